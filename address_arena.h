@@ -0,0 +1,395 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include "address_differ.h"
+#include "patch_codec.h"
+
+/*
+ * @brief Список адресов, значения которых лежат подряд в одном буфере байт.
+ * Запись хранит идентификатор, позицию и смещение значения в буфере; длина значения - разность соседних смещений.
+ * Список строится за один проход по заранее подсчитанному размеру, поэтому построение и освобождение - несколько выделений памяти
+ * независимо от количества адресов, а просмотр значений идет по памяти последовательно.
+ * Значения не попадают в пул строк; интернируются только значения, попавшие в операции предписания.
+ */
+class AddressArena
+{
+public:
+
+    AddressArena() = default;
+
+    /*
+     * @brief Формирует список из вектора адресов.
+     * @param addresses Вектор адресов.
+     */
+    explicit AddressArena( const std::vector< Address >& addresses );
+
+    /*
+     * @brief Разбирает полный список в кодировке PatchCodec прямо в буфер, без пула строк.
+     * @param data Закодированный список.
+     * @param arena Результат.
+     * @return false - данные повреждены.
+     */
+    static bool FromSnapshot( std::string_view data, AddressArena& arena );
+
+    /* @brief Преобразует список в вектор адресов */
+    std::vector< Address > ToVector() const;
+
+    /* @brief Количество адресов в списке */
+    size_t Size() const { return mIds.size(); }
+
+    /* @brief Суммарный размер значений, байт */
+    size_t Bytes() const { return mBytes.size(); }
+
+    /* @brief Резервирует место под заданное количество адресов и байт значений */
+    void Reserve( size_t size, size_t bytes );
+
+    /* @brief Добавляет адрес в конец списка */
+    void PushBack( size_t id, size_t position, std::string_view value );
+    void PushBack( const Address& address ) { PushBack( address.mId, address.mPosition, address.mValue.View() ); }
+
+    /* @brief Возвращает значение адреса по индексу */
+    std::string_view Value( size_t index ) const { return { mBytes.data() + mOffsets[ index ], mOffsets[ index + 1 ] - mOffsets[ index ] }; }
+
+    /* @brief Возвращает адрес по индексу. Значение интернируется */
+    Address At( size_t index ) const { return { InternedString( Value( index ) ), mIds[ index ], mPositions[ index ] }; }
+
+    const std::vector< size_t >& Ids() const { return mIds; }
+    const std::vector< size_t >& Positions() const { return mPositions; }
+
+    bool operator==( const AddressArena& rhs ) const
+    {
+        return this->mIds == rhs.mIds &&
+               this->mPositions == rhs.mPositions &&
+               this->mOffsets == rhs.mOffsets &&
+               this->mBytes == rhs.mBytes;
+    }
+
+private:
+
+    /* Уникальные идентификаторы адресов */
+    std::vector< size_t > mIds;
+
+    /* Позиции адресов в списке */
+    std::vector< size_t > mPositions;
+
+    /* Смещения значений в mBytes; последний элемент - конец последнего значения */
+    std::vector< size_t > mOffsets{ 0 };
+
+    /* Значения адресов подряд */
+    std::string mBytes;
+};
+
+AddressArena::AddressArena( const std::vector< Address >& addresses )
+{
+    size_t bytes = 0;
+    for( const auto& address : addresses )
+    {
+        bytes += address.mValue.View().size();
+    }
+    Reserve( addresses.size(), bytes );
+    for( const auto& address : addresses )
+    {
+        PushBack( address );
+    }
+}
+
+bool AddressArena::FromSnapshot( std::string_view data, AddressArena& arena )
+{
+    if( data.empty() || data.front() != PatchCodec::SNAPSHOT_MAGIC ) return false;
+    data.remove_prefix( 1 );
+
+    /* Значения занимают меньше, чем весь снимок, поэтому буфер не перераспределяется */
+    uint64_t count;
+    if( !PatchCodec::GetVarint( data, count ) || count > data.size() ) return false;
+    arena = AddressArena();
+    arena.Reserve( count, data.size() );
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        uint64_t id, position, size;
+        if( !PatchCodec::GetVarint( data, id ) || !PatchCodec::GetVarint( data, position ) || !PatchCodec::GetVarint( data, size ) || size > data.size() ) return false;
+        arena.PushBack( id, position, data.substr( 0, size ) );
+        data.remove_prefix( size );
+    }
+    return data.empty();
+}
+
+std::vector< Address > AddressArena::ToVector() const
+{
+    std::vector< Address > result;
+    result.reserve( Size() );
+    for( size_t i = 0; i < Size(); ++i )
+    {
+        result.push_back( At( i ) );
+    }
+    return result;
+}
+
+void AddressArena::Reserve( size_t size, size_t bytes )
+{
+    mIds.reserve( size );
+    mPositions.reserve( size );
+    mOffsets.reserve( size + 1 );
+    mBytes.reserve( bytes );
+}
+
+void AddressArena::PushBack( size_t id, size_t position, std::string_view value )
+{
+    mIds.push_back( id );
+    mPositions.push_back( position );
+    mBytes.append( value );
+    mOffsets.push_back( mBytes.size() );
+}
+
+/*
+ * @brief Хеш-индекс идентификатор -> индекс в массиве идентификаторов.
+ * Открытая адресация с линейным пробированием: ячейка хранит только индекс, идентификатор сравнивается по массиву.
+ * Одно выделение памяти и последовательные пробы вместо узлов std::unordered_map.
+ * @warning Массив идентификаторов должен жить дольше индекса и не меняться.
+ */
+class IdIndex
+{
+public:
+
+    static constexpr size_t npos = static_cast< size_t >( -1 );
+
+    /*
+     * @param ids Массив идентификаторов. При повторах находится первое вхождение.
+     */
+    explicit IdIndex( const std::vector< size_t >& ids );
+
+    /* @brief Индекс идентификатора или npos */
+    size_t Find( size_t id ) const
+    {
+        for( size_t slot = Slot( id ); mSlots[ slot ] != 0; slot = ( slot + 1 ) & mMask )
+        {
+            if( mIds[ mSlots[ slot ] - 1 ] == id ) return mSlots[ slot ] - 1;
+        }
+        return npos;
+    }
+
+private:
+
+    /* Мультипликативное хеширование: старшие биты произведения */
+    size_t Slot( size_t id ) const { return static_cast< size_t >( ( id * 0x9E3779B97F4A7C15ULL ) >> mShift ); }
+
+    const std::vector< size_t >& mIds;
+
+    /* Индекс + 1; 0 - пустая ячейка */
+    std::vector< size_t > mSlots;
+    size_t mMask;
+    unsigned mShift;
+};
+
+IdIndex::IdIndex( const std::vector< size_t >& ids )
+    : mIds( ids )
+{
+    /* Заполнение не больше половины */
+    unsigned bits = 4;
+    while( ( size_t( 1 ) << bits ) < ids.size() * 2 ) ++bits;
+    mSlots.assign( size_t( 1 ) << bits, 0 );
+    mMask = mSlots.size() - 1;
+    mShift = 64 - bits;
+
+    for( size_t i = 0; i < ids.size(); ++i )
+    {
+        size_t slot = Slot( ids[ i ] );
+        while( mSlots[ slot ] != 0 && mIds[ mSlots[ slot ] - 1 ] != ids[ i ] ) slot = ( slot + 1 ) & mMask;
+        if( mSlots[ slot ] == 0 ) mSlots[ slot ] = i + 1;
+    }
+}
+
+/*
+ * @brief Находит добавленные, удаленные и измененные элементы за линейные проходы по хеш-индексам.
+ * @param old_addresses Старый список адресов.
+ * @param updated_addresses Новый список адресов.
+ * @param result Результат сравнения без перемещений.
+ * @return Идентификаторы удаленных элементов.
+ */
+std::unordered_set< size_t > CompareArenaMembers( const AddressArena& old_addresses, const AddressArena& updated_addresses, CompareResult< Address >& result )
+{
+    const auto& old_ids = old_addresses.Ids();
+    const auto& updated_ids = updated_addresses.Ids();
+
+    IdIndex old_index( old_ids );
+    IdIndex updated_index( updated_ids );
+
+    /* Находим удаленные элементы */
+    std::unordered_set< size_t > deleted_ids;
+    for( size_t i = 0; i < old_ids.size(); ++i )
+    {
+        if( updated_index.Find( old_ids[ i ] ) != IdIndex::npos ) continue;
+        deleted_ids.emplace( old_ids[ i ] );
+        result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, old_addresses.At( i ), std::nullopt, old_addresses.Positions()[ i ], std::nullopt } );
+    }
+
+    /* Находим добавленные и измененные элементы за один проход; значения сравниваются побайтно */
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        auto position = updated_addresses.Positions()[ i ];
+        auto j = old_index.Find( updated_ids[ i ] );
+        if( j == IdIndex::npos )
+        {
+            result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, updated_addresses.At( i ), std::nullopt, position, std::nullopt } );
+        }
+        else if( old_addresses.Value( j ) != updated_addresses.Value( i ) )
+        {
+            result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses.At( j ), updated_addresses.At( i ), position, std::nullopt } );
+        }
+    }
+    return deleted_ids;
+}
+
+CompareResult< Address > DifferAddress::Compare( const AddressArena& old_addresses, const AddressArena& updated_addresses )
+{
+    CompareResult< Address > result;
+    auto deleted_ids = CompareArenaMembers( old_addresses, updated_addresses, result );
+    auto copy_ids = FormCopyIds( old_addresses.Ids(), result.mAddedOperations, deleted_ids );
+    ResolveMoves( copy_ids, updated_addresses.Ids(), [&]( size_t i ){ return updated_addresses.At( i ); }, result.mMovedOperations,
+        []( const OperationData< Address >& ){ return true; } );
+    return result;
+}
+
+CompareResult< Address > DifferAddress::ComparePermutation( const AddressArena& old_addresses, const AddressArena& updated_addresses )
+{
+    CompareResult< Address > result;
+    auto deleted_ids = CompareArenaMembers( old_addresses, updated_addresses, result );
+    auto copy_ids = FormCopyIds( old_addresses.Ids(), result.mAddedOperations, deleted_ids );
+
+    /* На позицию i нового списка встает элемент копии с тем же идентификатором; совпадающий хвост не записывается */
+    const auto& updated_ids = updated_addresses.Ids();
+    IdIndex copy_index( copy_ids );
+
+    size_t length = 0;
+    auto& permutation = result.mPermutation;
+    permutation.resize( updated_ids.size() );
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        permutation[ i ] = copy_index.Find( updated_ids[ i ] );
+        assert( permutation[ i ] != IdIndex::npos );
+        if( permutation[ i ] != i ) length = i + 1;
+    }
+    permutation.resize( length );
+    return result;
+}
+
+AddressArena DifferAddress::DoEditorialPrescription( const CompareResult< Address >& compare_result, const AddressArena& old_adresses )
+{
+    /* Записи результата: индекс в старом списке или, начиная с old_size, индекс значения из предписания */
+    const size_t old_size = old_adresses.Size();
+    std::vector< size_t > extra_ids;
+    std::vector< std::string_view > extra_values;
+    auto id_of = [&]( size_t record ){ return record < old_size ? old_adresses.Ids()[ record ] : extra_ids[ record - old_size ]; };
+    auto value_of = [&]( size_t record ){ return record < old_size ? old_adresses.Value( record ) : extra_values[ record - old_size ]; };
+
+    std::vector< size_t > order( old_size );
+    std::iota( order.begin(), order.end(), 0 );
+
+    /* Добавления по строгому возрастанию позиций - это слияние за один проход, иначе вставки по одной */
+    const auto& added = compare_result.mAddedOperations;
+    bool ascending = true;
+    for( size_t i = 1; i < added.size() && ascending; ++i )
+    {
+        ascending = added[ i - 1 ].mPositionStart < added[ i ].mPositionStart;
+    }
+    std::vector< size_t > with_added;
+    with_added.reserve( old_size + added.size() );
+    size_t next = 0;
+    for( const auto& elem : added )
+    {
+        size_t record = old_size + extra_ids.size();
+        extra_ids.push_back( elem.mValue.mId );
+        extra_values.push_back( elem.mValue.mValue.View() );
+        if( ascending )
+        {
+            assert( elem.mPositionStart <= with_added.size() + order.size() - next );
+            while( with_added.size() < elem.mPositionStart ) with_added.push_back( order[ next++ ] );
+            with_added.push_back( record );
+        }
+        else
+        {
+            order.insert( order.begin() + elem.mPositionStart, record );
+        }
+        if( mVerbose ) std::cout << " Added  " << elem.mValue << " to position " << elem.mPositionStart << std::endl;
+    }
+    if( ascending )
+    {
+        with_added.insert( with_added.end(), order.begin() + next, order.end() );
+        order.swap( with_added );
+    }
+
+    std::unordered_set< size_t > deleted_ids;
+    for( const auto& elem : compare_result.mDeletedOperations )
+    {
+        deleted_ids.emplace( elem.mValue.mId );
+        if( mVerbose ) std::cout << " Deleted  " << elem.mValue << std::endl;
+    }
+    if( !deleted_ids.empty() )
+    {
+        size_t before = order.size();
+        order.erase( std::remove_if( order.begin(), order.end(), [&]( size_t record ){ return deleted_ids.count( id_of( record ) ) != 0; } ), order.end() );
+        assert( before - order.size() == compare_result.mDeletedOperations.size() );
+    }
+
+    /* Новое значение становится отдельной записью; при повторных изменениях побеждает последнее */
+    std::unordered_map< size_t, size_t > changed;
+    for( const auto& elem : compare_result.mChandedOperations )
+    {
+        changed[ elem.mValue.mId ] = old_size + extra_ids.size();
+        extra_ids.push_back( elem.mValue.mId );
+        extra_values.push_back( elem.mNewValue->mValue.View() );
+        if( mVerbose ) std::cout << "Changed  Old value:  " << elem.mValue << " New value " << *elem.mNewValue << std::endl;
+    }
+    if( !changed.empty() )
+    {
+        for( auto& record : order )
+        {
+            if( auto it = changed.find( id_of( record ) ); it != changed.end() ) record = it->second;
+        }
+    }
+
+    auto reorder = [&]( const std::vector< size_t >& permutation )
+    {
+        assert( permutation.size() <= order.size() );
+        std::vector< size_t > reordered( permutation.size() );
+        for( size_t i = 0; i < permutation.size(); ++i )
+        {
+            reordered[ i ] = order[ permutation[ i ] ];
+        }
+        std::copy( reordered.begin(), reordered.end(), order.begin() );
+    };
+    if( !compare_result.mMovedOperations.empty() )
+    {
+        reorder( MovesToPermutation( compare_result.mMovedOperations ) );
+        if( mVerbose )
+        {
+            for( const auto& elem : compare_result.mMovedOperations )
+            {
+                std::cout << " Moved  " << elem.mValue << " from position " << elem.mPositionStart << " to position " << *elem.mPositionEnd << std::endl;
+            }
+        }
+    }
+    if( !compare_result.mPermutation.empty() )
+    {
+        reorder( compare_result.mPermutation );
+        if( mVerbose ) std::cout << " Reordered  " << compare_result.mPermutation.size() << " first elements" << std::endl;
+    }
+
+    /* Сборка результата: размер буфера известен заранее, позиции исправляются по порядку */
+    size_t bytes = 0;
+    for( auto record : order )
+    {
+        bytes += value_of( record ).size();
+    }
+    AddressArena result;
+    result.Reserve( order.size(), bytes );
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+        result.PushBack( id_of( order[ i ] ), i, value_of( order[ i ] ) );
+    }
+    return result;
+}
@@ -0,0 +1,195 @@
+/*
+ * address-diff: сравнивает два списка адресов в файлах CSV или TSV (идентификатор, позиция, значение)
+ * и выводит редакционное предписание текстом или в двоичной кодировке PatchCodec.
+ *
+ *   address-diff [--binary] [--output FILE] [--stats] OLD NEW
+ *
+ * Текстовый вывод - строка на операцию:
+ *   + позиция идентификатор значение    добавление
+ *   - позиция идентификатор             удаление
+ *   ~ позиция идентификатор значение    изменение
+ *   > откуда куда                       перестановка: элемент с позиции "откуда" встает на позицию "куда"
+ */
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <address_differ.h>
+#include <address_arena.h>
+#include <address_loader.h>
+#include <patch_codec.h>
+
+/* @brief Буферизованная запись в файл: данные копятся в буфере и сбрасываются крупными блоками */
+class BufferedWriter
+{
+public:
+
+    /*
+     * @param file Открытый файл.
+     * @param capacity Размер буфера, байт.
+     */
+    explicit BufferedWriter( FILE* file, size_t capacity = 1 << 20 )
+        : mFile( file ) { mBuffer.reserve( capacity ); }
+
+    ~BufferedWriter() { Flush(); }
+
+    void Write( std::string_view data )
+    {
+        if( mBuffer.size() + data.size() > mBuffer.capacity() ) Flush();
+        if( data.size() > mBuffer.capacity() ) WriteOut( data );
+        else mBuffer.append( data );
+    }
+
+    void Write( char c )
+    {
+        if( mBuffer.size() == mBuffer.capacity() ) Flush();
+        mBuffer.push_back( c );
+    }
+
+    void Write( size_t value )
+    {
+        char digits[ 20 ];
+        auto end = std::to_chars( digits, digits + sizeof( digits ), value ).ptr;
+        Write( std::string_view( digits, end - digits ) );
+    }
+
+    /* @brief Сбрасывает буфер. false - ошибка записи */
+    bool Flush()
+    {
+        WriteOut( mBuffer );
+        mBuffer.clear();
+        return mOk && std::fflush( mFile ) == 0;
+    }
+
+private:
+
+    void WriteOut( std::string_view data )
+    {
+        if( !data.empty() && std::fwrite( data.data(), 1, data.size(), mFile ) != data.size() ) mOk = false;
+    }
+
+    FILE* mFile;
+    std::string mBuffer;
+    bool mOk = true;
+};
+
+/*
+ * @brief Записывает предписание текстом.
+ * @param compare_result Редакционное предписание.
+ * @param out Поток вывода.
+ */
+void WriteText( const CompareResult< Address >& compare_result, BufferedWriter& out )
+{
+    auto line = [&]( char kind, size_t position, size_t id, const InternedString* value )
+    {
+        out.Write( kind );
+        out.Write( ' ' );
+        out.Write( position );
+        out.Write( ' ' );
+        out.Write( id );
+        if( value )
+        {
+            out.Write( ' ' );
+            out.Write( value->View() );
+        }
+        out.Write( '\n' );
+    };
+    for( const auto& elem : compare_result.mAddedOperations ) line( '+', elem.mPositionStart, elem.mValue.mId, &elem.mValue.mValue );
+    for( const auto& elem : compare_result.mDeletedOperations ) line( '-', elem.mPositionStart, elem.mValue.mId, nullptr );
+    for( const auto& elem : compare_result.mChandedOperations ) line( '~', elem.mPositionStart, elem.mValue.mId, &elem.mNewValue->mValue );
+    for( size_t i = 0; i < compare_result.mPermutation.size(); ++i )
+    {
+        if( compare_result.mPermutation[ i ] == i ) continue;
+        out.Write( "> " );
+        out.Write( compare_result.mPermutation[ i ] );
+        out.Write( ' ' );
+        out.Write( i );
+        out.Write( '\n' );
+    }
+}
+
+int Usage()
+{
+    std::cerr << "usage: address-diff [--binary] [--output FILE] [--stats] OLD NEW" << std::endl;
+    return 2;
+}
+
+int main( int argc, char** argv )
+{
+    bool binary = false;
+    bool stats = false;
+    std::string output;
+    std::vector< std::string > inputs;
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string_view arg = argv[ i ];
+        if( arg == "--binary" ) binary = true;
+        else if( arg == "--stats" ) stats = true;
+        else if( arg == "--output" && i + 1 < argc ) output = argv[ ++i ];
+        else if( arg.size() > 1 && arg[ 0 ] == '-' ) return Usage();
+        else inputs.emplace_back( arg );
+    }
+    if( inputs.size() != 2 ) return Usage();
+
+    FILE* file = output.empty() ? stdout : std::fopen( output.c_str(), "wb" );
+    if( !file )
+    {
+        std::cerr << "address-diff: cannot open " << output << ": " << std::strerror( errno ) << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        auto start = std::chrono::steady_clock::now();
+        /* Файлы разбираются одновременно */
+        auto old_loading = std::async( std::launch::async, AddressLoader::Load, inputs[ 0 ] );
+        auto updated_addresses = AddressLoader::Load( inputs[ 1 ] );
+        auto old_addresses = old_loading.get();
+        auto loaded = std::chrono::steady_clock::now();
+
+        /* Порядок записывается перестановкой: время линейно при любом количестве перемещений */
+        auto compare_result = DifferAddress( false ).ComparePermutation( old_addresses, updated_addresses );
+        auto compared = std::chrono::steady_clock::now();
+
+        BufferedWriter out( file );
+        if( binary )
+        {
+            std::string encoded;
+            PatchCodec::EncodePatch( compare_result, encoded );
+            out.Write( encoded );
+        }
+        else
+        {
+            WriteText( compare_result, out );
+        }
+        if( !out.Flush() ) throw std::runtime_error( "write failed: " + std::string( std::strerror( errno ) ) );
+
+        if( stats )
+        {
+            auto seconds = []( auto from, auto to ){ return std::chrono::duration< double >( to - from ).count(); };
+            double total = seconds( start, std::chrono::steady_clock::now() );
+            auto input_bytes = std::filesystem::file_size( inputs[ 0 ] ) + std::filesystem::file_size( inputs[ 1 ] );
+            std::cerr << "addresses " << old_addresses.Size() << " -> " << updated_addresses.Size()
+                      << ", added " << compare_result.mAddedOperations.size() << ", deleted " << compare_result.mDeletedOperations.size()
+                      << ", changed " << compare_result.mChandedOperations.size() << ", reordered " << compare_result.mPermutation.size() << std::endl
+                      << "load " << seconds( start, loaded ) << " s, diff " << seconds( loaded, compared ) << " s, total " << total << " s, "
+                      << input_bytes / total / 1e9 << " GB/s" << std::endl;
+        }
+    }
+    catch( const std::exception& error )
+    {
+        std::cerr << "address-diff: " << error.what() << std::endl;
+        if( file != stdout ) std::fclose( file );
+        return 1;
+    }
+
+    if( file != stdout ) std::fclose( file );
+    return 0;
+}
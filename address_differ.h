@@ -1,10 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <array>
+#include <cstdint>
 #include <algorithm>
 #include <optional>
 #include <cassert>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <type_traits>
+#include "string_pool.h"
+#include "allocation_profiler.h"
 
 /* @brief Тип операции */
 enum class OPERATION_TYPE
@@ -56,13 +63,19 @@ struct CompareResult
 
     /* Операции перемещения */
     std::vector<OperationData<ValueType>> mMovedOperations;
+
+    /*
+     * Перестановка, выполняемая после перемещений: на позицию i встает элемент с позиции mPermutation[ i ].
+     * Позиции за пределами перестановки не меняются. Пустая - перестановки нет.
+     */
+    std::vector< std::size_t > mPermutation = {};
 };
 
 /* @brief Структура адреса */
 struct Address
 {
-    /* Значение адреса */
-    std::string mValue;
+    /* Значение адреса. Хранится в общем пуле строк, сравнение значений - сравнение указателей */
+    InternedString mValue;
 
     /* Уникальный идентификатор адреса */
     size_t mId;
@@ -110,6 +123,17 @@ struct ShiftDiff
     std::size_t mPosition;
 };
 
+class AddressList;
+class AddressArena;
+struct CompareBudget;
+struct BoundedCompareResult;
+class CancellationToken;
+struct CancellableCompareResult;
+struct CancellableApplyResult;
+class PersistentAddressList;
+class ReconciliationSketch;
+struct MergeResult;
+
 /*
  * @brief Класс содержит логику по формированию разницы между 2 списками адрессов.
  */
@@ -118,6 +142,12 @@ class DifferAddress
 
 public:
 
+    /*
+     * @param verbose Печатать выполняемые операции в DoEditorialPrescription.
+     */
+    explicit DifferAddress( bool verbose = true )
+        : mVerbose( verbose ) {}
+
     /*
      * @brief Сравнивает 2 списка адресов.
      * @param old_addresses Старый список адресов.
@@ -126,6 +156,163 @@ public:
      */
     CompareResult< Address > Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses );
 
+    /*
+     * @brief Сравнивает 2 списка адресов, которые больше не нужны вызывающему.
+     * @details Значения удаленных, добавленных и измененных элементов переносятся из списков в операции без копирования,
+     * копируются только значения перемещений. После вызова значения в списках пусты, идентификаторы и позиции сохраняются.
+     * Результат совпадает с результатом сравнения константных списков.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @return Результат сравнения.
+     */
+    CompareResult< Address > Compare( std::vector< Address >&& old_addresses, std::vector< Address >&& updated_addresses );
+
+    /*
+     * @brief Сравнивает 2 списка адресов, хранящихся по столбцам. Поиск по идентификаторам идет по плотным массивам без обращения к значениям.
+     * @details Определение находится в address_list.h. Результат совпадает с результатом сравнения векторов адресов.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @return Результат сравнения.
+     */
+    CompareResult< Address > Compare( const AddressList& old_addresses, const AddressList& updated_addresses );
+
+    /*
+     * @brief Сравнивает 2 списка адресов, значения которых лежат в непрерывных буферах.
+     * @details Определение находится в address_arena.h. Поиск по идентификаторам идет через хеш-индекс,
+     * значения сравниваются побайтно без обращения к пулу строк. Результат совпадает с результатом сравнения векторов адресов.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @return Результат сравнения.
+     */
+    CompareResult< Address > Compare( const AddressArena& old_addresses, const AddressArena& updated_addresses );
+
+    /*
+     * @brief Сравнивает 2 списка с непрерывным буфером значений, записывая порядок перестановкой вместо перемещений.
+     * @details Определение находится в address_arena.h. Добавления, удаления и изменения совпадают с Compare,
+     * mMovedOperations пуст, mPermutation приводит список к новому порядку. Время линейно при любом количестве перестановок.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @return Результат сравнения.
+     */
+    CompareResult< Address > ComparePermutation( const AddressArena& old_addresses, const AddressArena& updated_addresses );
+
+    /*
+     * @brief Сравнивает 2 списка адресов, формируя только заданные типы операций.
+     * @details Фазы и вспомогательные массивы невыбранных операций не компилируются. Поиск по идентификаторам идет через хеш-индекс,
+     * поэтому сравнение только по составу (ADDED, DELETED) или только по значениям (CHANGED) - один линейный проход.
+     * Выбранные операции совпадают с результатом полного сравнения.
+     * @tparam Ops Типы операций, которые нужно сформировать.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @return Результат сравнения.
+     */
+    template< OPERATION_TYPE... Ops >
+    CompareResult< Address > Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses );
+
+    /* Наибольший размер списков для CompareSmall */
+    static constexpr size_t SMALL_LIST_SIZE = 64;
+
+    /*
+     * @brief Сравнивает 2 коротких списка без выделения памяти в куче.
+     * @details Индексы идентификаторов - хеш-таблицы на стеке, добавленные и удаленные отмечаются битовыми масками,
+     * перемещения ищутся на перестановке индексов размером в байт. Операции дописываются в векторы result, которые
+     * предварительно очищаются. Добавлений, удалений и изменений не больше SMALL_LIST_SIZE, а перемещения пишутся только
+     * в пределах емкости mMovedOperations: количество перемещений может превышать n, и его граница не доказана. Поэтому
+     * с результатом, зарезервированным ReserveSmall, память не выделяется никогда.
+     * Compare и Compare< ADDED, DELETED, CHANGED, MOVED > сами переходят сюда для коротких списков, без ограничения перемещений.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @param result Результат сравнения, совпадает с результатом Compare.
+     * @return false - список длиннее SMALL_LIST_SIZE, идентификаторы повторяются или перемещения не уместились
+     * в емкость mMovedOperations; result тогда пуст.
+     */
+    bool CompareSmall( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, CompareResult< Address >& result );
+
+    /*
+     * @brief Резервирует векторы операций под любой результат CompareSmall.
+     * @param result Результат сравнения, переиспользуемый между вызовами.
+     */
+    static void ReserveSmall( CompareResult< Address >& result );
+
+    /*
+     * @brief Сравнивает 2 списка адресов, пока предписание укладывается в бюджет.
+     * @details Определение находится в bounded_compare.h. Как только количество операций или размер закодированного предписания
+     * превышает бюджет, сравнение прекращается и возвращается оценка полного размера.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @param budget Бюджет предписания.
+     * @return Результат сравнения или оценка размера при превышении бюджета.
+     */
+    BoundedCompareResult CompareBounded( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, const CompareBudget& budget );
+
+    /*
+     * @brief Сравнивает 2 списка адресов с возможностью отмены.
+     * @details Определение находится в cancellable_compare.h. Отмена и срок проверяются в долгих циклах; при срабатывании
+     * сравнение прекращается и возвращается признак незавершенности с уже найденными операциями.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     * @param token Признак отмены и срок.
+     * @return Результат сравнения. Если сравнение завершено, совпадает с результатом Compare.
+     */
+    CancellableCompareResult Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, const CancellationToken& token );
+
+    /*
+     * @brief Сравнивает 2 версии неизменяемого списка адресов.
+     * @details Определение находится в persistent_list.h. Общие для обеих версий отрезки находятся по равенству указателей и не просматриваются:
+     * добавления, удаления и изменения ищутся только в остальных. Если порядок элементов поменялся, перемещения ищутся по спискам целиком.
+     * Результат совпадает с результатом сравнения векторов адресов.
+     * @param old_addresses Старая версия.
+     * @param updated_addresses Новая версия.
+     * @return Результат сравнения.
+     */
+    CompareResult< Address > Compare( const PersistentAddressList& old_addresses, const PersistentAddressList& updated_addresses );
+
+    /*
+     * @brief Сравнивает удаленный список, от которого есть только эскиз, с локальным.
+     * @details Определение находится в reconciliation.h. Из разности эскизов восстанавливаются отличающиеся записи, по ним -
+     * идентификаторы и порядок старого списка. Добавления, удаления и перемещения совпадают с Compare. Старые значения
+     * удаленных и измененных элементов неизвестны: в операциях они пустые, DoEditorialPrescription их не использует.
+     * @param old_sketch Эскиз старого списка.
+     * @param updated_addresses Новый список адресов.
+     * @param result Результат сравнения.
+     * @return false - отличий больше, чем вмещает эскиз; нужен эскиз большего размера.
+     */
+    bool Compare( const ReconciliationSketch& old_sketch, const std::vector< Address >& updated_addresses, CompareResult< Address >& result );
+
+    /*
+     * @brief Трехстороннее слияние: объединяет изменения двух списков, независимо полученных из общего базового.
+     * @details Определение находится в merge.h.
+     * @param base Базовый список адресов.
+     * @param ours Первый измененный список. Его изменения побеждают в конфликтах.
+     * @param theirs Второй измененный список.
+     * @return Объединенный список и конфликты.
+     */
+    MergeResult Merge( const std::vector< Address >& base, const std::vector< Address >& ours, const std::vector< Address >& theirs );
+
+    /*
+     * @brief Переигрывает перемещения на массиве индексов и возвращает итоговую перестановку.
+     * @details Перестановка покрывает позиции до самой дальней позиции перемещений включительно.
+     * @param moved_operations Операции перемещения.
+     * @return Перестановка: на позицию i встает элемент с позиции result[ i ].
+     */
+    static std::vector< size_t > MovesToPermutation( const std::vector< OperationData< Address > >& moved_operations );
+
+    /*
+     * @brief Места добавленных элементов в списке после всех вставок.
+     * @details Добавления вставляются по одному, поэтому более поздняя вставка перед добавленным элементом сдвигает его.
+     * Добавления по возрастанию позиций, как их формирует Compare, не сдвигаются - тогда время линейно.
+     * @param added_operations Операции добавления.
+     * @return Место каждого добавления в порядке операций.
+     */
+    static std::vector< size_t > AddedSlots( const std::vector< OperationData< Address > >& added_operations );
+
+    /*
+     * @brief Позиция элемента в списке со вставками по его позиции в списке без них.
+     * @param slots Места вставок по возрастанию.
+     * @param index Позиция в списке без вставок.
+     */
+    static size_t SkipSlots( const std::vector< size_t >& slots, size_t index );
+
     /*
      * @brief Распечатать редакционное предписание для результата сравнения.
      * @param compare_result Результат сравнения.
@@ -139,6 +326,43 @@ public:
      */
     std::vector< Address > DoEditorialPrescription( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses );
 
+    /*
+     * @brief Выполняет редакционное предписание, которое больше не нужно вызывающему.
+     * @details Значения добавлений и изменений переносятся из предписания в результат без копирования.
+     * @param compare_result Редакционное предписание. После вызова значения в операциях пусты.
+     * @param old_adresses Начальный массив адресов. Передается перемещением, чтобы не копировать.
+     */
+    std::vector< Address > DoEditorialPrescription( CompareResult< Address >&& compare_result, std::vector< Address > old_adresses );
+
+    /*
+     * @brief Выполняет редакционное предписание с возможностью отмены.
+     * @details Определение находится в cancellable_compare.h. Отмена и срок проверяются перед каждой операцией.
+     * @param compare_result Редакционное предписание.
+     * @param old_adresses Начальный массив адресов.
+     * @param token Признак отмены и срок.
+     */
+    CancellableApplyResult DoEditorialPrescription( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses,
+        const CancellationToken& token );
+
+    /*
+     * @brief Выполняет редакционное предписание над неизменяемым списком, не копируя его.
+     * @details Определение находится в persistent_list.h. Каждая операция стоит O(log n) и копирует один отрезок,
+     * нетронутые отрезки разделяются со старой версией.
+     * @param compare_result Редакционное предписание.
+     * @param old_adresses Начальная версия списка.
+     * @return Новая версия списка.
+     */
+    PersistentAddressList DoEditorialPrescription( const CompareResult< Address >& compare_result, const PersistentAddressList& old_adresses );
+
+    /*
+     * @brief Выполняет редакционное предписание для списка с непрерывным буфером значений.
+     * @details Определение находится в address_arena.h. Сначала строится порядок записей результата,
+     * затем результат собирается одним копированием значений в буфер заранее подсчитанного размера.
+     * @param compare_result Редакционное предписание.
+     * @param old_adresses Начальный список адресов.
+     */
+    AddressArena DoEditorialPrescription( const CompareResult< Address >& compare_result, const AddressArena& old_adresses );
+
 private:
 
     /*
@@ -157,6 +381,13 @@ private:
         InputIt2 first2, InputIt2 last2, OutputIt d_first, Comp comp );
 
 
+    /*
+     * @brief Сравнение коротких списков для CompareSmall и перехода на короткий путь из Compare.
+     * @param max_moves Наибольшее количество перемещений; при превышении возвращается false и result очищается.
+     */
+    bool CompareSmall( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, CompareResult< Address >& result,
+        size_t max_moves );
+
     /*
      * @brief Формирует список элементов с информацией о сдвигах в порядке элементов в 2 списках.
      * @warning По содержанию оба массива должны быть равны.
@@ -166,6 +397,15 @@ private:
      */
     std::vector< ShiftDiff > FormShifts( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses );
 
+    /*
+     * @brief Формирует список сдвигов по массивам идентификаторов.
+     * @warning По содержанию оба массива должны быть равны.
+     * @param old_ids Идентификаторы старого списка.
+     * @param updated_ids Идентификаторы нового списка.
+     * @return Результат сравнения.
+     */
+    std::vector< ShiftDiff > FormShifts( const std::vector< size_t >& old_ids, const std::vector< size_t >& updated_ids );
+
     /*
      * @brief Проверяет есть ли сдвиги элементов в списке со сдвигами.
      * @param shifts Список со сдвигами элементов.
@@ -180,7 +420,80 @@ private:
      * @param shift - Количество элементов, на которое надо сдвинуть.
      * @param direction - Направление сдвига.
      */
-    void MoveElementInVector( std::vector< Address >& vec, size_t position, size_t shift, DIRECTION direction );
+    template< typename T >
+    void MoveElementInVector( std::vector< T >& vec, size_t position, size_t shift, DIRECTION direction );
+
+    /* Проверка срока для FormCopyIds и ResolveMoves, которая никогда не срабатывает */
+    struct NeverExpired
+    {
+        bool operator()() const { return false; }
+    };
+
+    /*
+     * @brief Формирует копию старого списка по идентификаторам: добавляет новые элементы и удаляет старые, как в полном сравнении.
+     * @param old_addresses Старый список адресов.
+     * @param added_operations Операции добавления.
+     * @param deleted_ids Идентификаторы удаленных элементов.
+     * @param expired Опрашивается раз в 4096 элементов и перед каждой вставкой по одной. Вернула true - копия остается недостроенной.
+     * @return Идентификаторы копии старого списка.
+     */
+    template< typename Expired = NeverExpired >
+    std::vector< size_t > FormCopyIds( const std::vector< Address >& old_addresses, const std::vector< OperationData< Address > >& added_operations,
+        const std::unordered_set< size_t >& deleted_ids, Expired expired = {} );
+
+    /*
+     * @brief Формирует копию старого списка по идентификаторам старого списка.
+     * @param copy_ids Идентификаторы старого списка.
+     * @param added_operations Операции добавления.
+     * @param deleted_ids Идентификаторы удаленных элементов.
+     * @param expired Опрашивается раз в 4096 элементов и перед каждой вставкой по одной. Вернула true - копия остается недостроенной.
+     * @return Идентификаторы копии старого списка.
+     */
+    template< typename Expired = NeverExpired >
+    std::vector< size_t > FormCopyIds( std::vector< size_t > copy_ids, const std::vector< OperationData< Address > >& added_operations,
+        const std::unordered_set< size_t >& deleted_ids, Expired expired = {} );
+
+    /*
+     * @brief Переставляет копию старого списка в порядок нового списка, формируя операции перемещения.
+     * @warning По содержанию оба списка должны быть равны.
+     * @param copy_ids Идентификаторы копии старого списка.
+     * @param updated_addresses Новый список адресов.
+     * @param moved_operations Операции перемещения.
+     * @param on_move Вызывается после каждого перемещения. Вернула false - перестановка прерывается.
+     * @param expired Опрашивается раз в 4096 элементов при построении индекса и выборе перемещения. Вернула true - перестановка прерывается.
+     * @return true - порядок совпал, false - перестановка прервана.
+     */
+    template< typename OnMove, typename Expired = NeverExpired >
+    bool ResolveMoves( std::vector< size_t >& copy_ids, const std::vector< Address >& updated_addresses,
+        std::vector< OperationData< Address > >& moved_operations, OnMove on_move, Expired expired = {} );
+
+    /*
+     * @brief Переставляет копию старого списка в порядок нового списка, заданного идентификаторами.
+     * @param copy_ids Идентификаторы копии старого списка.
+     * @param updated_ids Идентификаторы нового списка.
+     * @param address_at Возвращает адрес нового списка по индексу - для операций перемещения.
+     * @param moved_operations Операции перемещения.
+     * @param on_move Вызывается после каждого перемещения. Вернула false - перестановка прерывается.
+     * @param expired Опрашивается раз в 4096 элементов при построении индекса и выборе перемещения. Вернула true - перестановка прерывается.
+     * @return true - порядок совпал, false - перестановка прервана.
+     */
+    template< typename AddressAt, typename OnMove, typename Expired = NeverExpired >
+    bool ResolveMoves( std::vector< size_t >& copy_ids, const std::vector< size_t >& updated_ids, AddressAt address_at,
+        std::vector< OperationData< Address > >& moved_operations, OnMove on_move, Expired expired = {} );
+
+    /*
+     * @brief Выполняет операции предписания над массивом адресов по порядку.
+     * @tparam Result CompareResult< Address > - значения переносятся из предписания, const CompareResult< Address > - копируются.
+     * @param compare_result Редакционное предписание.
+     * @param result Массив адресов, изменяется на месте.
+     * @param should_stop Вызывается перед каждой операцией. Вернула true - выполнение прерывается, позиции не перенумеровываются.
+     * @return Количество выполненных операций; перестановка считается одной операцией.
+     */
+    template< typename Result, typename ShouldStop >
+    size_t ApplyOperations( Result& compare_result, std::vector< Address >& result, ShouldStop should_stop );
+
+    /* Печатать выполняемые операции в DoEditorialPrescription */
+    bool mVerbose;
 
 };
 
@@ -210,7 +523,7 @@ struct AddressIdComparator
     size_t mId;
 };
 
-/* Компаратор для отбора изменившихся элементов */
+/* Компаратор для отбора изменившихся элементов. Значения интернированы, поэтому сравниваются указатели на записи пула */
 template<typename InputIt1>
 struct ChangeElementsAddressComparator
 {
@@ -224,6 +537,9 @@ struct ChangeElementsAddressComparator
 
 CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses )
 {
+    AllocationPhase total( "compare" );
+    if( CompareResult< Address > small; CompareSmall( old_addresses, updated_addresses, small, SIZE_MAX ) ) return small;
+    AllocationPhase phase( "compare.reserve" );
     std::vector<OperationData<Address>> added_operations;
     added_operations.reserve( updated_addresses.size() );
     std::vector<OperationData<Address>> deleted_operations;
@@ -239,6 +555,7 @@ CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& o
     changed_elements.reserve( old_addresses.size() );
 
     NewElementsAddressComparator< decltype ( old_addresses.begin() ) > new_element_comparator;
+    phase.Restart( "compare.set_difference" );
 
     /* Находим добавленные элементы */
     SetDifference( old_addresses.begin(), old_addresses.end(), updated_addresses.begin(), updated_addresses.end(), std::back_inserter( deleted_elements ), new_element_comparator );
@@ -246,6 +563,7 @@ CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& o
     /* Находим удаленные элементы */
     SetDifference( updated_addresses.begin(), updated_addresses.end(), old_addresses.begin(), old_addresses.end(), std::back_inserter( added_elements  ), new_element_comparator );
 
+    phase.Restart( "compare.copy" );
     std::vector< Address > old_copy( old_addresses.begin(), old_addresses.end() );
 
     for( const auto& elem: added_elements )
@@ -271,6 +589,7 @@ CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& o
                     return std::find_if( deleted_elements.begin(), deleted_elements.end(), AddressIdComparator( elem.mId ) ) != deleted_elements.end(); }),
              old_copy.end());
 
+    phase.Restart( "compare.changes" );
     ChangeElementsAddressComparator< decltype ( old_addresses.begin() ) > change_element_comparator;
     /* Находим измененные элементы */
     SetDifference( updated_addresses.begin(), updated_addresses.end(), old_copy.begin(), old_copy.end(), std::back_inserter( changed_elements ), change_element_comparator );
@@ -281,6 +600,7 @@ CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& o
     }
 
     /* Формируем сдвиги элементов относительно друг друга */
+    phase.Restart( "compare.moves" );
     auto shifts = FormShifts( old_copy, updated_addresses );
 
     while( HasShifts( shifts ) )
@@ -310,6 +630,450 @@ CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& o
     return CompareResult<Address>{ std::move( added_operations ), std::move( deleted_operations ), std::move( chanded_operations ), std::move( moved_operations ),};
 }
 
+template< OPERATION_TYPE... Ops >
+CompareResult< Address > DifferAddress::Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses )
+{
+    static_assert( sizeof...( Ops ) > 0, "at least one operation type must be selected" );
+    constexpr bool with_added = ( ( Ops == OPERATION_TYPE::ADDED ) || ... );
+    constexpr bool with_deleted = ( ( Ops == OPERATION_TYPE::DELETED ) || ... );
+    constexpr bool with_changed = ( ( Ops == OPERATION_TYPE::CHANGED ) || ... );
+    constexpr bool with_moved = ( ( Ops == OPERATION_TYPE::MOVED ) || ... );
+
+    AllocationPhase total( "indexed_compare" );
+    CompareResult< Address > result;
+    if constexpr ( with_added && with_deleted && with_changed && with_moved )
+    {
+        if( CompareSmall( old_addresses, updated_addresses, result, SIZE_MAX ) ) return result;
+    }
+    AllocationPhase phase( "indexed_compare.index" );
+
+    /* Индекс идентификаторов старого списка. Для повторяющихся идентификаторов хранится первый, как при поиске find_if */
+    std::unordered_map< size_t, size_t > old_index;
+    if constexpr ( with_added || with_changed || with_moved )
+    {
+        old_index.reserve( old_addresses.size() );
+        for( size_t i = 0; i < old_addresses.size(); ++i )
+        {
+            old_index.emplace( old_addresses[ i ].mId, i );
+        }
+    }
+
+    /* Удаленные идентификаторы нужны только для перемещений; пустой контейнер не выделяет память */
+    std::unordered_set< size_t > deleted_ids;
+
+    if constexpr ( with_deleted || with_moved )
+    {
+        std::unordered_map< size_t, size_t > updated_index;
+        updated_index.reserve( updated_addresses.size() );
+        for( size_t i = 0; i < updated_addresses.size(); ++i )
+        {
+            updated_index.emplace( updated_addresses[ i ].mId, i );
+        }
+
+        /* Находим удаленные элементы */
+        phase.Restart( "indexed_compare.operations" );
+        for( const auto& elem : old_addresses )
+        {
+            if( updated_index.count( elem.mId ) == 0 )
+            {
+                if constexpr ( with_deleted ) result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+                if constexpr ( with_moved ) deleted_ids.emplace( elem.mId );
+            }
+        }
+    }
+
+    if constexpr ( !( with_deleted || with_moved ) ) phase.Restart( "indexed_compare.operations" );
+    if constexpr ( with_added || with_moved )
+    {
+        /* Находим добавленные элементы */
+        for( const auto& elem : updated_addresses )
+        {
+            if( old_index.count( elem.mId ) == 0 )
+            {
+                result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+            }
+        }
+    }
+
+    if constexpr ( with_changed )
+    {
+        /* Находим измененные элементы: в копии старого списка у существующих элементов старые значения */
+        for( const auto& elem : updated_addresses )
+        {
+            auto it = old_index.find( elem.mId );
+            if( it != old_index.end() && old_addresses[ it->second ].mValue != elem.mValue )
+            {
+                result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses[ it->second ], elem, elem.mPosition, std::nullopt } );
+            }
+        }
+    }
+
+    if constexpr ( with_moved )
+    {
+        phase.Restart( "indexed_compare.moves" );
+        auto copy_ids = FormCopyIds( old_addresses, result.mAddedOperations, deleted_ids );
+        ResolveMoves( copy_ids, updated_addresses, result.mMovedOperations, []( const OperationData< Address >& ){ return true; } );
+
+        if constexpr ( !with_added ) result.mAddedOperations.clear();
+    }
+
+    return result;
+}
+
+void DifferAddress::ReserveSmall( CompareResult< Address >& result )
+{
+    result.mAddedOperations.reserve( SMALL_LIST_SIZE );
+    result.mDeletedOperations.reserve( SMALL_LIST_SIZE );
+    result.mChandedOperations.reserve( SMALL_LIST_SIZE );
+    /* Перемещений бывает больше, чем элементов: на перестановках 64 элементов встречалось до 103. Больше емкости CompareSmall не пишет */
+    result.mMovedOperations.reserve( 4 * SMALL_LIST_SIZE );
+}
+
+bool DifferAddress::CompareSmall( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, CompareResult< Address >& result )
+{
+    return CompareSmall( old_addresses, updated_addresses, result, result.mMovedOperations.capacity() );
+}
+
+bool DifferAddress::CompareSmall( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, CompareResult< Address >& result,
+    size_t max_moves )
+{
+    result.mAddedOperations.clear();
+    result.mDeletedOperations.clear();
+    result.mChandedOperations.clear();
+    result.mMovedOperations.clear();
+    result.mPermutation.clear();
+    const size_t old_size = old_addresses.size();
+    const size_t updated_size = updated_addresses.size();
+    if( old_size > SMALL_LIST_SIZE || updated_size > SMALL_LIST_SIZE ) return false;
+
+    /* Хеш-таблица идентификаторов с линейным пробированием: в ячейке индекс + 1, 0 - пустая; заполнена не больше чем наполовину */
+    using Table = std::array< uint8_t, 2 * SMALL_LIST_SIZE >;
+    constexpr size_t npos = SMALL_LIST_SIZE;
+    auto slot = []( size_t id ){ return static_cast< size_t >( ( id * 0x9E3779B97F4A7C15ULL ) >> 57 ); };
+    auto insert = [&]( Table& table, const std::vector< Address >& list, size_t index )
+    {
+        size_t s = slot( list[ index ].mId );
+        for( ; table[ s ] != 0; s = ( s + 1 ) % table.size() )
+        {
+            if( list[ table[ s ] - 1 ].mId == list[ index ].mId ) return false;
+        }
+        table[ s ] = static_cast< uint8_t >( index + 1 );
+        return true;
+    };
+    Table old_table{};
+    for( size_t j = 0; j < old_size; ++j )
+    {
+        if( !insert( old_table, old_addresses, j ) ) return false;
+    }
+
+    /*
+     * Бит j маски - элемент с индексом j. match - индекс элемента нового списка в старом, target - наоборот.
+     * Элемент на той же позиции находится без таблицы: идентификаторы старого списка уже проверены на повторы.
+     */
+    uint64_t present_mask = 0, added_mask = 0;
+    std::array< uint8_t, SMALL_LIST_SIZE > target, match;
+    Table added_table{};
+    for( size_t i = 0; i < updated_size; ++i )
+    {
+        size_t id = updated_addresses[ i ].mId;
+        size_t j = npos;
+        if( i < old_size && old_addresses[ i ].mId == id ) j = i;
+        else
+        {
+            for( size_t s = slot( id ); old_table[ s ] != 0; s = ( s + 1 ) % old_table.size() )
+            {
+                if( old_addresses[ old_table[ s ] - 1 ].mId == id )
+                {
+                    j = old_table[ s ] - 1;
+                    break;
+                }
+            }
+        }
+        if( j == npos )
+        {
+            if( !insert( added_table, updated_addresses, i ) ) return false;
+            added_mask |= uint64_t( 1 ) << i;
+            continue;
+        }
+        if( present_mask >> j & 1 ) return false;
+        present_mask |= uint64_t( 1 ) << j;
+        match[ i ] = static_cast< uint8_t >( j );
+        target[ j ] = static_cast< uint8_t >( i );
+    }
+    uint64_t deleted_mask = ~present_mask & ( old_size == SMALL_LIST_SIZE ? ~uint64_t( 0 ) : ( uint64_t( 1 ) << old_size ) - 1 );
+
+    for( uint64_t mask = deleted_mask; mask != 0; mask &= mask - 1 )
+    {
+        const auto& elem = old_addresses[ __builtin_ctzll( mask ) ];
+        result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+    }
+    for( size_t i = 0; i < updated_size; ++i )
+    {
+        const auto& elem = updated_addresses[ i ];
+        if( added_mask >> i & 1 )
+        {
+            result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+        }
+        else if( old_addresses[ match[ i ] ].mValue != elem.mValue )
+        {
+            result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses[ match[ i ] ], elem, elem.mPosition, std::nullopt } );
+        }
+    }
+
+    /*
+     * Копия старого списка, как в FormCopyIds: добавления вставляются по порядку операций, удаленные выбрасываются.
+     * Элемент копии - его индекс в новом списке, поэтому копия - перестановка 0..n-1; inverse - обратная к ней.
+     */
+    std::array< uint8_t, 2 * SMALL_LIST_SIZE > copy;
+    size_t copy_size = 0;
+    for( size_t j = 0; j < old_size; ++j ) copy[ copy_size++ ] = ( deleted_mask >> j & 1 ) ? uint8_t( npos ) : target[ j ];
+    for( uint64_t mask = added_mask; mask != 0; mask &= mask - 1 )
+    {
+        size_t i = __builtin_ctzll( mask );
+        size_t position = std::min( updated_addresses[ i ].mPosition, copy_size );
+        std::copy_backward( copy.begin() + position, copy.begin() + copy_size, copy.begin() + copy_size + 1 );
+        copy[ position ] = static_cast< uint8_t >( i );
+        ++copy_size;
+    }
+    copy_size = std::remove( copy.begin(), copy.begin() + copy_size, uint8_t( npos ) ) - copy.begin();
+    std::array< uint8_t, SMALL_LIST_SIZE > inverse;
+    for( size_t k = 0; k < copy_size; ++k ) inverse[ copy[ k ] ] = static_cast< uint8_t >( k );
+
+    /* Бит i - элемент i нового списка стоит в копии не на своем месте; на месте стоящие не выбираются, пока есть другие */
+    uint64_t misplaced_mask = 0;
+    for( size_t i = 0; i < copy_size; ++i ) misplaced_mask |= uint64_t( inverse[ i ] != i ) << i;
+
+    /* Тот же выбор перемещаемого элемента, что и в ResolveMoves */
+    while( misplaced_mask != 0 )
+    {
+        size_t highest = 0;
+        int highest_shift = -1;
+        DIRECTION highest_dir = DIRECTION::NONE;
+        for( uint64_t mask = misplaced_mask; mask != 0; mask &= mask - 1 )
+        {
+            size_t i = __builtin_ctzll( mask );
+            size_t j = inverse[ i ];
+            int shift = std::abs( int( i ) - int( j ) );
+            DIRECTION dir = i < j ? DIRECTION::UP : DIRECTION::DOWN;
+            if( shift > highest_shift || ( shift == highest_shift && dir == DIRECTION::UP ) )
+            {
+                highest = i;
+                highest_shift = shift;
+                highest_dir = dir;
+            }
+        }
+
+        if( result.mMovedOperations.size() == max_moves )
+        {
+            result.mAddedOperations.clear();
+            result.mDeletedOperations.clear();
+            result.mChandedOperations.clear();
+            result.mMovedOperations.clear();
+            return false;
+        }
+        size_t j = inverse[ highest ];
+        if( highest_dir == DIRECTION::UP ) std::rotate( copy.begin() + highest, copy.begin() + j, copy.begin() + j + 1 );
+        else std::rotate( copy.begin() + j, copy.begin() + j + 1, copy.begin() + highest + 1 );
+        for( size_t k = std::min( j, highest ); k <= std::max( j, highest ); ++k )
+        {
+            size_t i = copy[ k ];
+            inverse[ i ] = static_cast< uint8_t >( k );
+            misplaced_mask = ( misplaced_mask & ~( uint64_t( 1 ) << i ) ) | ( uint64_t( k != i ) << i );
+        }
+        result.mMovedOperations.push_back( { OPERATION_TYPE::MOVED, updated_addresses[ highest ], std::nullopt, j, highest } );
+    }
+    return true;
+}
+
+CompareResult< Address > DifferAddress::Compare( std::vector< Address >&& old_addresses, std::vector< Address >&& updated_addresses )
+{
+    CompareResult< Address > result;
+
+    std::unordered_map< size_t, size_t > old_index;
+    old_index.reserve( old_addresses.size() );
+    for( size_t i = 0; i < old_addresses.size(); ++i )
+    {
+        old_index.emplace( old_addresses[ i ].mId, i );
+    }
+    std::unordered_set< size_t > updated_ids;
+    updated_ids.reserve( updated_addresses.size() );
+    for( const auto& elem : updated_addresses )
+    {
+        updated_ids.emplace( elem.mId );
+    }
+
+    /* Находим удаленные элементы. После переноса значения у адреса остаются идентификатор и позиция */
+    std::unordered_set< size_t > deleted_ids;
+    for( auto& elem : old_addresses )
+    {
+        if( updated_ids.count( elem.mId ) != 0 ) continue;
+        deleted_ids.emplace( elem.mId );
+        result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, std::move( elem ), std::nullopt, elem.mPosition, std::nullopt } );
+    }
+
+    /* Находим добавленные элементы; индексы в новом списке нужны, чтобы найти значение перемещаемого добавленного элемента */
+    std::vector< size_t > added_indices;
+    for( size_t i = 0; i < updated_addresses.size(); ++i )
+    {
+        auto& elem = updated_addresses[ i ];
+        if( old_index.count( elem.mId ) != 0 ) continue;
+        added_indices.push_back( i );
+        result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, std::move( elem ), std::nullopt, elem.mPosition, std::nullopt } );
+    }
+
+    /* Перемещения до переноса новых значений измененных элементов: перемещение хранит копию адреса нового списка */
+    auto copy_ids = FormCopyIds( old_addresses, result.mAddedOperations, deleted_ids );
+    std::vector< size_t > updated_order;
+    updated_order.reserve( updated_addresses.size() );
+    for( const auto& elem : updated_addresses ) updated_order.push_back( elem.mId );
+    auto address_at = [&]( size_t i ) -> const Address&
+    {
+        auto added = std::lower_bound( added_indices.begin(), added_indices.end(), i );
+        if( added != added_indices.end() && *added == i ) return result.mAddedOperations[ added - added_indices.begin() ].mValue;
+        return updated_addresses[ i ];
+    };
+    ResolveMoves( copy_ids, updated_order, address_at, result.mMovedOperations, []( const OperationData< Address >& ){ return true; } );
+
+    /* Находим измененные элементы */
+    for( auto& elem : updated_addresses )
+    {
+        auto it = old_index.find( elem.mId );
+        if( it == old_index.end() || old_addresses[ it->second ].mValue == elem.mValue ) continue;
+        result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, std::move( old_addresses[ it->second ] ), std::move( elem ), elem.mPosition, std::nullopt } );
+    }
+
+    return result;
+}
+
+template< typename Expired >
+std::vector< size_t > DifferAddress::FormCopyIds( const std::vector< Address >& old_addresses, const std::vector< OperationData< Address > >& added_operations,
+    const std::unordered_set< size_t >& deleted_ids, Expired expired )
+{
+    std::vector< size_t > copy_ids;
+    copy_ids.reserve( old_addresses.size() + added_operations.size() );
+    for( size_t i = 0; i < old_addresses.size(); ++i )
+    {
+        if( ( i & 4095 ) == 0 && expired() ) return copy_ids;
+        copy_ids.push_back( old_addresses[ i ].mId );
+    }
+    return FormCopyIds( std::move( copy_ids ), added_operations, deleted_ids, expired );
+}
+
+template< typename Expired >
+std::vector< size_t > DifferAddress::FormCopyIds( std::vector< size_t > copy_ids, const std::vector< OperationData< Address > >& added_operations,
+    const std::unordered_set< size_t >& deleted_ids, Expired expired )
+{
+    /* Добавления по строгому возрастанию позиций вставляются слиянием за один проход, иначе - по одному */
+    bool ascending = true;
+    for( size_t i = 1; i < added_operations.size() && ascending; ++i )
+    {
+        ascending = added_operations[ i - 1 ].mPositionStart < added_operations[ i ].mPositionStart;
+    }
+    if( ascending )
+    {
+        std::vector< size_t > merged;
+        merged.reserve( copy_ids.size() + added_operations.size() );
+        size_t next = 0;
+        for( const auto& elem : added_operations )
+        {
+            while( merged.size() < elem.mPositionStart && next < copy_ids.size() )
+            {
+                if( ( merged.size() & 4095 ) == 0 && expired() ) return merged;
+                merged.push_back( copy_ids[ next++ ] );
+            }
+            merged.push_back( elem.mValue.mId );
+        }
+        merged.insert( merged.end(), copy_ids.begin() + next, copy_ids.end() );
+        copy_ids.swap( merged );
+    }
+    else
+    {
+        /* Каждая вставка сдвигает хвост копии, поэтому срок проверяется перед каждой */
+        for( const auto& elem : added_operations )
+        {
+            if( expired() ) return copy_ids;
+            copy_ids.insert( copy_ids.begin() + elem.mPositionStart, elem.mValue.mId );
+        }
+    }
+    /* После срабатывания срока остальные элементы не ищутся в хеш-таблице: копия остается недостроенной */
+    size_t checked = 0;
+    bool stopped = false;
+    copy_ids.erase( std::remove_if( copy_ids.begin(), copy_ids.end(), [&]( size_t id )
+    {
+        stopped = stopped || ( ( checked++ & 4095 ) == 0 && expired() );
+        return !stopped && deleted_ids.count( id ) != 0;
+    } ), copy_ids.end() );
+    return copy_ids;
+}
+
+template< typename OnMove, typename Expired >
+bool DifferAddress::ResolveMoves( std::vector< size_t >& copy_ids, const std::vector< Address >& updated_addresses,
+    std::vector< OperationData< Address > >& moved_operations, OnMove on_move, Expired expired )
+{
+    std::vector< size_t > updated_ids;
+    updated_ids.reserve( updated_addresses.size() );
+    for( size_t i = 0; i < updated_addresses.size(); ++i )
+    {
+        if( ( i & 4095 ) == 0 && expired() ) return false;
+        updated_ids.push_back( updated_addresses[ i ].mId );
+    }
+    return ResolveMoves( copy_ids, updated_ids, [&]( size_t i ) -> const Address& { return updated_addresses[ i ]; }, moved_operations, on_move, expired );
+}
+
+template< typename AddressAt, typename OnMove, typename Expired >
+bool DifferAddress::ResolveMoves( std::vector< size_t >& copy_ids, const std::vector< size_t >& updated_ids, AddressAt address_at,
+    std::vector< OperationData< Address > >& moved_operations, OnMove on_move, Expired expired )
+{
+    /*
+     * Тот же выбор перемещаемого элемента, что и в полном сравнении. order[ j ] - индекс элемента копии в новом списке,
+     * position[ i ] - место элемента i нового списка в копии. Хеш-индекс строится один раз; перемещение сдвигает
+     * только отрезок между старым и новым местом, поэтому и места обновляются только в нем.
+     */
+    std::unordered_map< size_t, size_t > updated_index;
+    updated_index.reserve( updated_ids.size() );
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        if( ( i & 4095 ) == 0 && expired() ) return false;
+        updated_index.emplace( updated_ids[ i ], i );
+    }
+    std::vector< size_t > order( copy_ids.size() ), position( updated_ids.size() );
+    for( size_t j = 0; j < copy_ids.size(); ++j )
+    {
+        if( ( j & 4095 ) == 0 && expired() ) return false;
+        order[ j ] = updated_index[ copy_ids[ j ] ];
+        position[ order[ j ] ] = j;
+    }
+
+    while( true )
+    {
+        size_t highest = 0;
+        int highest_shift = -1;
+        DIRECTION highest_dir = DIRECTION::NONE;
+        for( size_t i = 0; i < updated_ids.size(); ++i )
+        {
+            /* Выбор перемещения - просмотр всего списка, поэтому срок проверяется и внутри него */
+            if( ( i & 4095 ) == 0 && expired() ) return false;
+            size_t j = position[ i ];
+            int shift = std::abs( int( i - j ) );
+            DIRECTION dir = i < j ? DIRECTION::UP : ( i > j ? DIRECTION::DOWN : DIRECTION::NONE );
+            if( shift > highest_shift || ( shift == highest_shift && dir == DIRECTION::UP ) )
+            {
+                highest = i;
+                highest_shift = shift;
+                highest_dir = dir;
+            }
+        }
+        if( highest_shift <= 0 ) return true;
+
+        size_t j = position[ highest ];
+        MoveElementInVector( copy_ids, j, highest_shift, highest_dir );
+        MoveElementInVector( order, j, highest_shift, highest_dir );
+        for( size_t k = std::min( j, highest ); k <= std::max( j, highest ); ++k ) position[ order[ k ] ] = k;
+        moved_operations.push_back( { OPERATION_TYPE::MOVED, address_at( highest ), std::nullopt, j, highest } );
+        if( !on_move( moved_operations.back() ) ) return false;
+    }
+}
+
 template< class InputIt1, class InputIt2, class OutputIt, class Comp >
 OutputIt DifferAddress::SetDifference( InputIt1 first1, InputIt1 last1,
     InputIt2 first2, InputIt2 last2, OutputIt d_first, Comp comp )
@@ -336,7 +1100,8 @@ OutputIt DifferAddress::SetDifference( InputIt1 first1, InputIt1 last1,
     return d_first;
 }
 
-void DifferAddress::MoveElementInVector( std::vector< Address >& vec, size_t position, size_t shift, DIRECTION direction )
+template< typename T >
+void DifferAddress::MoveElementInVector( std::vector< T >& vec, size_t position, size_t shift, DIRECTION direction )
 {
     int int_direction = static_cast< int >( direction );
     for( size_t i = position; i != position + shift * int_direction; i += int_direction )
@@ -393,24 +1158,114 @@ void DifferAddress::PrintEditorialPrescription( const CompareResult< Address >&
     {
         std::cout << " Moved  " << elem.mValue << " from position " << elem.mPositionStart << " to position " << *elem.mPositionEnd << std::endl;
     }
+
+    if( !compare_result.mPermutation.empty() )
+    {
+        std::cout << " Reordered  " << compare_result.mPermutation.size() << " first elements" << std::endl;
+    }
+}
+
+std::vector< size_t > DifferAddress::MovesToPermutation( const std::vector< OperationData< Address > >& moved_operations )
+{
+    size_t size = 0;
+    for( const auto& elem : moved_operations )
+    {
+        assert( elem.mPositionEnd );
+        size = std::max( { size, elem.mPositionStart + 1, *elem.mPositionEnd + 1 } );
+    }
+
+    std::vector< size_t > permutation( size );
+    for( size_t i = 0; i < size; ++i ) permutation[ i ] = i;
+    for( const auto& elem : moved_operations )
+    {
+        size_t start = elem.mPositionStart;
+        size_t end = *elem.mPositionEnd;
+        if( start > end ) std::rotate( permutation.begin() + end, permutation.begin() + start, permutation.begin() + start + 1 );
+        if( start < end ) std::rotate( permutation.begin() + start, permutation.begin() + start + 1, permutation.begin() + end + 1 );
+    }
+    return permutation;
+}
+
+std::vector< size_t > DifferAddress::AddedSlots( const std::vector< OperationData< Address > >& added_operations )
+{
+    std::vector< size_t > slots( added_operations.size() );
+    size_t max_slot = 0;
+    for( size_t k = 0; k < added_operations.size(); ++k )
+    {
+        size_t position = added_operations[ k ].mPositionStart;
+        if( k != 0 && position <= max_slot )
+        {
+            for( size_t j = 0; j < k; ++j )
+            {
+                if( slots[ j ] >= position ) ++slots[ j ];
+            }
+        }
+        slots[ k ] = position;
+        max_slot = k == 0 || position > max_slot ? position : max_slot + 1;
+    }
+    return slots;
+}
+
+size_t DifferAddress::SkipSlots( const std::vector< size_t >& slots, size_t index )
+{
+    /* slots[ i ] - i - количество элементов без вставок перед i-й вставкой, не убывает */
+    size_t low = 0, high = slots.size();
+    while( low < high )
+    {
+        size_t middle = ( low + high ) / 2;
+        if( slots[ middle ] - middle <= index ) low = middle + 1;
+        else high = middle;
+    }
+    return index + low;
 }
 
 std::vector< Address > DifferAddress::DoEditorialPrescription( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses )
 {
+    AllocationPhase total( "apply" );
+    AllocationPhase copy( "apply.copy" );
     std::vector< Address > result( old_adresses.begin(), old_adresses.end() );
-    for( const auto& elem : compare_result.mAddedOperations )
+    copy.Restart( "apply.operations" );
+    ApplyOperations( compare_result, result, []{ return false; } );
+    return result;
+}
+
+std::vector< Address > DifferAddress::DoEditorialPrescription( CompareResult< Address >&& compare_result, std::vector< Address > old_adresses )
+{
+    AllocationPhase total( "apply" );
+    ApplyOperations( compare_result, old_adresses, []{ return false; } );
+    return old_adresses;
+}
+
+template< typename Result, typename ShouldStop >
+size_t DifferAddress::ApplyOperations( Result& compare_result, std::vector< Address >& result, ShouldStop should_stop )
+{
+    /* Значения неконстантного предписания переносятся, константного - копируются */
+    auto take = []( auto& value ) -> decltype( auto )
     {
-        result.insert( result.begin() + elem.mPositionStart, elem.mValue );
-        std::cout << " Added  " << elem.mValue << " to position " << elem.mPositionStart << std::endl;
+        if constexpr ( std::is_const_v< Result > ) return ( value );
+        else return std::move( value );
+    };
+
+    size_t applied = 0;
+    AllocationPhase phase( "apply.added" );
+    for( auto& elem : compare_result.mAddedOperations )
+    {
+        if( should_stop() ) return applied;
+        ++applied;
+        if( mVerbose ) std::cout << " Added  " << elem.mValue << " to position " << elem.mPositionStart << std::endl;
+        result.insert( result.begin() + elem.mPositionStart, take( elem.mValue ) );
     }
 
+    phase.Restart( "apply.deleted" );
     for( const auto& elem : compare_result.mDeletedOperations )
     {
+        if( should_stop() ) return applied;
+        ++applied;
         if( auto it = std::find_if( result.begin(), result.end(), [&elem]( const Address& address ){ return address.mId == elem.mValue.mId; } );
             it != result.end() )
         {
             result.erase( it );
-            std::cout << " Deleted  " << elem.mValue << std::endl;
+            if( mVerbose ) std::cout << " Deleted  " << elem.mValue << std::endl;
         }
         else
         {
@@ -418,13 +1273,16 @@ std::vector< Address > DifferAddress::DoEditorialPrescription( const CompareResu
         }
     }
 
-    for( const auto& elem : compare_result.mChandedOperations )
+    phase.Restart( "apply.changed" );
+    for( auto& elem : compare_result.mChandedOperations )
     {
+        if( should_stop() ) return applied;
+        ++applied;
         if( auto it = std::find_if( result.begin(), result.end(), [&elem]( const Address& address ){ return address.mId == elem.mValue.mId; } );
             it != result.end() )
         {
-            it->mValue = elem.mNewValue->mValue;
-            std::cout << "Changed  Old value:  " << elem.mValue << " New value " << *elem.mNewValue << std::endl;
+            if( mVerbose ) std::cout << "Changed  Old value:  " << elem.mValue << " New value " << *elem.mNewValue << std::endl;
+            it->mValue = take( elem.mNewValue->mValue );
         }
         else
         {
@@ -432,8 +1290,11 @@ std::vector< Address > DifferAddress::DoEditorialPrescription( const CompareResu
         }
     }
 
+    phase.Restart( "apply.moved" );
     for( const auto& elem : compare_result.mMovedOperations )
     {
+        if( should_stop() ) return applied;
+        ++applied;
         if( !elem.mPositionEnd ) assert( false );
 
         if( elem.mPositionStart > *elem.mPositionEnd )
@@ -450,7 +1311,23 @@ std::vector< Address > DifferAddress::DoEditorialPrescription( const CompareResu
                 std::swap( result[ i + 1 ], result[ i ] );
             }
         }
-        std::cout << " Moved  " << elem.mValue << " from position " << elem.mPositionStart << " to position " << *elem.mPositionEnd << std::endl;
+        if( mVerbose ) std::cout << " Moved  " << elem.mValue << " from position " << elem.mPositionStart << " to position " << *elem.mPositionEnd << std::endl;
+    }
+
+    // Перестановка выполняется одним проходом
+    phase.Restart( "apply.permutation" );
+    if( const auto& permutation = compare_result.mPermutation; !permutation.empty() )
+    {
+        if( should_stop() ) return applied;
+        ++applied;
+        assert( permutation.size() <= result.size() );
+        std::vector< Address > reordered( permutation.size() );
+        for( size_t i = 0; i < permutation.size(); ++i )
+        {
+            reordered[ i ] = std::move( result[ permutation[ i ] ] );
+        }
+        std::move( reordered.begin(), reordered.end(), result.begin() );
+        if( mVerbose ) std::cout << " Reordered  " << permutation.size() << " first elements" << std::endl;
     }
 
     // Исправляю номера позиций
@@ -459,5 +1336,5 @@ std::vector< Address > DifferAddress::DoEditorialPrescription( const CompareResu
         result[ i ].mPosition = i;
     }
 
-    return result;
+    return applied;
 }
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "address_differ.h"
+
+/*
+ * @brief Список адресов, хранящийся по столбцам (struct of arrays).
+ * Идентификаторы, позиции и значения лежат в отдельных непрерывных массивах,
+ * поэтому просмотр только идентификаторов не тянет в кэш значения адресов.
+ */
+class AddressList
+{
+public:
+
+    /* Значение, возвращаемое при отсутствии идентификатора в списке */
+    static constexpr size_t npos = static_cast< size_t >( -1 );
+
+    AddressList() = default;
+
+    /*
+     * @brief Формирует список из вектора адресов.
+     * @param addresses Вектор адресов.
+     */
+    explicit AddressList( const std::vector< Address >& addresses );
+
+    /* @brief Преобразует список в вектор адресов */
+    std::vector< Address > ToVector() const;
+
+    /* @brief Количество адресов в списке */
+    size_t Size() const { return mIds.size(); }
+
+    /* @brief Резервирует место под заданное количество адресов */
+    void Reserve( size_t size );
+
+    /* @brief Добавляет адрес в конец списка */
+    void PushBack( const Address& address );
+
+    /* @brief Возвращает адрес по индексу */
+    Address At( size_t index ) const { return { mValues[ index ], mIds[ index ], mPositions[ index ] }; }
+
+    const std::vector< size_t >& Ids() const { return mIds; }
+    const std::vector< size_t >& Positions() const { return mPositions; }
+    const std::vector< InternedString >& Values() const { return mValues; }
+
+    /*
+     * @brief Ищет идентификатор в массиве идентификаторов.
+     * @details Сравнение идет блоками фиксированного размера без ветвлений внутри блока, что позволяет компилятору векторизовать цикл.
+     * @param ids Массив идентификаторов.
+     * @param id Искомый идентификатор.
+     * @return Индекс первого совпадения или npos.
+     */
+    static size_t FindId( const std::vector< size_t >& ids, size_t id );
+
+    bool operator==( const AddressList& rhs ) const
+    {
+        return this->mIds == rhs.mIds &&
+               this->mPositions == rhs.mPositions &&
+               this->mValues == rhs.mValues;
+    }
+
+private:
+
+    /* Уникальные идентификаторы адресов */
+    std::vector< size_t > mIds;
+
+    /* Позиции адресов в списке */
+    std::vector< size_t > mPositions;
+
+    /* Значения адресов (ссылки на пул строк) */
+    std::vector< InternedString > mValues;
+};
+
+AddressList::AddressList( const std::vector< Address >& addresses )
+{
+    Reserve( addresses.size() );
+    for( const auto& address : addresses )
+    {
+        PushBack( address );
+    }
+}
+
+std::vector< Address > AddressList::ToVector() const
+{
+    std::vector< Address > result;
+    result.reserve( Size() );
+    for( size_t i = 0; i < Size(); ++i )
+    {
+        result.push_back( At( i ) );
+    }
+    return result;
+}
+
+void AddressList::Reserve( size_t size )
+{
+    mIds.reserve( size );
+    mPositions.reserve( size );
+    mValues.reserve( size );
+}
+
+void AddressList::PushBack( const Address& address )
+{
+    mIds.push_back( address.mId );
+    mPositions.push_back( address.mPosition );
+    mValues.push_back( address.mValue );
+}
+
+size_t AddressList::FindId( const std::vector< size_t >& ids, size_t id )
+{
+    constexpr size_t block = 8;
+    const size_t* data = ids.data();
+    size_t i = 0;
+    for( ; i + block <= ids.size(); i += block )
+    {
+        bool found = false;
+        for( size_t k = 0; k < block; ++k )
+        {
+            found |= data[ i + k ] == id;
+        }
+        if( found ) break;
+    }
+
+    for( ; i < ids.size(); ++i )
+    {
+        if( data[ i ] == id ) return i;
+    }
+    return npos;
+}
+
+CompareResult< Address > DifferAddress::Compare( const AddressList& old_addresses, const AddressList& updated_addresses )
+{
+    const auto& old_ids = old_addresses.Ids();
+    const auto& updated_ids = updated_addresses.Ids();
+
+    std::vector<OperationData<Address>> added_operations;
+    std::vector<OperationData<Address>> deleted_operations;
+    std::vector<OperationData<Address>> chanded_operations;
+    std::vector<OperationData<Address>> moved_operations;
+
+    /* Находим удаленные элементы */
+    std::vector< size_t > deleted_ids;
+    for( size_t i = 0; i < old_ids.size(); ++i )
+    {
+        if( AddressList::FindId( updated_ids, old_ids[ i ] ) == AddressList::npos )
+        {
+            deleted_ids.push_back( old_ids[ i ] );
+            deleted_operations.push_back( { OPERATION_TYPE::DELETED, old_addresses.At( i ), std::nullopt, old_addresses.Positions()[ i ], std::nullopt } );
+        }
+    }
+
+    /* Копия старого списка: идентификаторы и ссылки на значения */
+    std::vector< size_t > copy_ids( old_ids.begin(), old_ids.end() );
+    std::vector< const InternedString* > copy_values;
+    copy_values.reserve( old_addresses.Size() );
+    for( const auto& value : old_addresses.Values() )
+    {
+        copy_values.push_back( &value );
+    }
+
+    /* Находим добавленные элементы и добавляем их в копию, чтобы можно было сравнить порядок элементов */
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        if( AddressList::FindId( old_ids, updated_ids[ i ] ) == AddressList::npos )
+        {
+            auto position = updated_addresses.Positions()[ i ];
+            added_operations.push_back( { OPERATION_TYPE::ADDED, updated_addresses.At( i ), std::nullopt, position, std::nullopt } );
+            copy_ids.insert( copy_ids.begin() + position, updated_ids[ i ] );
+            copy_values.insert( copy_values.begin() + position, &updated_addresses.Values()[ i ] );
+        }
+    }
+
+    /* Удаляем старые элементы, чтобы можно было сравнить порядок элементов */
+    size_t kept = 0;
+    for( size_t j = 0; j < copy_ids.size(); ++j )
+    {
+        if( AddressList::FindId( deleted_ids, copy_ids[ j ] ) == AddressList::npos )
+        {
+            copy_ids[ kept ] = copy_ids[ j ];
+            copy_values[ kept ] = copy_values[ j ];
+            ++kept;
+        }
+    }
+    copy_ids.resize( kept );
+    copy_values.resize( kept );
+
+    /* Находим измененные элементы */
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        auto j = AddressList::FindId( copy_ids, updated_ids[ i ] );
+        if( j != AddressList::npos && *copy_values[ j ] != updated_addresses.Values()[ i ] )
+        {
+            auto old_index = AddressList::FindId( old_ids, updated_ids[ i ] );
+            chanded_operations.push_back( { OPERATION_TYPE::CHANGED, old_addresses.At( old_index ), updated_addresses.At( i ), updated_addresses.Positions()[ i ], std::nullopt } );
+        }
+    }
+
+    /* Формируем сдвиги элементов относительно друг друга */
+    auto shifts = FormShifts( copy_ids, updated_ids );
+
+    while( HasShifts( shifts ) )
+    {
+        size_t highest = 0;
+        for( size_t i = 0; i < shifts.size(); ++i )
+        {
+            if( shifts[ i ].mShift > shifts[ highest ].mShift || ( shifts[ i ].mShift == shifts[ highest ].mShift && shifts[ i ].mDir == DIRECTION::UP ) )
+            {
+                highest = i;
+            }
+        }
+
+        auto j = AddressList::FindId( copy_ids, updated_ids[ highest ] );
+        MoveElementInVector( copy_ids, j, shifts[ highest ].mShift, shifts[ highest ].mDir );
+        size_t position_end = static_cast< size_t >( j + shifts[ highest ].mShift * static_cast< int >( shifts[ highest ].mDir ) );
+        moved_operations.push_back( { OPERATION_TYPE::MOVED, updated_addresses.At( highest ), std::nullopt, j, position_end } );
+
+        shifts = FormShifts( copy_ids, updated_ids );
+    }
+
+    return CompareResult<Address>{ std::move( added_operations ), std::move( deleted_operations ), std::move( chanded_operations ), std::move( moved_operations ), };
+}
+
+std::vector< ShiftDiff > DifferAddress::FormShifts( const std::vector< size_t >& old_ids, const std::vector< size_t >& updated_ids )
+{
+    std::vector< ShiftDiff > result;
+    result.reserve( updated_ids.size() );
+
+    for( size_t i = 0; i < updated_ids.size(); ++i )
+    {
+        auto j = AddressList::FindId( old_ids, updated_ids[ i ] );
+        if( j == AddressList::npos ) continue;
+
+        DIRECTION current_dirrection;
+        if( i < j ) current_dirrection = DIRECTION::UP;
+        else if( i > j ) current_dirrection = DIRECTION::DOWN;
+        else current_dirrection = DIRECTION::NONE;
+        result.push_back( { std::abs( int( i - j ) ), current_dirrection, i } );
+    }
+    return result;
+}
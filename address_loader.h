@@ -0,0 +1,231 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "address_arena.h"
+#include "positions.h"
+
+/* @brief Файл, отображенный в память только для чтения */
+class MappedFile
+{
+public:
+
+    /*
+     * @details std::runtime_error - файл не открывается или не отображается.
+     * @param path Путь к файлу.
+     */
+    explicit MappedFile( const std::string& path );
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    std::string_view Data() const { return { mData, mSize }; }
+
+private:
+
+    const char* mData = nullptr;
+    size_t mSize = 0;
+};
+
+MappedFile::MappedFile( const std::string& path )
+{
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) throw std::runtime_error( "cannot open " + path + ": " + std::strerror( errno ) );
+
+    struct stat st;
+    if( fstat( fd, &st ) < 0 )
+    {
+        close( fd );
+        throw std::runtime_error( "cannot stat " + path + ": " + std::strerror( errno ) );
+    }
+    mSize = static_cast< size_t >( st.st_size );
+    if( mSize != 0 )
+    {
+        /* Страницы подгружаются сразу при отображении, а не по одной при первом обращении */
+        void* data = mmap( nullptr, mSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+        if( data == MAP_FAILED )
+        {
+            close( fd );
+            throw std::runtime_error( "cannot map " + path + ": " + std::strerror( errno ) );
+        }
+        madvise( data, mSize, MADV_SEQUENTIAL );
+        mData = static_cast< const char* >( data );
+    }
+    close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+    if( mData ) munmap( const_cast< char* >( mData ), mSize );
+}
+
+/*
+ * @brief Разбор текстового списка адресов: строки "идентификатор,позиция,значение" (CSV) или через табуляцию (TSV).
+ * Разделитель определяется по первой строке. Значение - остаток строки после второго разделителя, поэтому
+ * может содержать разделители; кавычки не снимаются. Пустые строки пропускаются, первая строка без числа в начале
+ * считается заголовком. Поля не копируются по отдельности: значения дописываются прямо в буфер AddressArena.
+ */
+class AddressLoader
+{
+public:
+
+    /*
+     * @brief Разбирает текст в список адресов в порядке строк.
+     * @details std::runtime_error с номером строки - строка не разбирается.
+     * @param data Текст.
+     */
+    static AddressArena Parse( std::string_view data );
+
+    /*
+     * @brief Отображает файл в память, разбирает его, упорядочивает адреса по позиции и перенумеровывает их.
+     * @details std::runtime_error - ошибка чтения или разбора.
+     * @param path Путь к файлу.
+     */
+    static AddressArena Load( const std::string& path );
+
+    /*
+     * @brief Упорядочивает адреса по позиции и перенумеровывает позиции в 0..n-1.
+     * @details std::invalid_argument - повторяющаяся позиция.
+     * @param arena Список адресов.
+     */
+    static AddressArena SortByPosition( AddressArena arena );
+
+    /*
+     * @brief Ищет первый разделитель или перевод строки.
+     * @details Просмотр идет словами по 8 байт: совпадающие байты выделяются без ветвлений (SWAR), первый в памяти -
+     * по младшему биту слова (порядок байт little-endian).
+     * @param begin Начало просмотра.
+     * @param end Конец текста.
+     * @param delimiter Разделитель полей.
+     * @return Указатель на найденный символ или end.
+     */
+    static const char* FindSeparator( const char* begin, const char* end, char delimiter );
+
+private:
+
+    /* Разбирает десятичное число без знака. false - поле пустое, не число или переполнение */
+    static bool ParseNumber( std::string_view field, size_t& value );
+};
+
+const char* AddressLoader::FindSeparator( const char* begin, const char* end, char delimiter )
+{
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    constexpr uint64_t highs = 0x8080808080808080ULL;
+    const uint64_t delimiters = ones * static_cast< uint8_t >( delimiter );
+    const uint64_t newlines = ones * static_cast< uint8_t >( '\n' );
+
+    const char* it = begin;
+    for( ; it + 8 <= end; it += 8 )
+    {
+        uint64_t word;
+        std::memcpy( &word, it, 8 );
+        uint64_t a = word ^ delimiters;
+        uint64_t b = word ^ newlines;
+        /* Нулевой байт в a или b дает старший бит; ложных срабатываний до первого совпадения не бывает */
+        uint64_t found = ( ( ( a - ones ) & ~a ) | ( ( b - ones ) & ~b ) ) & highs;
+        if( found ) return it + __builtin_ctzll( found ) / 8;
+    }
+    for( ; it < end; ++it )
+    {
+        if( *it == delimiter || *it == '\n' ) return it;
+    }
+    return end;
+}
+
+bool AddressLoader::ParseNumber( std::string_view field, size_t& value )
+{
+    if( field.empty() || field.size() > 20 ) return false;
+    uint64_t result = 0;
+    for( char c : field )
+    {
+        unsigned digit = static_cast< unsigned char >( c ) - '0';
+        if( digit > 9 ) return false;
+        if( __builtin_mul_overflow( result, 10, &result ) || __builtin_add_overflow( result, digit, &result ) ) return false;
+    }
+    value = static_cast< size_t >( result );
+    return true;
+}
+
+AddressArena AddressLoader::Parse( std::string_view data )
+{
+    const char* it = data.data();
+    const char* end = it + data.size();
+
+    /* Разделитель - первая запятая или табуляция первой строки */
+    const char* first_line_end = static_cast< const char* >( std::memchr( it, '\n', data.size() ) );
+    if( !first_line_end ) first_line_end = end;
+    char delimiter = ',';
+    for( const char* c = it; c < first_line_end; ++c )
+    {
+        if( *c == ',' || *c == '\t' )
+        {
+            delimiter = *c;
+            break;
+        }
+    }
+
+    /* Размеры известны заранее: записей не больше строк, значения короче текста */
+    AddressArena arena;
+    arena.Reserve( std::count( it, end, '\n' ) + 1, data.size() );
+
+    size_t line = 0;
+    while( it < end )
+    {
+        ++line;
+        const char* line_end = static_cast< const char* >( std::memchr( it, '\n', end - it ) );
+        if( !line_end ) line_end = end;
+        const char* content_end = line_end != it && line_end[ -1 ] == '\r' ? line_end - 1 : line_end;
+        auto fail = [&]{ throw std::runtime_error( "line " + std::to_string( line ) + ": expected id" + delimiter + "position" + delimiter + "value" ); };
+
+        if( content_end != it )
+        {
+            const char* first = FindSeparator( it, content_end, delimiter );
+            const char* second = first < content_end ? FindSeparator( first + 1, content_end, delimiter ) : content_end;
+            size_t id, position;
+            bool parsed = second < content_end && ParseNumber( { it, size_t( first - it ) }, id ) && ParseNumber( { first + 1, size_t( second - first - 1 ) }, position );
+            if( parsed ) arena.PushBack( id, position, { second + 1, size_t( content_end - second - 1 ) } );
+            else if( line != 1 || ParseNumber( { it, size_t( first - it ) }, id ) ) fail();
+        }
+        it = line_end + 1;
+    }
+    return arena;
+}
+
+AddressArena AddressLoader::SortByPosition( AddressArena arena )
+{
+    const auto& positions = arena.Positions();
+    auto order = PositionOrder( arena.Size(), [&]( size_t i ){ return positions[ i ]; }, true );
+    if( order.empty() ) return arena;
+
+    AddressArena sorted;
+    sorted.Reserve( arena.Size(), arena.Bytes() );
+    for( size_t k = 0; k < order.size(); ++k )
+    {
+        sorted.PushBack( arena.Ids()[ order[ k ] ], k, arena.Value( order[ k ] ) );
+    }
+    return sorted;
+}
+
+AddressArena AddressLoader::Load( const std::string& path )
+{
+    MappedFile file( path );
+    try
+    {
+        return SortByPosition( Parse( file.Data() ) );
+    }
+    catch( const std::exception& error )
+    {
+        throw std::runtime_error( path + ": " + error.what() );
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+#include "allocation_profiler.h"
+
+/*
+ * @brief Глобальные операторы new и delete, сообщающие о выделениях в AllocationProfiler.
+ * Включается в одну единицу трансляции программы, которой нужен профиль выделений. Размер блока берется из
+ * malloc_usable_size, поэтому выделение и освобождение учитываются одинаково без sized delete.
+ */
+
+namespace allocation_hooks_detail
+{
+
+void* Allocate( std::size_t size, std::size_t alignment )
+{
+    void* pointer = alignment > alignof( std::max_align_t )
+        ? std::aligned_alloc( alignment, ( std::max< std::size_t >( size, 1 ) + alignment - 1 ) / alignment * alignment )
+        : std::malloc( std::max< std::size_t >( size, 1 ) );
+    if( pointer ) AllocationProfiler::OnAllocate( malloc_usable_size( pointer ) );
+    return pointer;
+}
+
+void Free( void* pointer ) noexcept
+{
+    if( !pointer ) return;
+    AllocationProfiler::OnFree( malloc_usable_size( pointer ) );
+    std::free( pointer );
+}
+
+void* AllocateOrThrow( std::size_t size, std::size_t alignment )
+{
+    void* pointer = Allocate( size, alignment );
+    if( !pointer ) throw std::bad_alloc();
+    return pointer;
+}
+
+/* Отмечает в профилировщике, что выделения учитываются */
+const bool installed = ( AllocationProfiler::InstallHooks(), true );
+
+}
+
+void* operator new( std::size_t size ) { return allocation_hooks_detail::AllocateOrThrow( size, 0 ); }
+void* operator new[]( std::size_t size ) { return allocation_hooks_detail::AllocateOrThrow( size, 0 ); }
+void* operator new( std::size_t size, const std::nothrow_t& ) noexcept { return allocation_hooks_detail::Allocate( size, 0 ); }
+void* operator new[]( std::size_t size, const std::nothrow_t& ) noexcept { return allocation_hooks_detail::Allocate( size, 0 ); }
+void* operator new( std::size_t size, std::align_val_t alignment ) { return allocation_hooks_detail::AllocateOrThrow( size, static_cast< std::size_t >( alignment ) ); }
+void* operator new[]( std::size_t size, std::align_val_t alignment ) { return allocation_hooks_detail::AllocateOrThrow( size, static_cast< std::size_t >( alignment ) ); }
+
+void operator delete( void* pointer ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete[]( void* pointer ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete( void* pointer, std::size_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete[]( void* pointer, std::size_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete( void* pointer, std::align_val_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete[]( void* pointer, std::align_val_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete( void* pointer, std::size_t, std::align_val_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
+void operator delete[]( void* pointer, std::size_t, std::align_val_t ) noexcept { allocation_hooks_detail::Free( pointer ); }
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+
+class AllocationPhase;
+
+/* @brief Выделения памяти одной фазы, суммарно по всем ее вызовам */
+struct AllocationStats
+{
+    /* Количество вызовов фазы */
+    size_t mCalls = 0;
+
+    size_t mAllocations = 0;
+    size_t mFrees = 0;
+
+    /* Выделено байт - фактические размеры блоков malloc */
+    size_t mBytes = 0;
+
+    /* Наибольший прирост занятой памяти от начала фазы за один вызов */
+    size_t mPeakLiveBytes = 0;
+};
+
+/*
+ * @brief Профилировщик выделений памяти по фазам Compare и DoEditorialPrescription.
+ * Фазы отмечаются объектами AllocationPhase; выделение учитывается во внутренней фазе текущего потока и во всех
+ * внешних. Считать выделения начинают операторы new и delete из allocation_hooks.h - этот заголовок включается
+ * в одну единицу трансляции программы. Без него и без Enable фазы ничего не считают и почти ничего не стоят.
+ * @warning Учитываются только выделения потока, открывшего фазу.
+ */
+class AllocationProfiler
+{
+public:
+
+    /* @brief Включает или выключает учет; фазы, открытые до вызова, не меняются */
+    static void Enable( bool enabled ) { Enabled().store( enabled, std::memory_order_relaxed ); }
+    static bool IsEnabled() { return Enabled().load( std::memory_order_relaxed ); }
+
+    /* @brief Операторы new и delete учитывают выделения: подключен allocation_hooks.h */
+    static bool HooksInstalled() { return HooksFlag().load( std::memory_order_relaxed ); }
+
+    /* @brief Очищает отчет */
+    static void Reset();
+
+    /* @brief Отчет: фаза - суммарные выделения, по имени фазы */
+    static std::map< std::string, AllocationStats > Report();
+
+    /*
+     * @brief Печатает отчет таблицей: фаза, вызовы, выделения, освобождения, байты, пик.
+     * @param os Поток вывода.
+     */
+    static void Print( std::ostream& os );
+
+    /* @brief Вызываются операторами new и delete из allocation_hooks.h */
+    static void OnAllocate( size_t bytes );
+    static void OnFree( size_t bytes );
+    static void InstallHooks() { HooksFlag().store( true, std::memory_order_relaxed ); }
+
+private:
+
+    friend class AllocationPhase;
+
+    static std::atomic< bool >& Enabled()
+    {
+        static std::atomic< bool > enabled{ false };
+        return enabled;
+    }
+
+    static std::atomic< bool >& HooksFlag()
+    {
+        static std::atomic< bool > installed{ false };
+        return installed;
+    }
+
+    static std::mutex& Mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::map< std::string, AllocationStats >& Phases()
+    {
+        static std::map< std::string, AllocationStats > phases;
+        return phases;
+    }
+
+    /* Внутренняя открытая фаза потока; пока отчет обновляется, выделения не учитываются */
+    static thread_local AllocationPhase* tCurrent;
+    static thread_local bool tPaused;
+};
+
+/*
+ * @brief Фаза профилирования: учитывает выделения потока от создания до разрушения.
+ * @details Имя должно жить дольше фазы - обычно это строковый литерал. Вложенные фазы именуются через точку, например "compare.moves".
+ */
+class AllocationPhase
+{
+public:
+
+    explicit AllocationPhase( const char* name );
+    ~AllocationPhase() { End(); }
+
+    AllocationPhase( const AllocationPhase& ) = delete;
+    AllocationPhase& operator=( const AllocationPhase& ) = delete;
+
+    /*
+     * @brief Завершает фазу и начинает следующую с тем же родителем - для последовательных шагов одной функции.
+     * @param name Имя следующей фазы.
+     */
+    void Restart( const char* name );
+
+private:
+
+    friend class AllocationProfiler;
+
+    void Begin();
+    void End();
+
+    const char* mName;
+    AllocationPhase* mParent = nullptr;
+    bool mActive = false;
+
+    size_t mAllocations = 0;
+    size_t mFrees = 0;
+    size_t mBytes = 0;
+
+    /* Занятая память относительно начала фазы; отрицательна, если фаза освободила чужие блоки */
+    int64_t mLive = 0;
+    int64_t mPeak = 0;
+};
+
+thread_local AllocationPhase* AllocationProfiler::tCurrent = nullptr;
+thread_local bool AllocationProfiler::tPaused = false;
+
+void AllocationProfiler::Reset()
+{
+    std::lock_guard< std::mutex > lock( Mutex() );
+    Phases().clear();
+}
+
+std::map< std::string, AllocationStats > AllocationProfiler::Report()
+{
+    /* Копия создается без учета, чтобы отчет не попадал в открытые фазы */
+    tPaused = true;
+    std::map< std::string, AllocationStats > report;
+    {
+        std::lock_guard< std::mutex > lock( Mutex() );
+        report = Phases();
+    }
+    tPaused = false;
+    return report;
+}
+
+void AllocationProfiler::Print( std::ostream& os )
+{
+    auto report = Report();
+    size_t width = 5;
+    for( const auto& [ name, stats ] : report ) width = std::max( width, name.size() );
+    os << std::left << std::setw( width ) << "phase" << std::right << std::setw( 8 ) << "calls" << std::setw( 12 ) << "allocs"
+       << std::setw( 12 ) << "frees" << std::setw( 14 ) << "bytes" << std::setw( 14 ) << "peak" << std::endl;
+    for( const auto& [ name, stats ] : report )
+    {
+        os << std::left << std::setw( width ) << name << std::right << std::setw( 8 ) << stats.mCalls << std::setw( 12 ) << stats.mAllocations
+           << std::setw( 12 ) << stats.mFrees << std::setw( 14 ) << stats.mBytes << std::setw( 14 ) << stats.mPeakLiveBytes << std::endl;
+    }
+}
+
+void AllocationProfiler::OnAllocate( size_t bytes )
+{
+    auto* phase = tCurrent;
+    if( !phase || tPaused ) return;
+    ++phase->mAllocations;
+    phase->mBytes += bytes;
+    phase->mLive += static_cast< int64_t >( bytes );
+    phase->mPeak = std::max( phase->mPeak, phase->mLive );
+}
+
+void AllocationProfiler::OnFree( size_t bytes )
+{
+    auto* phase = tCurrent;
+    if( !phase || tPaused ) return;
+    ++phase->mFrees;
+    phase->mLive -= static_cast< int64_t >( bytes );
+}
+
+AllocationPhase::AllocationPhase( const char* name )
+    : mName( name )
+{
+    Begin();
+}
+
+void AllocationPhase::Restart( const char* name )
+{
+    End();
+    mName = name;
+    Begin();
+}
+
+void AllocationPhase::Begin()
+{
+    if( !AllocationProfiler::IsEnabled() ) return;
+    mActive = true;
+    mAllocations = mFrees = mBytes = 0;
+    mLive = mPeak = 0;
+    mParent = AllocationProfiler::tCurrent;
+    AllocationProfiler::tCurrent = this;
+}
+
+void AllocationPhase::End()
+{
+    if( !mActive ) return;
+    mActive = false;
+    AllocationProfiler::tCurrent = mParent;
+
+    /* Выделения фазы входят во внешнюю; ее пик - занятое до фазы плюс пик фазы */
+    if( mParent )
+    {
+        mParent->mAllocations += mAllocations;
+        mParent->mFrees += mFrees;
+        mParent->mBytes += mBytes;
+        mParent->mPeak = std::max( mParent->mPeak, mParent->mLive + mPeak );
+        mParent->mLive += mLive;
+    }
+
+    AllocationProfiler::tPaused = true;
+    {
+        std::lock_guard< std::mutex > lock( AllocationProfiler::Mutex() );
+        auto& stats = AllocationProfiler::Phases()[ mName ];
+        ++stats.mCalls;
+        stats.mAllocations += mAllocations;
+        stats.mFrees += mFrees;
+        stats.mBytes += mBytes;
+        stats.mPeakLiveBytes = std::max( stats.mPeakLiveBytes, static_cast< size_t >( std::max< int64_t >( mPeak, 0 ) ) );
+    }
+    AllocationProfiler::tPaused = false;
+}
@@ -0,0 +1,623 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <address_differ.h>
+#include <address_list.h>
+#include <replication.h>
+#include <diff_pipeline.h>
+#include <transport_cost.h>
+#include <merge.h>
+#include <address_arena.h>
+#include <positions.h>
+#include <patch_overlay.h>
+#include <persistent_list.h>
+#include <reconciliation.h>
+#include <patch_codec.h>
+#include <allocation_hooks.h>
+
+/*
+ * @brief Формирует список адресов заданного размера.
+ * @param size Размер списка.
+ */
+std::vector< Address > MakeList( size_t size )
+{
+    std::vector< Address > result;
+    result.reserve( size );
+    for( size_t i = 0; i < size; ++i )
+    {
+        result.push_back( { "street " + std::to_string( i ) + ", house " + std::to_string( i % 97 ), i + 1, i }  );
+    }
+    return result;
+}
+
+/*
+ * @brief Формирует следующую версию списка: изменяет долю rate элементов, добавляет и удаляет по rate / 10.
+ * @param current Текущая версия.
+ * @param rate Доля изменяемых элементов.
+ * @param next_id Следующий свободный идентификатор.
+ * @param gen Генератор случайных чисел.
+ */
+std::vector< Address > MutateList( const std::vector< Address >& current, double rate, size_t& next_id, std::mt19937& gen )
+{
+    std::vector< Address > result( current );
+    size_t changes = std::max< size_t >( 1, static_cast< size_t >( result.size() * rate ) );
+    for( size_t i = 0; i < changes; ++i )
+    {
+        auto& elem = result[ gen() % result.size() ];
+        elem.mValue = elem.mValue.Str() + "'";
+    }
+    for( size_t i = 0; i < changes / 10; ++i )
+    {
+        result.erase( result.begin() + gen() % result.size() );
+        result.insert( result.begin() + gen() % result.size(), Address{ "new " + std::to_string( next_id ), next_id, 0 } );
+        ++next_id;
+    }
+    for( size_t i = 0; i < result.size(); ++i )
+    {
+        result[ i ].mPosition = i;
+    }
+    return result;
+}
+
+/*
+ * @brief Замеряет репликацию через Unix-сокет: предписаний в секунду и задержку доставки.
+ * @param size Размер списка.
+ * @param rate Доля изменяемых элементов в каждой версии.
+ * @param versions Количество публикуемых версий.
+ */
+void BenchReplication( size_t size, double rate, size_t versions )
+{
+    auto socket_path = "/tmp/address_differ_bench_" + std::to_string( getpid() ) + ".sock";
+    std::mt19937 gen( 42 );
+    size_t next_id = size + 1;
+
+    /* Версии готовятся заранее, чтобы в замер не попала их генерация */
+    std::vector< std::vector< Address > > lists{ MakeList( size ) };
+    for( size_t i = 0; i < versions; ++i )
+    {
+        lists.push_back( MutateList( lists.back(), rate, next_id, gen ) );
+    }
+
+    ReplicationPublisher publisher( socket_path, lists.front() );
+    ReplicationSubscriber subscriber( socket_path );
+    publisher.AcceptSubscribers( 1000 );
+    while( !subscriber.State().Synced() ) subscriber.Poll( 1000 );
+
+    std::vector< uint64_t > latencies;
+    std::thread reader( [&]()
+    {
+        while( subscriber.State().Sequence() != versions && subscriber.Connected() )
+        {
+            if( subscriber.Poll( 100 ) > 0 ) latencies.push_back( subscriber.LastLatencyNs() );
+        }
+    } );
+
+    auto start = std::chrono::steady_clock::now();
+    for( size_t i = 1; i <= versions; ++i )
+    {
+        publisher.Publish( lists[ i ] );
+    }
+    reader.join();
+    double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+    if( !subscriber.Connected() )
+    {
+        std::cout << "subscriber dropped!" << std::endl;
+        return;
+    }
+    if( !( subscriber.State().Addresses() == lists.back() ) ) std::cout << "replica diverged!" << std::endl;
+
+    std::sort( latencies.begin(), latencies.end() );
+    double mean = 0;
+    for( auto latency : latencies ) mean += latency;
+    mean /= latencies.size();
+
+    std::cout << std::setw( 8 ) << size << std::setw( 8 ) << rate * 100 << "%"
+              << std::setw( 12 ) << std::fixed << std::setprecision( 1 ) << versions / seconds << " patches/s"
+              << std::setw( 12 ) << mean / 1000 << " us mean"
+              << std::setw( 12 ) << latencies[ latencies.size() * 99 / 100 ] / 1000.0 << " us p99" << std::endl;
+}
+
+/*
+ * @brief Сравнивает последовательную обработку снимков (разбор, сравнение, кодирование) с конвейером.
+ * @param size Размер списка.
+ * @param versions Количество снимков.
+ * @param compare_threads Количество потоков сравнения в конвейере.
+ */
+void BenchPipeline( size_t size, size_t versions, size_t compare_threads )
+{
+    std::mt19937 gen( 7 );
+    size_t next_id = size + 1;
+    std::vector< Address > current = MakeList( size );
+
+    /* Снимки хранятся закодированными: загрузка - это их разбор */
+    std::vector< std::string > encoded_snapshots;
+    for( size_t i = 0; i < versions; ++i )
+    {
+        std::string out;
+        PatchCodec::EncodeSnapshot( current, out );
+        encoded_snapshots.push_back( std::move( out ) );
+        current = MutateList( current, 0.01, next_id, gen );
+    }
+    auto load = [&]( size_t index )
+    {
+        std::vector< Address > addresses;
+        PatchCodec::DecodeSnapshot( encoded_snapshots[ index ], addresses );
+        return addresses;
+    };
+
+    size_t sequential_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto previous = load( 0 );
+    for( size_t i = 1; i < versions; ++i )
+    {
+        auto next = load( i );
+        std::string out;
+        PatchCodec::EncodePatch( DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >(
+            previous, next ), out );
+        sequential_bytes += out.size();
+        previous = std::move( next );
+    }
+    double sequential = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+    DiffPipelineConfig config;
+    config.mCompareThreads = compare_threads;
+    size_t pipeline_bytes = 0;
+    start = std::chrono::steady_clock::now();
+    DiffPipeline( config ).Run( versions, load, [&]( size_t, std::string&& patch ) { pipeline_bytes += patch.size(); } );
+    double pipelined = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+
+    if( sequential_bytes != pipeline_bytes ) std::cout << "pipeline output differs!" << std::endl;
+    std::cout << std::setw( 8 ) << size << std::setw( 4 ) << compare_threads << " compare threads"
+              << std::setw( 12 ) << std::fixed << std::setprecision( 1 ) << versions / sequential << " snapshots/s sequential"
+              << std::setw( 12 ) << versions / pipelined << " snapshots/s pipelined" << std::endl;
+}
+
+/*
+ * @brief Калибрует модель стоимости и сверяет ее выбор с замеренным временем разбора и применения.
+ * @param size Размер списка.
+ */
+void BenchCostModel( size_t size )
+{
+    auto model = TransportCostModel::Calibrate( size );
+    const auto& c = model.GetCoefficients();
+    std::cout << std::fixed << std::setprecision( 2 )
+              << "transfer " << c.mTransferNsPerByte << " ns/byte, decode " << c.mDecodeNsPerByte << " ns/byte + " << c.mDecodeNsPerAddress
+              << " ns/address, copy " << c.mCopyNsPerElement << " ns/element, scan " << c.mScanNsPerElement << " ns/element, shift "
+              << c.mShiftNsPerElement << " ns/element" << std::endl;
+
+    std::mt19937 gen( 3 );
+    size_t next_id = size + 1;
+    auto old = MakeList( size );
+    std::vector< std::pair< std::string, std::vector< Address > > > cases;
+    for( double rate : { 0.001, 0.01, 0.1, 0.5 } )
+    {
+        cases.push_back( { std::to_string( rate * 100 ) + "% changed", MutateList( old, rate, next_id, gen ) } );
+    }
+    std::vector< Address > reversed( old.rbegin(), old.rend() );
+    for( size_t i = 0; i < reversed.size(); ++i ) reversed[ i ].mPosition = i;
+    cases.push_back( { "reversed", reversed } );
+
+    auto measure = []( auto fn )
+    {
+        double best = 0;
+        for( int i = 0; i < 5; ++i )
+        {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            double ns = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count();
+            if( i == 0 || ns < best ) best = ns;
+        }
+        return best;
+    };
+
+    for( const auto& [ name, updated ] : cases )
+    {
+        auto patch = DifferAddress( false ).Compare( AddressList( old ), AddressList( updated ) );
+        std::string encoded_patch, encoded_snapshot;
+        PatchCodec::EncodePatch( patch, encoded_patch );
+        PatchCodec::EncodeSnapshot( updated, encoded_snapshot );
+
+        double patch_ns = measure( [&]
+        {
+            CompareResult< Address > decoded;
+            PatchCodec::DecodePatch( encoded_patch, decoded );
+            DifferAddress( false ).DoEditorialPrescription( decoded, old );
+        } ) + c.mTransferNsPerByte * encoded_patch.size();
+        double snapshot_ns = measure( [&]
+        {
+            std::vector< Address > decoded;
+            PatchCodec::DecodeSnapshot( encoded_snapshot, decoded );
+        } ) + c.mTransferNsPerByte * encoded_snapshot.size();
+
+        bool chosen = model.PreferSnapshot( patch, old.size(), updated );
+        std::cout << std::setw( 16 ) << name
+                  << std::setw( 10 ) << model.EstimatePatch( patch, old.size() ).TotalNs() / 1000 << " /" << std::setw( 10 ) << patch_ns / 1000 << " us patch"
+                  << std::setw( 10 ) << model.EstimateSnapshot( updated ).TotalNs() / 1000 << " /" << std::setw( 10 ) << snapshot_ns / 1000 << " us snapshot"
+                  << "  model: " << ( chosen ? "snapshot" : "patch" )
+                  << ( chosen == ( snapshot_ns < patch_ns ) ? "" : "  (mispredicted)" ) << std::endl;
+    }
+}
+
+/*
+ * @brief Замеряет трехстороннее слияние двух независимых версий списка.
+ * @param size Размер базового списка.
+ * @param rate Доля изменяемых элементов в каждой версии.
+ */
+void BenchMerge( size_t size, double rate )
+{
+    std::mt19937 gen( 5 );
+    size_t next_id = size + 1;
+    auto base = MakeList( size );
+    auto ours = MutateList( base, rate, next_id, gen );
+    auto theirs = MutateList( base, rate, next_id, gen );
+    for( auto* side : { &ours, &theirs } )
+    {
+        for( size_t i = 0; i < size * rate / 10; ++i ) std::swap( ( *side )[ gen() % side->size() ], ( *side )[ gen() % side->size() ] );
+        for( size_t i = 0; i < side->size(); ++i ) ( *side )[ i ].mPosition = i;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto merged = DifferAddress( false ).Merge( base, ours, theirs );
+    double ms = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    std::cout << std::setw( 8 ) << size << " elements, " << std::setw( 5 ) << rate * 100 << "% changed: "
+              << std::setw( 8 ) << ms << " ms, " << merged.mConflicts.size() << " conflicts" << std::endl;
+}
+
+/*
+ * @brief Замеряет разбор полного списка и поиск изменений: вектор адресов с пулом строк против непрерывного буфера значений.
+ * @param size Размер списка.
+ */
+void BenchArena( size_t size )
+{
+    auto old = MakeList( size );
+    auto updated = old;
+    for( size_t i = 0; i < size; i += 1000 ) updated[ i ].mValue = updated[ i ].mValue.Str() + "'";
+    std::string encoded;
+    PatchCodec::EncodeSnapshot( updated, encoded );
+
+    auto ms_since = []( auto start ){ return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count(); };
+    DifferAddress differ( false );
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector< Address > decoded;
+    PatchCodec::DecodeSnapshot( encoded, decoded );
+    double vector_decode = ms_since( start );
+    start = std::chrono::steady_clock::now();
+    auto vector_changes = differ.Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old, decoded ).mChandedOperations.size();
+    double vector_compare = ms_since( start );
+
+    AddressArena old_arena( old );
+    start = std::chrono::steady_clock::now();
+    AddressArena arena;
+    AddressArena::FromSnapshot( encoded, arena );
+    double arena_decode = ms_since( start );
+    start = std::chrono::steady_clock::now();
+    auto arena_changes = differ.Compare( old_arena, arena ).mChandedOperations.size();
+    double arena_compare = ms_since( start );
+
+    std::cout << std::setw( 8 ) << size << " elements: vector decode " << vector_decode << " ms, compare " << vector_compare << " ms (" << vector_changes
+              << " changed); arena decode " << arena_decode << " ms, compare " << arena_compare << " ms (" << arena_changes << " changed)" << std::endl;
+}
+
+/*
+ * @brief Замеряет сравнение с изменением каждого step-го значения: копирование значений из константных списков против переноса из временных.
+ * @details Списки копируются перед каждым сравнением, копирование входит в оба замера.
+ * @param size Размер списка.
+ * @param step Шаг изменяемых элементов.
+ */
+void BenchRvalueCompare( size_t size, size_t step )
+{
+    auto old = MakeList( size );
+    auto updated = old;
+    for( size_t i = 0; i < size; i += step ) updated[ i ].mValue = updated[ i ].mValue.Str() + "'";
+
+    auto ms = []( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    };
+    DifferAddress differ( false );
+    double copied = ms( [&]
+    {
+        auto old_copy = old;
+        auto updated_copy = updated;
+        differ.Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old_copy, updated_copy );
+    } );
+    double moved = ms( [&]
+    {
+        auto old_copy = old;
+        auto updated_copy = updated;
+        differ.Compare( std::move( old_copy ), std::move( updated_copy ) );
+    } );
+    std::cout << std::setw( 8 ) << size << " elements, every " << step << " changed: const " << copied << " ms, rvalue " << moved << " ms" << std::endl;
+}
+
+/*
+ * @brief Замеряет чтение окна новой версии: применение предписания целиком против наложения предписания на снимок.
+ * @param size Размер списка.
+ * @param rate Доля изменяемых элементов.
+ */
+void BenchOverlay( size_t size, double rate )
+{
+    std::mt19937 gen( 17 );
+    size_t next_id = size + 1;
+    auto old = MakeList( size );
+    auto updated = MutateList( old, rate, next_id, gen );
+    auto patch = DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old, updated );
+
+    auto ms = []( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    };
+    const size_t first = size / 2;
+    std::vector< Address > applied_window, overlay_window;
+    double applied = ms( [&]
+    {
+        auto applied_list = DifferAddress( false ).DoEditorialPrescription( patch, old );
+        applied_window.assign( applied_list.begin() + first, applied_list.begin() + first + 50 );
+    } );
+    double overlay = ms( [&]{ overlay_window = PatchOverlay( old, patch ).Range( first, first + 50 ); } );
+    std::cout << std::setw( 8 ) << size << " elements, " << std::setw( 5 ) << rate * 100 << "% changed, window of 50: apply "
+              << applied << " ms, overlay " << overlay << " ms" << ( applied_window == overlay_window ? "" : " MISMATCH" ) << std::endl;
+}
+
+/*
+ * @brief Замеряет применение небольшого предписания и сравнение версий: вектор против неизменяемого списка с общими отрезками.
+ * @param size Размер списка.
+ * @param rate Доля изменяемых элементов.
+ */
+void BenchPersistent( size_t size, double rate )
+{
+    std::mt19937 gen( 19 );
+    size_t next_id = size + 1;
+    auto old = MakeList( size );
+    auto updated = MutateList( old, rate, next_id, gen );
+    auto patch = DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old, updated );
+    PersistentAddressList old_version( old );
+
+    auto ms = []( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    };
+    std::vector< Address > applied_list;
+    PersistentAddressList applied_version;
+    double vector_apply = ms( [&]{ applied_list = DifferAddress( false ).DoEditorialPrescription( patch, old ); } );
+    double persistent_apply = ms( [&]{ applied_version = DifferAddress( false ).DoEditorialPrescription( patch, old_version ); } );
+    double vector_compare = ms( [&]{ DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old, applied_list ); } );
+    double persistent_compare = ms( [&]{ DifferAddress( false ).Compare( old_version, applied_version ); } );
+    std::cout << std::setw( 8 ) << size << " elements, " << std::setw( 5 ) << rate * 100 << "% changed: apply vector " << vector_apply
+              << " ms, persistent " << persistent_apply << " ms; compare vector " << vector_compare << " ms, persistent " << persistent_compare << " ms"
+              << ( applied_version.ToVector() == applied_list ? "" : " MISMATCH" ) << std::endl;
+}
+
+/*
+ * @brief Замеряет сверку с репликой по эскизу: размер эскиза против размера снимка и время построения предписания.
+ * @param size Размер списка.
+ * @param rate Доля изменяемых элементов.
+ */
+void BenchReconciliation( size_t size, double rate )
+{
+    std::mt19937 gen( 23 );
+    size_t next_id = size + 1;
+    auto replica = MakeList( size );
+    auto updated = MutateList( replica, rate, next_id, gen );
+
+    auto ms = []( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    };
+    /* Реплика не знает количества отличий: начинает с малого эскиза и удваивает его */
+    std::string snapshot, encoded;
+    PatchCodec::EncodeSnapshot( replica, snapshot );
+    CompareResult< Address > patch;
+    size_t rounds = 0, sent = 0;
+    double elapsed = ms( [&]
+    {
+        for( size_t cells = ReconciliationSketch::CellsFor( 16 ); ; cells = ReconciliationSketch::CellsFor( cells ) )
+        {
+            ++rounds;
+            encoded.clear();
+            ReconciliationSketch::FromList( replica, cells ).Encode( encoded );
+            sent += encoded.size();
+            ReconciliationSketch sketch( ReconciliationSketch::HASH_COUNT );
+            ReconciliationSketch::Decode( encoded, sketch );
+            if( DifferAddress( false ).Compare( sketch, updated, patch ) ) break;
+        }
+    } );
+    bool valid = DifferAddress( false ).DoEditorialPrescription( patch, replica ) == updated;
+    std::cout << std::setw( 8 ) << size << " elements, " << std::setw( 5 ) << rate * 100 << "% changed: snapshot " << snapshot.size()
+              << " bytes, sketches " << sent << " bytes in " << rounds << " rounds, " << elapsed << " ms" << ( valid ? "" : " MISMATCH" ) << std::endl;
+}
+
+/* @brief Предел выделений фазы для BenchAllocations */
+struct AllocationBudget
+{
+    const char* mPhase;
+
+    /* Пределы на элемент списка */
+    double mAllocationsPerElement;
+    double mPeakBytesPerElement;
+};
+
+/*
+ * @brief Замеряет выделения памяти по фазам Compare и DoEditorialPrescription и сверяет их с бюджетом.
+ * @param size Размер списка.
+ * @param rate Доля изменяемых элементов.
+ * @param budgets Пределы по фазам.
+ * @return false - какая-то фаза превысила бюджет.
+ */
+bool BenchAllocations( size_t size, double rate, const std::vector< AllocationBudget >& budgets )
+{
+    std::mt19937 gen( 29 );
+    size_t next_id = size + 1;
+    auto old = MakeList( size );
+    auto updated = MutateList( old, rate, next_id, gen );
+
+    AllocationProfiler::Reset();
+    AllocationProfiler::Enable( true );
+    auto patch = DifferAddress( false ).Compare( old, updated );
+    auto indexed = DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( old, updated );
+    auto applied = DifferAddress( false ).DoEditorialPrescription( patch, old );
+    AllocationProfiler::Enable( false );
+
+    std::cout << std::setw( 8 ) << size << " elements, " << std::setw( 5 ) << rate * 100 << "% changed" << ( applied == updated ? "" : " MISMATCH" ) << std::endl;
+    AllocationProfiler::Print( std::cout );
+    auto report = AllocationProfiler::Report();
+    bool within = true;
+    for( const auto& budget : budgets )
+    {
+        const auto& stats = report[ budget.mPhase ];
+        double allocations = double( stats.mAllocations ) / size;
+        double peak = double( stats.mPeakLiveBytes ) / size;
+        if( allocations > budget.mAllocationsPerElement || peak > budget.mPeakBytesPerElement )
+        {
+            std::cout << "OVER BUDGET " << budget.mPhase << ": " << allocations << " allocations per element (budget " << budget.mAllocationsPerElement
+                      << "), peak " << peak << " bytes per element (budget " << budget.mPeakBytesPerElement << ")" << std::endl;
+            within = false;
+        }
+    }
+    return within;
+}
+
+/*
+ * @brief Замеряет сравнение коротких списков: общий путь, Compare с переходом на короткий путь и CompareSmall с переиспользуемым результатом.
+ * @param size Размер списка.
+ * @param iterations Количество сравнений.
+ */
+void BenchSmall( size_t size, size_t iterations )
+{
+    std::mt19937 gen( 31 );
+    size_t next_id = size + 1;
+    auto old = MakeList( size );
+    auto updated = MutateList( old, 0.1, next_id, gen );
+    std::swap( updated[ 0 ], updated[ size / 2 ] );
+    for( size_t i = 0; i < updated.size(); ++i ) updated[ i ].mPosition = i;
+
+    auto ns = [&]( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < iterations; ++i ) fn();
+        return std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count() / iterations;
+    };
+    DifferAddress differ( false );
+    AddressList old_list( old ), updated_list( updated );
+    CompareResult< Address > reused;
+    DifferAddress::ReserveSmall( reused );
+    double general = ns( [&]{ differ.Compare( old_list, updated_list ); } );
+    double compare = ns( [&]{ differ.Compare( old, updated ); } );
+    double small = ns( [&]{ differ.CompareSmall( old, updated, reused ); } );
+
+    AllocationProfiler::Reset();
+    AllocationProfiler::Enable( true );
+    {
+        AllocationPhase phase( "small" );
+        differ.CompareSmall( old, updated, reused );
+    }
+    AllocationProfiler::Enable( false );
+    std::cout << std::setw( 8 ) << size << " elements: by columns " << general << " ns, Compare " << compare << " ns, CompareSmall " << small
+              << " ns, " << AllocationProfiler::Report()[ "small" ].mAllocations << " allocations"
+              << ( reused.mMovedOperations == differ.Compare( old_list, updated_list ).mMovedOperations ? "" : " MISMATCH" ) << std::endl;
+}
+
+/*
+ * @brief Замеряет упорядочивание списка по позициям: сортировка сравнением против NormalizePositions.
+ * @param size Размер списка.
+ */
+void BenchNormalize( size_t size )
+{
+    std::mt19937 gen( 11 );
+    auto shuffled = MakeList( size );
+    std::shuffle( shuffled.begin(), shuffled.end(), gen );
+    auto sparse = shuffled;
+    for( auto& elem : sparse ) elem.mPosition = elem.mPosition * 1000 + gen() % 1000;
+
+    auto ms = []( auto fn )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - start ).count();
+    };
+    auto by_position = []( const Address& a, const Address& b ){ return a.mPosition < b.mPosition; };
+    std::cout << std::setw( 8 ) << size << " elements: std::sort "
+              << ms( [&]{ auto copy = shuffled; std::sort( copy.begin(), copy.end(), by_position ); } ) << " ms, dense "
+              << ms( [&]{ auto copy = shuffled; NormalizePositions( copy ); } ) << " ms, sparse std::sort "
+              << ms( [&]{ auto copy = sparse; std::sort( copy.begin(), copy.end(), by_position ); } ) << " ms, sparse radix "
+              << ms( [&]{ auto copy = sparse; NormalizePositions( copy, true ); } ) << " ms" << std::endl;
+}
+
+int main()
+{
+    std::cout << "patch vs snapshot cost model (estimated / measured)" << std::endl;
+    BenchCostModel( 4000 );
+
+    std::cout << "position normalization (each includes a list copy)" << std::endl;
+    BenchNormalize( 2000000 );
+
+    std::cout << "snapshot decode and compare: string pool vs value arena" << std::endl;
+    BenchArena( 1000000 );
+
+    std::cout << "compare: copied vs moved values" << std::endl;
+    BenchRvalueCompare( 1000000, 4 );
+
+    std::cout << "window of the new version: apply vs overlay" << std::endl;
+    BenchOverlay( 200000, 0.005 );
+
+    std::cout << "small patch: vector vs persistent list" << std::endl;
+    BenchPersistent( 1000000, 0.0001 );
+
+    std::cout << "remote diff: snapshot vs reconciliation sketch" << std::endl;
+    BenchReconciliation( 1000000, 0.0001 );
+
+    /* Бюджеты - замеренные значения с запасом около 10%; превышение - регрессия по памяти */
+    std::cout << "small lists" << std::endl;
+    for( size_t size : { 8, 32, 64 } )
+    {
+        BenchSmall( size, 200000 );
+    }
+
+    std::cout << "allocations per phase" << std::endl;
+    bool within_budget = BenchAllocations( 2000, 0.01, {
+        { "compare", 0.05, 560 },
+        { "compare.reserve", 0.005, 450 },
+        { "indexed_compare", 5.5, 100 },
+        { "apply", 0.005, 80 },
+    } );
+
+    std::cout << "three-way merge" << std::endl;
+    for( size_t size : { 100000, 1000000 } )
+    {
+        BenchMerge( size, 0.001 );
+    }
+
+    std::cout << "diff pipeline" << std::endl;
+    for( size_t threads : { 1, 4 } )
+    {
+        BenchPipeline( 2000, 60, threads );
+    }
+
+    std::cout << "replication over unix socket" << std::endl;
+    for( size_t size : { 1000, 4000 } )
+    {
+        for( double rate : { 0.001, 0.01, 0.05 } )
+        {
+            BenchReplication( size, rate, size > 1000 ? 50 : 200 );
+        }
+    }
+
+    return within_budget ? 0 : 1;
+}
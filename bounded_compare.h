@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include "address_differ.h"
+#include "patch_codec.h"
+
+/* @brief Бюджет редакционного предписания */
+struct CompareBudget
+{
+    /* Максимальное количество операций */
+    size_t mMaxOperations = SIZE_MAX;
+
+    /* Максимальный размер предписания в кодировке PatchCodec, байт */
+    size_t mMaxBytes = SIZE_MAX;
+};
+
+/* @brief Результат сравнения с бюджетом */
+struct BoundedCompareResult
+{
+    /* Предписание не уложилось в бюджет; mResult неполный */
+    bool mOverBudget = false;
+
+    /* Количество операций: точное, если бюджет не превышен, иначе оценка */
+    size_t mEstimatedOperations = 0;
+
+    /* Размер закодированного предписания: точный, если бюджет не превышен, иначе оценка */
+    size_t mEstimatedBytes = 0;
+
+    /* Предписание. Совпадает с результатом Compare, если бюджет не превышен */
+    CompareResult< Address > mResult;
+};
+
+BoundedCompareResult DifferAddress::CompareBounded( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses, const CompareBudget& budget )
+{
+    BoundedCompareResult bounded;
+    auto& result = bounded.mResult;
+
+    /* Признак формата и 4 счетчика операций; счетчики больше 127 занимают больше байта, это учитывается в конце */
+    size_t operations = 0;
+    size_t bytes = 5;
+    auto account = [&]( const OperationData< Address >& operation )
+    {
+        ++operations;
+        bytes += PatchCodec::EncodedSize( operation );
+        return operations <= budget.mMaxOperations && bytes <= budget.mMaxBytes;
+    };
+
+    /* Бюджет превышен на линейном проходе: оцениваем полный размер по доле просмотренных элементов, без перемещений */
+    const size_t total = old_addresses.size() + updated_addresses.size();
+    auto over_budget = [&]( size_t processed )
+    {
+        bounded.mOverBudget = true;
+        bounded.mEstimatedOperations = operations * total / std::max< size_t >( processed, 1 );
+        bounded.mEstimatedBytes = 5 + ( bytes - 5 ) * total / std::max< size_t >( processed, 1 );
+        return bounded;
+    };
+
+    std::unordered_map< size_t, size_t > old_index;
+    old_index.reserve( old_addresses.size() );
+    for( size_t i = 0; i < old_addresses.size(); ++i )
+    {
+        old_index.emplace( old_addresses[ i ].mId, i );
+    }
+    std::unordered_set< size_t > updated_ids;
+    updated_ids.reserve( updated_addresses.size() );
+    for( const auto& elem : updated_addresses )
+    {
+        updated_ids.emplace( elem.mId );
+    }
+
+    /* Находим удаленные элементы */
+    std::unordered_set< size_t > deleted_ids;
+    for( size_t i = 0; i < old_addresses.size(); ++i )
+    {
+        const auto& elem = old_addresses[ i ];
+        if( updated_ids.count( elem.mId ) != 0 ) continue;
+        deleted_ids.emplace( elem.mId );
+        result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+        if( !account( result.mDeletedOperations.back() ) ) return over_budget( i + 1 );
+    }
+
+    /* Находим добавленные и измененные элементы за один проход */
+    for( size_t i = 0; i < updated_addresses.size(); ++i )
+    {
+        const auto& elem = updated_addresses[ i ];
+        auto it = old_index.find( elem.mId );
+        if( it == old_index.end() )
+        {
+            result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+            if( !account( result.mAddedOperations.back() ) ) return over_budget( old_addresses.size() + i + 1 );
+        }
+        else if( old_addresses[ it->second ].mValue != elem.mValue )
+        {
+            result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses[ it->second ], elem, elem.mPosition, std::nullopt } );
+            if( !account( result.mChandedOperations.back() ) ) return over_budget( old_addresses.size() + i + 1 );
+        }
+    }
+
+    /*
+     * Перемещения - самая дорогая часть: прерываем перестановку на первом перемещении сверх бюджета.
+     * Кодек может записать перемещения перестановкой; она не короче своей длины, а длина не меньше самой дальней позиции
+     * перемещений. Поэтому размер перемещений оценивается снизу меньшим из двух представлений.
+     */
+    size_t moves_bytes = 0;
+    size_t permutation_size = 0;
+    auto moves_lower_bound = [&]()
+    {
+        return std::min( moves_bytes, PatchCodec::VarintSize( permutation_size ) + permutation_size );
+    };
+    auto account_move = [&]( const OperationData< Address >& operation )
+    {
+        ++operations;
+        moves_bytes += PatchCodec::EncodedSize( operation );
+        permutation_size = std::max( { permutation_size, operation.mPositionStart + 1, *operation.mPositionEnd + 1 } );
+        return operations <= budget.mMaxOperations && bytes + moves_lower_bound() <= budget.mMaxBytes;
+    };
+
+    auto copy_ids = FormCopyIds( old_addresses, result.mAddedOperations, deleted_ids );
+    if( !ResolveMoves( copy_ids, updated_addresses, result.mMovedOperations, account_move ) )
+    {
+        /* Каждое перемещение ставит на место хотя бы один элемент, поэтому оставшихся не больше, чем элементов не на своих местах */
+        size_t misplaced = 0;
+        for( size_t i = 0; i < copy_ids.size(); ++i )
+        {
+            if( copy_ids[ i ] != updated_addresses[ i ].mId ) ++misplaced;
+        }
+        size_t average_move = moves_bytes / result.mMovedOperations.size();
+        size_t whole_permutation = PatchCodec::VarintSize( copy_ids.size() ) + copy_ids.size() * PatchCodec::VarintSize( 2 * copy_ids.size() );
+
+        bounded.mOverBudget = true;
+        bounded.mEstimatedOperations = operations + misplaced;
+        bounded.mEstimatedBytes = bytes + std::min( moves_bytes + misplaced * average_move, std::max( whole_permutation, moves_lower_bound() ) );
+        return bounded;
+    }
+
+    /* Точный размер: длина счетчиков операций и перемещения, которые кодек заменит перестановкой */
+    bytes = PatchCodec::EncodedSize( result );
+    bounded.mOverBudget = bytes > budget.mMaxBytes;
+    bounded.mEstimatedOperations = operations;
+    bounded.mEstimatedBytes = bytes;
+    return bounded;
+}
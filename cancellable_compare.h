@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include "address_differ.h"
+
+/*
+ * @brief Признак отмены долгой операции и необязательный срок ее выполнения.
+ * Отменить можно из другого потока; операция проверяет признак в своих циклах и завершается досрочно.
+ */
+class CancellationToken
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    /* Без срока: операция прерывается только вызовом Cancel */
+    CancellationToken() = default;
+
+    /*
+     * @param deadline Момент, после которого операция прерывается.
+     */
+    explicit CancellationToken( Clock::time_point deadline )
+        : mDeadline( deadline ) {}
+
+    CancellationToken( const CancellationToken& ) = delete;
+    CancellationToken& operator=( const CancellationToken& ) = delete;
+
+    /*
+     * @brief Признак со сроком, отсчитанным от текущего момента.
+     * @param timeout Время на выполнение операции.
+     */
+    static CancellationToken After( Clock::duration timeout ) { return CancellationToken( Clock::now() + timeout ); }
+
+    /* @brief Отменяет операцию. Потокобезопасен */
+    void Cancel() { mCancelled.store( true, std::memory_order_relaxed ); }
+
+    /* @brief Операция отменена или срок истек */
+    bool Expired() const
+    {
+        return mCancelled.load( std::memory_order_relaxed ) || ( mDeadline && Clock::now() >= *mDeadline );
+    }
+
+private:
+
+    std::atomic< bool > mCancelled{ false };
+    std::optional< Clock::time_point > mDeadline;
+};
+
+/* @brief Результат сравнения с возможностью отмены */
+struct CancellableCompareResult
+{
+    /* Сравнение завершено. Иначе mResult содержит только операции, найденные до отмены, и не годится для применения */
+    bool mComplete = false;
+
+    /* Просмотрено элементов обоих списков при поиске удалений, добавлений и изменений */
+    size_t mScanned = 0;
+
+    /* Элементов не на своих местах в момент отмены при поиске перемещений; 0, если отмена случилась раньше */
+    size_t mMisplaced = 0;
+
+    /* Предписание. Совпадает с результатом Compare, если сравнение завершено */
+    CompareResult< Address > mResult;
+};
+
+/* @brief Результат выполнения предписания с возможностью отмены */
+struct CancellableApplyResult
+{
+    /* Предписание выполнено полностью */
+    bool mComplete = false;
+
+    /* Выполнено операций; перестановка считается одной операцией */
+    size_t mAppliedOperations = 0;
+
+    /* Всего операций в предписании */
+    size_t mTotalOperations = 0;
+
+    /* Новый список адресов. Пуст, если выполнение прервано */
+    std::vector< Address > mAddresses;
+};
+
+CancellableCompareResult DifferAddress::Compare( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses,
+    const CancellationToken& token )
+{
+    CancellableCompareResult cancellable;
+    auto& result = cancellable.mResult;
+
+    /* Часы опрашиваются раз в 4096 элементов линейных проходов: проверка не заметна на фоне поиска в хеш-таблицах */
+    auto expired = [&]( size_t i ){ return ( i & 4095 ) == 0 && token.Expired(); };
+
+    std::unordered_map< size_t, size_t > old_index;
+    old_index.reserve( old_addresses.size() );
+    for( size_t i = 0; i < old_addresses.size(); ++i )
+    {
+        if( expired( i ) ) return cancellable;
+        old_index.emplace( old_addresses[ i ].mId, i );
+    }
+    std::unordered_set< size_t > updated_ids;
+    updated_ids.reserve( updated_addresses.size() );
+    for( size_t i = 0; i < updated_addresses.size(); ++i )
+    {
+        if( expired( i ) ) return cancellable;
+        updated_ids.emplace( updated_addresses[ i ].mId );
+    }
+
+    /* Находим удаленные элементы */
+    std::unordered_set< size_t > deleted_ids;
+    for( const auto& elem : old_addresses )
+    {
+        if( expired( cancellable.mScanned++ ) ) return cancellable;
+        if( updated_ids.count( elem.mId ) != 0 ) continue;
+        deleted_ids.emplace( elem.mId );
+        result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+    }
+
+    /* Находим добавленные и измененные элементы за один проход */
+    for( const auto& elem : updated_addresses )
+    {
+        if( expired( cancellable.mScanned++ ) ) return cancellable;
+        auto it = old_index.find( elem.mId );
+        if( it == old_index.end() )
+        {
+            result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, elem, std::nullopt, elem.mPosition, std::nullopt } );
+        }
+        else if( old_addresses[ it->second ].mValue != elem.mValue )
+        {
+            result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses[ it->second ], elem, elem.mPosition, std::nullopt } );
+        }
+    }
+
+    /*
+     * Перемещения - самая долгая часть: каждое стоит O(n). Срок проверяется после каждого перемещения и раз в 4096 элементов
+     * внутри построения копии и выбора перемещения. Недостроенная копия отбрасывается по повторной проверке срока.
+     */
+    auto expired_now = [&]{ return token.Expired(); };
+    auto copy_ids = FormCopyIds( old_addresses, result.mAddedOperations, deleted_ids, expired_now );
+    if( token.Expired() ) return cancellable;
+    if( !ResolveMoves( copy_ids, updated_addresses, result.mMovedOperations, [&]( const OperationData< Address >& ){ return !token.Expired(); }, expired_now ) )
+    {
+        for( size_t i = 0; i < copy_ids.size(); ++i )
+        {
+            if( copy_ids[ i ] != updated_addresses[ i ].mId ) ++cancellable.mMisplaced;
+        }
+        return cancellable;
+    }
+
+    cancellable.mComplete = true;
+    return cancellable;
+}
+
+CancellableApplyResult DifferAddress::DoEditorialPrescription( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses,
+    const CancellationToken& token )
+{
+    CancellableApplyResult cancellable;
+    cancellable.mTotalOperations = compare_result.mAddedOperations.size() + compare_result.mDeletedOperations.size() +
+        compare_result.mChandedOperations.size() + compare_result.mMovedOperations.size() + ( compare_result.mPermutation.empty() ? 0 : 1 );
+    if( token.Expired() ) return cancellable;
+
+    std::vector< Address > result( old_adresses.begin(), old_adresses.end() );
+    cancellable.mAppliedOperations = ApplyOperations( compare_result, result, [&]{ return token.Expired(); } );
+    cancellable.mComplete = cancellable.mAppliedOperations == cancellable.mTotalOperations;
+    if( cancellable.mComplete ) cancellable.mAddresses = std::move( result );
+    return cancellable;
+}
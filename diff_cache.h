@@ -0,0 +1,211 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <cstdint>
+#include <unordered_map>
+#include "address_differ.h"
+#include "patch_codec.h"
+#include "hash_mix.h"
+
+/*
+ * @brief Кеш закодированных предписаний между версиями списка адресов.
+ * Ключ - отпечатки содержимого старого и нового списков. Размер кеша ограничен суммой размеров предписаний,
+ * при превышении вытесняются давно не запрошенные. Одновременные запросы одного предписания ждут единственного вычисления.
+ * Потокобезопасен.
+ */
+class DiffCache
+{
+public:
+
+    /* Закодированное предписание; разделяется между всеми запросившими */
+    using Patch = std::shared_ptr< const std::string >;
+
+    /*
+     * @param max_bytes Наибольший суммарный размер хранимых предписаний, байт.
+     */
+    explicit DiffCache( size_t max_bytes = 64 << 20 )
+        : mMaxBytes( max_bytes ) {}
+
+    /*
+     * @brief Отпечаток содержимого списка: идентификаторы и значения в порядке списка.
+     * @details Значения хешируются по содержимому, а не по записи пула, поэтому отпечаток не зависит от времени жизни строк.
+     * @param addresses Список адресов.
+     */
+    static uint64_t Fingerprint( const std::vector< Address >& addresses );
+
+    /*
+     * @brief Возвращает предписание между списками, вычисляя его при отсутствии в кеше.
+     * @param old_addresses Старый список адресов.
+     * @param updated_addresses Новый список адресов.
+     */
+    Patch Get( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses );
+
+    /*
+     * @brief Возвращает предписание по отпечаткам, вычисляя его compute при отсутствии в кеше.
+     * @details Исключение из compute получают все ожидавшие запросы; предписание не кешируется.
+     * @param old_fingerprint Отпечаток старого списка.
+     * @param updated_fingerprint Отпечаток нового списка.
+     * @param compute Возвращает закодированное предписание.
+     */
+    template< typename Compute >
+    Patch Get( uint64_t old_fingerprint, uint64_t updated_fingerprint, Compute compute );
+
+    /* @brief Запросы, обслуженные кешем или готовящимся вычислением */
+    size_t Hits() const;
+
+    /* @brief Запросы, потребовавшие вычисления */
+    size_t Misses() const;
+
+    /* @brief Суммарный размер хранимых предписаний, байт */
+    size_t Bytes() const;
+
+    /* @brief Количество хранимых и вычисляемых предписаний */
+    size_t Entries() const;
+
+private:
+
+    struct Key
+    {
+        uint64_t mOld;
+        uint64_t mUpdated;
+
+        bool operator==( const Key& rhs ) const { return mOld == rhs.mOld && mUpdated == rhs.mUpdated; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const Key& key ) const { return static_cast< size_t >( MixHash( key.mOld ^ MixHash( key.mUpdated ) ) ); }
+    };
+
+    struct Entry
+    {
+        std::shared_future< Patch > mPatch;
+
+        /* Вычисление завершено, запись в mLru */
+        bool mReady = false;
+        size_t mBytes = 0;
+        std::list< Key >::iterator mLru;
+    };
+
+    /* Вытесняет давно не запрошенные предписания, пока размер больше mMaxBytes. Вызывается под mMutex */
+    void Evict();
+
+    const size_t mMaxBytes;
+
+    mutable std::mutex mMutex;
+    std::unordered_map< Key, Entry, KeyHash > mEntries;
+
+    /* Готовые предписания: в начале - последние запрошенные */
+    std::list< Key > mLru;
+    size_t mBytes = 0;
+    size_t mHits = 0;
+    size_t mMisses = 0;
+};
+
+uint64_t DiffCache::Fingerprint( const std::vector< Address >& addresses )
+{
+    uint64_t fingerprint = MixHash( addresses.size() );
+    for( const auto& elem : addresses )
+    {
+        fingerprint = MixHash( fingerprint ^ elem.mId );
+        fingerprint = MixHash( fingerprint ^ std::hash< std::string_view >()( elem.mValue.View() ) );
+    }
+    return fingerprint;
+}
+
+DiffCache::Patch DiffCache::Get( const std::vector< Address >& old_addresses, const std::vector< Address >& updated_addresses )
+{
+    return Get( Fingerprint( old_addresses ), Fingerprint( updated_addresses ), [&]
+    {
+        std::string encoded;
+        PatchCodec::EncodePatch( DifferAddress( false ).Compare( old_addresses, updated_addresses ), encoded );
+        return encoded;
+    } );
+}
+
+template< typename Compute >
+DiffCache::Patch DiffCache::Get( uint64_t old_fingerprint, uint64_t updated_fingerprint, Compute compute )
+{
+    const Key key{ old_fingerprint, updated_fingerprint };
+    std::promise< Patch > promise;
+    std::unique_lock< std::mutex > lock( mMutex );
+    auto [ it, inserted ] = mEntries.try_emplace( key );
+    if( !inserted )
+    {
+        ++mHits;
+        if( it->second.mReady ) mLru.splice( mLru.begin(), mLru, it->second.mLru );
+        auto pending = it->second.mPatch;
+        lock.unlock();
+        return pending.get();
+    }
+    ++mMisses;
+    it->second.mPatch = promise.get_future().share();
+    lock.unlock();
+
+    /* Вычисление идет без блокировки; остальные запросы этого ключа ждут на mPatch */
+    Patch patch;
+    try
+    {
+        patch = std::make_shared< const std::string >( compute() );
+    }
+    catch( ... )
+    {
+        lock.lock();
+        mEntries.erase( key );
+        lock.unlock();
+        promise.set_exception( std::current_exception() );
+        throw;
+    }
+    promise.set_value( patch );
+
+    lock.lock();
+    auto& entry = mEntries[ key ];
+    entry.mReady = true;
+    entry.mBytes = patch->size();
+    mLru.push_front( key );
+    entry.mLru = mLru.begin();
+    mBytes += entry.mBytes;
+    Evict();
+    return patch;
+}
+
+void DiffCache::Evict()
+{
+    while( mBytes > mMaxBytes && !mLru.empty() )
+    {
+        auto it = mEntries.find( mLru.back() );
+        mBytes -= it->second.mBytes;
+        mEntries.erase( it );
+        mLru.pop_back();
+    }
+}
+
+size_t DiffCache::Hits() const
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    return mHits;
+}
+
+size_t DiffCache::Misses() const
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    return mMisses;
+}
+
+size_t DiffCache::Bytes() const
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    return mBytes;
+}
+
+size_t DiffCache::Entries() const
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    return mEntries.size();
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <optional>
+#include <functional>
+#include <exception>
+#include "address_differ.h"
+#include "patch_codec.h"
+
+/*
+ * @brief Очередь ограниченного размера между стадиями конвейера.
+ * Запись в заполненную очередь блокируется - так медленная стадия притормаживает предыдущие.
+ */
+template< typename T >
+class BoundedQueue
+{
+public:
+
+    explicit BoundedQueue( size_t capacity )
+        : mCapacity( capacity ) {}
+
+    /*
+     * @brief Добавляет элемент, ожидая свободного места.
+     * @return false - очередь закрыта.
+     */
+    bool Push( T value );
+
+    /*
+     * @brief Извлекает элемент, ожидая его появления.
+     * @return std::nullopt - очередь закрыта и пуста.
+     */
+    std::optional< T > Pop();
+
+    /* @brief Закрывает очередь: новые элементы не принимаются, ожидающие потоки просыпаются */
+    void Close();
+
+private:
+
+    size_t mCapacity;
+    bool mClosed = false;
+    std::deque< T > mItems;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+};
+
+template< typename T >
+bool BoundedQueue< T >::Push( T value )
+{
+    std::unique_lock< std::mutex > lock( mMutex );
+    mNotFull.wait( lock, [this]{ return mClosed || mItems.size() < mCapacity; } );
+    if( mClosed ) return false;
+    mItems.push_back( std::move( value ) );
+    mNotEmpty.notify_one();
+    return true;
+}
+
+template< typename T >
+std::optional< T > BoundedQueue< T >::Pop()
+{
+    std::unique_lock< std::mutex > lock( mMutex );
+    mNotEmpty.wait( lock, [this]{ return mClosed || !mItems.empty(); } );
+    if( mItems.empty() ) return std::nullopt;
+    T value = std::move( mItems.front() );
+    mItems.pop_front();
+    mNotFull.notify_one();
+    return value;
+}
+
+template< typename T >
+void BoundedQueue< T >::Close()
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    mClosed = true;
+    mNotFull.notify_all();
+    mNotEmpty.notify_all();
+}
+
+/* @brief Настройки конвейера сравнения */
+struct DiffPipelineConfig
+{
+    /* Количество потоков загрузки снимков */
+    size_t mLoadThreads = 1;
+
+    /* Количество потоков подготовки снимков к сравнению (сортировка по позициям) */
+    size_t mIndexThreads = 1;
+
+    /* Количество потоков сравнения */
+    size_t mCompareThreads = 1;
+
+    /* Количество потоков кодирования предписаний */
+    size_t mEncodeThreads = 1;
+
+    /* Емкость очередей между стадиями */
+    size_t mQueueCapacity = 4;
+
+    /* Максимальное количество снимков в работе одновременно: от начала загрузки до записи предписания */
+    size_t mWindow = 16;
+};
+
+/*
+ * @brief Конвейер сравнения последовательности снимков: загрузка -> индекс -> сравнение -> кодирование -> запись.
+ * Стадии работают одновременно: пока сравнивается снимок N, загружается N + 1 и записывается предписание для N - 1.
+ * Пропускная способность определяется самой медленной стадией, а не суммой всех стадий.
+ */
+class DiffPipeline
+{
+public:
+
+    /* Загружает снимок с заданным номером */
+    using Loader = std::function< std::vector< Address >( size_t index ) >;
+
+    /* Получает закодированное предписание между снимками index - 1 и index. Вызывается строго по порядку index */
+    using Writer = std::function< void( size_t index, std::string&& encoded_patch ) >;
+
+    explicit DiffPipeline( DiffPipelineConfig config = {} )
+        : mConfig( config ) {}
+
+    /*
+     * @brief Обрабатывает снимки 0 .. snapshots - 1.
+     * @details Исключение из loader или writer останавливает конвейер и пробрасывается наружу.
+     * @param snapshots Количество снимков.
+     * @param loader Функция загрузки снимка.
+     * @param writer Функция записи предписания.
+     */
+    void Run( size_t snapshots, const Loader& loader, const Writer& writer );
+
+private:
+
+    DiffPipelineConfig mConfig;
+};
+
+void DiffPipeline::Run( size_t snapshots, const Loader& loader, const Writer& writer )
+{
+    using Snapshot = std::pair< size_t, std::vector< Address > >;
+    using Indexed = std::shared_ptr< const std::vector< Address > >;
+    using Pair = std::pair< size_t, std::pair< Indexed, Indexed > >;
+    using Patch = std::pair< size_t, CompareResult< Address > >;
+    using Encoded = std::pair< size_t, std::string >;
+
+    BoundedQueue< Snapshot > loaded( mConfig.mQueueCapacity );
+    BoundedQueue< Pair > pairs( mConfig.mQueueCapacity );
+    BoundedQueue< Patch > patches( mConfig.mQueueCapacity );
+    BoundedQueue< Encoded > encoded( mConfig.mQueueCapacity );
+
+    /* Окно: снимок index можно загружать, только когда предписание index - window уже записано */
+    std::mutex window_mutex;
+    std::condition_variable window_cv;
+    size_t next_to_write = 1;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::atomic< bool > failed{ false };
+
+    auto fail = [&]( std::exception_ptr e )
+    {
+        {
+            std::lock_guard< std::mutex > lock( error_mutex );
+            if( !error ) error = e;
+        }
+        {
+            std::lock_guard< std::mutex > lock( window_mutex );
+            failed = true;
+            window_cv.notify_all();
+        }
+        loaded.Close();
+        pairs.Close();
+        patches.Close();
+        encoded.Close();
+    };
+
+    /* Соседние снимки, ожидающие пары. Снимок удаляется, когда из него сформированы обе пары */
+    std::mutex pairing_mutex;
+    std::map< size_t, std::pair< Indexed, int > > waiting;
+
+    std::atomic< size_t > next_to_load{ 0 };
+    auto load_stage = [&]()
+    {
+        try
+        {
+            for( size_t index = next_to_load++; index < snapshots && !failed; index = next_to_load++ )
+            {
+                {
+                    std::unique_lock< std::mutex > lock( window_mutex );
+                    window_cv.wait( lock, [&]{ return failed || index < next_to_write + mConfig.mWindow; } );
+                }
+                if( !loaded.Push( { index, loader( index ) } ) ) break;
+            }
+        }
+        catch( ... ) { fail( std::current_exception() ); }
+    };
+
+    auto index_stage = [&]()
+    {
+        try
+        {
+            while( auto snapshot = loaded.Pop() )
+            {
+                auto& addresses = snapshot->second;
+                auto less_position = []( const Address& a, const Address& b ) { return a.mPosition < b.mPosition; };
+                if( !std::is_sorted( addresses.begin(), addresses.end(), less_position ) )
+                {
+                    std::sort( addresses.begin(), addresses.end(), less_position );
+                }
+                Indexed list = std::make_shared< const std::vector< Address > >( std::move( addresses ) );
+                size_t index = snapshot->first;
+
+                /* Формируем пары с уже готовыми соседями */
+                std::vector< Pair > ready;
+                {
+                    std::lock_guard< std::mutex > lock( pairing_mutex );
+                    int used = ( index == 0 ) + ( index + 1 == snapshots );
+                    if( auto prev = waiting.find( index - 1 ); index > 0 && prev != waiting.end() )
+                    {
+                        ready.push_back( { index, { prev->second.first, list } } );
+                        ++used;
+                        if( ++prev->second.second == 2 ) waiting.erase( prev );
+                    }
+                    if( auto next = waiting.find( index + 1 ); next != waiting.end() )
+                    {
+                        ready.push_back( { index + 1, { list, next->second.first } } );
+                        ++used;
+                        if( ++next->second.second == 2 ) waiting.erase( next );
+                    }
+                    if( used < 2 ) waiting[ index ] = { list, used };
+                }
+                for( auto& pair : ready )
+                {
+                    if( !pairs.Push( std::move( pair ) ) ) return;
+                }
+            }
+        }
+        catch( ... ) { fail( std::current_exception() ); }
+    };
+
+    auto compare_stage = [&]()
+    {
+        try
+        {
+            while( auto pair = pairs.Pop() )
+            {
+                /* Сравнение через хеш-индекс идентификаторов: линейный поиск по списку сделал бы стадию квадратичной */
+                auto result = DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >(
+                    *pair->second.first, *pair->second.second );
+                if( !patches.Push( { pair->first, std::move( result ) } ) ) return;
+            }
+        }
+        catch( ... ) { fail( std::current_exception() ); }
+    };
+
+    auto encode_stage = [&]()
+    {
+        try
+        {
+            while( auto patch = patches.Pop() )
+            {
+                std::string out;
+                PatchCodec::EncodePatch( patch->second, out );
+                if( !encoded.Push( { patch->first, std::move( out ) } ) ) return;
+            }
+        }
+        catch( ... ) { fail( std::current_exception() ); }
+    };
+
+    /* Запуск стадии в заданном количестве потоков; после завершения всех потоков закрывается выходная очередь */
+    std::vector< std::thread > stages;
+    auto start_stage = [&]( size_t threads, auto body, auto close_output )
+    {
+        stages.emplace_back( [threads, body, close_output]()
+        {
+            std::vector< std::thread > workers;
+            for( size_t i = 0; i < std::max< size_t >( threads, 1 ); ++i ) workers.emplace_back( body );
+            for( auto& worker : workers ) worker.join();
+            close_output();
+        } );
+    };
+    start_stage( mConfig.mLoadThreads, load_stage, [&]{ loaded.Close(); } );
+    start_stage( mConfig.mIndexThreads, index_stage, [&]{ pairs.Close(); } );
+    start_stage( mConfig.mCompareThreads, compare_stage, [&]{ patches.Close(); } );
+    start_stage( mConfig.mEncodeThreads, encode_stage, [&]{ encoded.Close(); } );
+
+    /* Запись в вызывающем потоке: восстанавливаем порядок предписаний */
+    try
+    {
+        std::map< size_t, std::string > reorder;
+        while( auto patch = encoded.Pop() )
+        {
+            reorder.emplace( patch->first, std::move( patch->second ) );
+            for( auto it = reorder.begin(); it != reorder.end() && it->first == next_to_write; it = reorder.erase( it ) )
+            {
+                writer( it->first, std::move( it->second ) );
+                std::lock_guard< std::mutex > lock( window_mutex );
+                ++next_to_write;
+                window_cv.notify_all();
+            }
+        }
+    }
+    catch( ... ) { fail( std::current_exception() ); }
+
+    for( auto& stage : stages ) stage.join();
+    if( error ) std::rethrow_exception( error );
+}
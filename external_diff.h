@@ -0,0 +1,1016 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <stdexcept>
+#include <system_error>
+#include <cstdio>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include "address_differ.h"
+#include "patch_codec.h"
+
+/*
+ * @brief Временный файл для сброса данных на диск. Удаляется из каталога сразу после создания,
+ * поэтому исчезает при закрытии, в том числе при аварийном завершении.
+ */
+class SpillFile
+{
+public:
+
+    /*
+     * @param directory Каталог для временного файла.
+     */
+    explicit SpillFile( const std::string& directory );
+    ~SpillFile();
+
+    SpillFile( SpillFile&& other ) noexcept
+        : mFile( other.mFile ) { other.mFile = nullptr; }
+    SpillFile& operator=( SpillFile&& other ) noexcept;
+
+    SpillFile( const SpillFile& ) = delete;
+    SpillFile& operator=( const SpillFile& ) = delete;
+
+    /* @brief Дописывает данные в конец файла и очищает буфер */
+    void Write( std::string& data );
+
+    /* @brief Переводит файл в чтение с начала */
+    void Rewind();
+
+    std::FILE* Get() const { return mFile; }
+
+private:
+
+    std::FILE* mFile = nullptr;
+};
+
+SpillFile::SpillFile( const std::string& directory )
+{
+    std::string path = directory + "/address_differ_spill_XXXXXX";
+    int fd = mkstemp( path.data() );
+    if( fd < 0 ) throw std::system_error( errno, std::generic_category(), "mkstemp" );
+    unlink( path.c_str() );
+    mFile = fdopen( fd, "w+b" );
+    if( !mFile )
+    {
+        int error = errno;
+        close( fd );
+        throw std::system_error( error, std::generic_category(), "fdopen" );
+    }
+}
+
+SpillFile::~SpillFile()
+{
+    if( mFile ) std::fclose( mFile );
+}
+
+SpillFile& SpillFile::operator=( SpillFile&& other ) noexcept
+{
+    if( this != &other )
+    {
+        if( mFile ) std::fclose( mFile );
+        mFile = other.mFile;
+        other.mFile = nullptr;
+    }
+    return *this;
+}
+
+void SpillFile::Write( std::string& data )
+{
+    if( !data.empty() && std::fwrite( data.data(), 1, data.size(), mFile ) != data.size() )
+    {
+        throw std::system_error( errno, std::generic_category(), "fwrite" );
+    }
+    data.clear();
+}
+
+void SpillFile::Rewind()
+{
+    std::fflush( mFile );
+    std::rewind( mFile );
+}
+
+/*
+ * @brief Буферизованное чтение записей из файла.
+ * Запись разбирается функцией get( std::string_view& data ), которая возвращает false на неполных данных -
+ * тогда буфер дочитывается и разбор повторяется.
+ */
+class SpillReader
+{
+public:
+
+    /* Наименьший размер буфера чтения */
+    static constexpr size_t MIN_BUFFER = 4096;
+
+    /*
+     * @param file Файл, открытый на чтение.
+     * @param buffer_size Размер буфера чтения.
+     */
+    SpillReader( std::FILE* file, size_t buffer_size )
+        : mFile( file ), mChunk( std::max< size_t >( buffer_size, MIN_BUFFER ) ) {}
+
+    /*
+     * @brief Разбирает следующую запись.
+     * @return false - файл закончился.
+     */
+    template< typename Get >
+    bool Next( Get get );
+
+private:
+
+    /* Дочитывает буфер, отбрасывая разобранное начало */
+    void Fill();
+
+    std::FILE* mFile;
+    size_t mChunk;
+    std::string mBuffer;
+    size_t mOffset = 0;
+    bool mEof = false;
+};
+
+template< typename Get >
+bool SpillReader::Next( Get get )
+{
+    while( true )
+    {
+        std::string_view data( mBuffer.data() + mOffset, mBuffer.size() - mOffset );
+        size_t available = data.size();
+        if( available != 0 && get( data ) )
+        {
+            mOffset += available - data.size();
+            return true;
+        }
+        if( mEof )
+        {
+            if( available != 0 ) throw std::runtime_error( "truncated spill data" );
+            return false;
+        }
+        Fill();
+    }
+}
+
+void SpillReader::Fill()
+{
+    mBuffer.erase( 0, mOffset );
+    mOffset = 0;
+    size_t size = mBuffer.size();
+    /* Буфер не растет сверх mChunk, пока в него помещается одна запись: иначе строка удвоила бы емкость */
+    size_t free = size < mChunk ? mChunk - size : mChunk;
+    mBuffer.resize( size + free );
+    size_t read = std::fread( mBuffer.data() + size, 1, free, mFile );
+    mBuffer.resize( size + read );
+    if( read == 0 ) mEof = true;
+}
+
+/* @brief Последовательное чтение файла снимка в формате PatchCodec::EncodeSnapshot по одному элементу */
+class SnapshotReader
+{
+public:
+
+    /*
+     * @details Исключение - файл не открывается или это не снимок.
+     * @param path Файл снимка.
+     * @param buffer_size Размер буфера чтения.
+     */
+    SnapshotReader( const std::string& path, size_t buffer_size );
+
+    /* @brief Количество элементов из заголовка снимка */
+    size_t Size() const { return mCount; }
+
+    /*
+     * @brief Читает следующий элемент.
+     * @details Исключение - снимок обрезан.
+     * @return false - элементы закончились.
+     */
+    bool Next( Address& address );
+
+private:
+
+    std::string mPath;
+    std::unique_ptr< std::FILE, int(*)( std::FILE* ) > mFile;
+    SpillReader mReader;
+    uint64_t mCount = 0;
+    uint64_t mRead = 0;
+};
+
+SnapshotReader::SnapshotReader( const std::string& path, size_t buffer_size )
+    : mPath( path ), mFile( std::fopen( path.c_str(), "rb" ), std::fclose ), mReader( mFile.get(), buffer_size )
+{
+    if( !mFile ) throw std::system_error( errno, std::generic_category(), "fopen " + path );
+    bool header = mReader.Next( [&]( std::string_view& data )
+    {
+        if( data.front() != PatchCodec::SNAPSHOT_MAGIC ) throw std::runtime_error( "not a snapshot: " + path );
+        data.remove_prefix( 1 );
+        return PatchCodec::GetVarint( data, mCount );
+    } );
+    if( !header ) throw std::runtime_error( "not a snapshot: " + path );
+}
+
+bool SnapshotReader::Next( Address& address )
+{
+    if( mRead == mCount ) return false;
+    if( !mReader.Next( [&]( std::string_view& data ) { return PatchCodec::GetAddress( data, address ); } ) )
+    {
+        throw std::runtime_error( "truncated snapshot: " + mPath );
+    }
+    ++mRead;
+    return true;
+}
+
+/* @brief Адрес и его номер в файле снимка */
+struct SpilledAddress
+{
+    size_t mIndex;
+    Address mAddress;
+};
+
+/* @brief Измененный элемент: номер в новом снимке, старое и новое значения */
+struct SpilledChange
+{
+    size_t mIndex;
+    Address mOld;
+    Address mNew;
+};
+
+/* @brief Пара чисел: ключ сортировки и значение */
+struct SpilledPair
+{
+    size_t mKey;
+    size_t mValue;
+};
+
+void PutRecord( std::string& out, const SpilledAddress& record )
+{
+    PatchCodec::PutVarint( out, record.mIndex );
+    PatchCodec::PutAddress( out, record.mAddress );
+}
+
+bool GetRecord( std::string_view& data, SpilledAddress& record )
+{
+    uint64_t index;
+    if( !PatchCodec::GetVarint( data, index ) || !PatchCodec::GetAddress( data, record.mAddress ) ) return false;
+    record.mIndex = index;
+    return true;
+}
+
+/*
+ * @brief Память значения адреса вне записи: символы и, с запасом, запись пула строк с узлом его таблицы.
+ * Значение, общее для нескольких записей, учитывается в каждой - оценка не занижает память.
+ */
+size_t ValueFootprint( const InternedString& value )
+{
+    return value.Empty() ? 0 : 112 + value.Str().size();
+}
+
+size_t RecordFootprint( const SpilledAddress& record )
+{
+    return sizeof( record ) + ValueFootprint( record.mAddress.mValue );
+}
+
+void PutRecord( std::string& out, const SpilledChange& record )
+{
+    PatchCodec::PutVarint( out, record.mIndex );
+    PatchCodec::PutAddress( out, record.mOld );
+    PatchCodec::PutAddress( out, record.mNew );
+}
+
+bool GetRecord( std::string_view& data, SpilledChange& record )
+{
+    uint64_t index;
+    if( !PatchCodec::GetVarint( data, index ) || !PatchCodec::GetAddress( data, record.mOld ) || !PatchCodec::GetAddress( data, record.mNew ) ) return false;
+    record.mIndex = index;
+    return true;
+}
+
+size_t RecordFootprint( const SpilledChange& record )
+{
+    return sizeof( record ) + ValueFootprint( record.mOld.mValue ) + ValueFootprint( record.mNew.mValue );
+}
+
+void PutRecord( std::string& out, const SpilledPair& record )
+{
+    PatchCodec::PutVarint( out, record.mKey );
+    PatchCodec::PutVarint( out, record.mValue );
+}
+
+bool GetRecord( std::string_view& data, SpilledPair& record )
+{
+    uint64_t key, value;
+    if( !PatchCodec::GetVarint( data, key ) || !PatchCodec::GetVarint( data, value ) ) return false;
+    record = { key, value };
+    return true;
+}
+
+size_t RecordFootprint( const SpilledPair& record )
+{
+    return sizeof( record );
+}
+
+/*
+ * @brief Внешняя сортировка: записи копятся в памяти до бюджета, затем сортируются и сбрасываются на диск отрезком.
+ * После Finish записи читаются по возрастанию слиянием отрезков; буферы чтения отрезков делят тот же бюджет.
+ * Если все записи поместились в память, диск не используется. Прочитав последнюю запись, сортировка освобождает память.
+ * Если бюджета не хватает на буферы чтения всех отрезков, отрезки сначала сливаются группами в более длинные.
+ * @tparam Record Тип записи. Для него определены PutRecord, GetRecord и RecordFootprint.
+ * @tparam Less Порядок сортировки.
+ */
+template< typename Record, typename Less >
+class ExternalSorter
+{
+public:
+
+    /*
+     * @param memory_budget Бюджет памяти, байт.
+     * @param directory Каталог для отрезков.
+     */
+    ExternalSorter( size_t memory_budget, const std::string& directory )
+        : mBudget( memory_budget ), mDirectory( directory ) {}
+
+    /* @brief Добавляет запись */
+    void Push( Record record );
+
+    /* @brief Завершает добавление и готовит чтение */
+    void Finish();
+
+    /*
+     * @brief Следующая запись по возрастанию.
+     * @return false - записи закончились.
+     */
+    bool Next( Record& record );
+
+    size_t Size() const { return mSize; }
+
+    /* @brief Количество отрезков, сброшенных из памяти на диск */
+    size_t Runs() const { return mSpilled; }
+
+private:
+
+    /* Сортирует накопленные записи и сбрасывает их отрезком */
+    void Spill();
+
+    /* Открывает отрезки на чтение и строит кучу их голов */
+    void OpenRuns();
+
+    /* Сливает отрезки группами по fan_in в более длинные */
+    void MergeRuns( size_t fan_in );
+
+    /* Восстанавливает кучу голов отрезков после извлечения */
+    bool Advance( size_t run );
+
+    /* Освобождает буферы прочитанной сортировки */
+    void Release();
+
+    size_t mBudget;
+    std::string mDirectory;
+    std::vector< Record > mBuffer;
+
+    /* Память накопленных записей вне вектора mBuffer, байт */
+    size_t mBuffered = 0;
+    size_t mSize = 0;
+    size_t mSpilled = 0;
+
+    std::vector< SpillFile > mRuns;
+    std::vector< SpillReader > mReaders;
+    std::vector< Record > mHeads;
+    std::vector< size_t > mHeap;
+    size_t mNext = 0;
+};
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::Push( Record record )
+{
+    size_t outside = RecordFootprint( record ) - sizeof( Record );
+    if( mBuffer.size() == mBuffer.capacity() )
+    {
+        /* Вектор растет вручную и не сверх бюджета: на время переноса живы и старый, и новый буферы */
+        size_t used = mBuffer.capacity() * sizeof( Record ) + mBuffered + outside;
+        size_t fits = used < mBudget ? ( mBudget - used ) / sizeof( Record ) : 0;
+        size_t capacity = std::min( std::max< size_t >( 2 * mBuffer.size(), 64 ), fits );
+        if( capacity > mBuffer.size() ) mBuffer.reserve( capacity );
+        else if( !mBuffer.empty() ) Spill();
+    }
+    else if( !mBuffer.empty() && mBuffer.capacity() * sizeof( Record ) + mBuffered + outside > mBudget )
+    {
+        Spill();
+    }
+    mBuffered += outside;
+    mBuffer.push_back( std::move( record ) );
+    ++mSize;
+}
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::Spill()
+{
+    std::sort( mBuffer.begin(), mBuffer.end(), Less() );
+    mRuns.emplace_back( mDirectory );
+    ++mSpilled;
+    std::string out;
+    for( const auto& record : mBuffer )
+    {
+        PutRecord( out, record );
+        if( out.size() >= 1 << 16 ) mRuns.back().Write( out );
+    }
+    mRuns.back().Write( out );
+    mRuns.back().Rewind();
+    /* Емкость остается для следующего отрезка */
+    mBuffer.clear();
+    mBuffered = 0;
+}
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::Finish()
+{
+    if( mRuns.empty() )
+    {
+        std::sort( mBuffer.begin(), mBuffer.end(), Less() );
+        return;
+    }
+    if( !mBuffer.empty() ) Spill();
+    std::vector< Record >().swap( mBuffer );
+
+    size_t fan_in = std::max< size_t >( mBudget / SpillReader::MIN_BUFFER, 2 );
+    while( mRuns.size() > fan_in ) MergeRuns( fan_in );
+    OpenRuns();
+}
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::OpenRuns()
+{
+    mReaders.reserve( mRuns.size() );
+    mHeads.resize( mRuns.size() );
+    for( size_t run = 0; run < mRuns.size(); ++run )
+    {
+        mReaders.emplace_back( mRuns[ run ].Get(), mBudget / mRuns.size() );
+        if( Advance( run ) ) mHeap.push_back( run );
+    }
+    auto greater = [this]( size_t a, size_t b ) { return Less()( mHeads[ b ], mHeads[ a ] ); };
+    std::make_heap( mHeap.begin(), mHeap.end(), greater );
+}
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::MergeRuns( size_t fan_in )
+{
+    std::vector< SpillFile > merged;
+    for( size_t first = 0; first < mRuns.size(); first += fan_in )
+    {
+        /* Группа читается так же, как вся сортировка, и в том же бюджете */
+        ExternalSorter group( mBudget, mDirectory );
+        size_t last = std::min( first + fan_in, mRuns.size() );
+        std::move( mRuns.begin() + first, mRuns.begin() + last, std::back_inserter( group.mRuns ) );
+        group.OpenRuns();
+
+        merged.emplace_back( mDirectory );
+        std::string out;
+        Record record{};
+        while( group.Next( record ) )
+        {
+            PutRecord( out, record );
+            if( out.size() >= 1 << 16 ) merged.back().Write( out );
+        }
+        merged.back().Write( out );
+        merged.back().Rewind();
+    }
+    mRuns = std::move( merged );
+}
+
+template< typename Record, typename Less >
+bool ExternalSorter< Record, Less >::Advance( size_t run )
+{
+    return mReaders[ run ].Next( [&]( std::string_view& data ) { return GetRecord( data, mHeads[ run ] ); } );
+}
+
+template< typename Record, typename Less >
+void ExternalSorter< Record, Less >::Release()
+{
+    std::vector< Record >().swap( mBuffer );
+    std::vector< SpillReader >().swap( mReaders );
+    std::vector< Record >().swap( mHeads );
+    std::vector< size_t >().swap( mHeap );
+    mBuffered = 0;
+}
+
+template< typename Record, typename Less >
+bool ExternalSorter< Record, Less >::Next( Record& record )
+{
+    if( mRuns.empty() )
+    {
+        if( mNext == mBuffer.size() )
+        {
+            Release();
+            mNext = 0;
+            return false;
+        }
+        record = std::move( mBuffer[ mNext++ ] );
+        return true;
+    }
+
+    if( mHeap.empty() )
+    {
+        Release();
+        return false;
+    }
+    auto greater = [this]( size_t a, size_t b ) { return Less()( mHeads[ b ], mHeads[ a ] ); };
+    std::pop_heap( mHeap.begin(), mHeap.end(), greater );
+    size_t run = mHeap.back();
+    record = std::move( mHeads[ run ] );
+    if( Advance( run ) ) std::push_heap( mHeap.begin(), mHeap.end(), greater );
+    else mHeap.pop_back();
+    return true;
+}
+
+/* @brief Настройки внешнего сравнения */
+struct ExternalDiffConfig
+{
+    /* Бюджет памяти на буферы сортировки и чтения, байт */
+    size_t mMemoryBudget = 64 << 20;
+
+    /* Каталог для временных файлов */
+    std::string mTempDirectory = "/tmp";
+};
+
+/* @brief Итоги внешнего сравнения */
+struct ExternalDiffStats
+{
+    size_t mAdded = 0;
+    size_t mDeleted = 0;
+    size_t mChanged = 0;
+
+    /* Длина перестановки; 0 - порядок не менялся */
+    size_t mPermutationSize = 0;
+
+    /* Количество отрезков, сброшенных на диск */
+    size_t mSpilledRuns = 0;
+};
+
+/* @brief Итоги потокового применения предписания */
+struct ExternalApplyStats
+{
+    /* Прочитано элементов старого снимка */
+    size_t mRead = 0;
+
+    /* Записано элементов нового снимка */
+    size_t mWritten = 0;
+
+    /* Длина начала списка, которое переставляют перемещения и перестановка; 0 - порядок не менялся */
+    size_t mReorderedPrefix = 0;
+
+    /* Наибольшее количество элементов, одновременно ожидавших своей позиции при перестановке */
+    size_t mPeakWaiting = 0;
+};
+
+/*
+ * @brief Сравнение снимков, которые не помещаются в память.
+ * Снимки читаются из файлов в формате PatchCodec::EncodeSnapshot, предписание пишется в файл в формате PatchCodec::EncodePatch.
+ * Оба снимка сортируются по идентификатору внешней сортировкой и сливаются: так находятся добавленные, удаленные и
+ * измененные элементы - те же операции и в том же порядке, что и у DifferAddress::Compare.
+ * Перемещения вычисляются не пошагово, а перестановкой: позиция каждого элемента в списке после добавлений и удалений
+ * сопоставляется с позицией в новом снимке двумя внешними сортировками. Применяется предписание как обычно -
+ * DoEditorialPrescription дает новый снимок.
+ * @warning Идентификаторы в снимке должны быть уникальны.
+ */
+class ExternalDiffer
+{
+public:
+
+    explicit ExternalDiffer( ExternalDiffConfig config = {} )
+        : mConfig( std::move( config ) ) {}
+
+    /*
+     * @brief Сравнивает снимки и записывает предписание.
+     * @details Исключение - ошибка ввода-вывода или поврежденный снимок.
+     * @param old_path Файл старого снимка.
+     * @param updated_path Файл нового снимка.
+     * @param patch_path Файл предписания.
+     * @return Итоги сравнения.
+     */
+    ExternalDiffStats Compare( const std::string& old_path, const std::string& updated_path, const std::string& patch_path );
+
+    /*
+     * @brief Применяет предписание к снимку в файле, не загружая список в память.
+     * @details Старый снимок читается, а новый пишется последовательно; добавления, удаления и изменения вливаются в поток.
+     * В памяти - предписание и, если порядок меняется, индексы переставляемого начала списка и элементы, ожидающие в нем своей позиции.
+     * Новый снимок совпадает с результатом DoEditorialPrescription.
+     * Исключение - ошибка ввода-вывода, поврежденный снимок или предписание, которое не подходит к снимку.
+     * @warning Старый и новый снимки - разные файлы.
+     * @param old_path Файл старого снимка.
+     * @param patch Редакционное предписание.
+     * @param updated_path Файл нового снимка.
+     * @return Итоги применения.
+     */
+    ExternalApplyStats Apply( const std::string& old_path, const CompareResult< Address >& patch, const std::string& updated_path );
+
+    /*
+     * @brief Применяет предписание из файла в формате PatchCodec::EncodePatch к снимку в файле.
+     * @param old_path Файл старого снимка.
+     * @param patch_path Файл предписания.
+     * @param updated_path Файл нового снимка.
+     * @return Итоги применения.
+     */
+    ExternalApplyStats Apply( const std::string& old_path, const std::string& patch_path, const std::string& updated_path );
+
+private:
+
+    struct ById
+    {
+        bool operator()( const SpilledAddress& a, const SpilledAddress& b ) const
+        {
+            return a.mAddress.mId < b.mAddress.mId || ( a.mAddress.mId == b.mAddress.mId && a.mIndex < b.mIndex );
+        }
+    };
+
+    struct ByIndex
+    {
+        template< typename Record >
+        bool operator()( const Record& a, const Record& b ) const { return a.mIndex < b.mIndex; }
+    };
+
+    struct ByKey
+    {
+        bool operator()( const SpilledPair& a, const SpilledPair& b ) const { return a.mKey < b.mKey; }
+    };
+
+    /* Размер буфера чтения файла снимка */
+    static constexpr size_t READ_BUFFER = 1 << 16;
+
+    /*
+     * @brief Читает снимок по одному элементу.
+     * @param path Файл снимка.
+     * @param fn Вызывается для каждого элемента с его номером.
+     * @return Количество элементов.
+     */
+    static size_t ReadSnapshot( const std::string& path, const std::function< void( SpilledAddress&& ) >& fn );
+
+    ExternalDiffConfig mConfig;
+};
+
+size_t ExternalDiffer::ReadSnapshot( const std::string& path, const std::function< void( SpilledAddress&& ) >& fn )
+{
+    SnapshotReader reader( path, READ_BUFFER );
+    SpilledAddress record{ 0, {} };
+    for( size_t i = 0; reader.Next( record.mAddress ); ++i )
+    {
+        record.mIndex = i;
+        fn( std::move( record ) );
+    }
+    return reader.Size();
+}
+
+ExternalDiffStats ExternalDiffer::Compare( const std::string& old_path, const std::string& updated_path, const std::string& patch_path )
+{
+    /*
+     * Бюджет делится между сортировками, которые живут одновременно. Прочитанная сортировка сразу освобождает память,
+     * а сортировки этапа выходят из области видимости вместе с ним: сортировкам по идентификатору и сортировкам
+     * удаленных, добавленных и измененных достается по половине, затем позициям копий и перестановке - по половине
+     */
+    const size_t budget = mConfig.mMemoryBudget;
+    const auto& directory = mConfig.mTempDirectory;
+    ExternalDiffStats stats;
+
+    std::FILE* patch = std::fopen( patch_path.c_str(), "wb" );
+    if( !patch ) throw std::system_error( errno, std::generic_category(), "fopen " + patch_path );
+    std::unique_ptr< std::FILE, int(*)( std::FILE* ) > patch_guard( patch, std::fclose );
+    std::string out;
+    auto flush = [&]( bool force )
+    {
+        if( ( force || out.size() >= 1 << 16 ) && !out.empty() )
+        {
+            if( std::fwrite( out.data(), 1, out.size(), patch ) != out.size() ) throw std::system_error( errno, std::generic_category(), "fwrite " + patch_path );
+            out.clear();
+        }
+    };
+
+    SpillFile updated_indexes( directory );
+    ExternalSorter< SpilledPair, ByKey > copy_positions( budget / 2, directory );
+    {
+        ExternalSorter< SpilledAddress, ByIndex > deleted( budget / 6, directory );
+        ExternalSorter< SpilledAddress, ByIndex > added( budget / 6, directory );
+        ExternalSorter< SpilledChange, ByIndex > changed( budget / 6, directory );
+        {
+            /* 1. Оба снимка - по идентификатору */
+            ExternalSorter< SpilledAddress, ById > old_by_id( budget / 4, directory );
+            ExternalSorter< SpilledAddress, ById > updated_by_id( budget / 4, directory );
+            ReadSnapshot( old_path, [&]( SpilledAddress&& record ) { old_by_id.Push( std::move( record ) ); } );
+            ReadSnapshot( updated_path, [&]( SpilledAddress&& record ) { updated_by_id.Push( std::move( record ) ); } );
+            old_by_id.Finish();
+            updated_by_id.Finish();
+
+            /* 2. Слияние по идентификатору: удаленные, добавленные, измененные и номера элементов в новом снимке */
+            std::string indexes_out;
+            SpilledAddress old_record{ 0, {} }, updated_record{ 0, {} };
+            bool has_old = old_by_id.Next( old_record );
+            bool has_updated = updated_by_id.Next( updated_record );
+            while( has_old || has_updated )
+            {
+                if( has_old && ( !has_updated || old_record.mAddress.mId < updated_record.mAddress.mId ) )
+                {
+                    deleted.Push( std::move( old_record ) );
+                    has_old = old_by_id.Next( old_record );
+                    continue;
+                }
+
+                PutRecord( indexes_out, SpilledPair{ updated_record.mAddress.mId, updated_record.mIndex } );
+                if( !has_old || updated_record.mAddress.mId < old_record.mAddress.mId )
+                {
+                    added.Push( std::move( updated_record ) );
+                }
+                else
+                {
+                    if( old_record.mAddress.mValue != updated_record.mAddress.mValue )
+                    {
+                        changed.Push( { updated_record.mIndex, std::move( old_record.mAddress ), std::move( updated_record.mAddress ) } );
+                    }
+                    has_old = old_by_id.Next( old_record );
+                }
+                has_updated = updated_by_id.Next( updated_record );
+                if( indexes_out.size() >= 1 << 16 ) updated_indexes.Write( indexes_out );
+            }
+            updated_indexes.Write( indexes_out );
+            updated_indexes.Rewind();
+            stats.mSpilledRuns += old_by_id.Runs() + updated_by_id.Runs();
+        }
+        deleted.Finish();
+        added.Finish();
+        changed.Finish();
+        stats.mAdded = added.Size();
+        stats.mDeleted = deleted.Size();
+        stats.mChanged = changed.Size();
+
+        /*
+         * 3. Проход по старому снимку в исходном порядке с добавленными на своих позициях - это порядок списка
+         * после добавлений и удалений, как в DoEditorialPrescription. Заодно пишутся добавления и удаления.
+         */
+        SpillFile deleted_section( directory );
+        {
+            out.push_back( PatchCodec::PATCH_MAGIC );
+            PatchCodec::PutVarint( out, added.Size() );
+            std::string deleted_out;
+            PatchCodec::PutVarint( deleted_out, deleted.Size() );
+
+            SpilledAddress next_add{ 0, {} }, next_delete{ 0, {} };
+            bool has_add = added.Next( next_add );
+            bool has_delete = deleted.Next( next_delete );
+            size_t slot = 0;
+            size_t copy = 0;
+            auto put_add = [&]()
+            {
+                copy_positions.Push( { next_add.mAddress.mId, copy++ } );
+                PatchCodec::PutOperation( out, { OPERATION_TYPE::ADDED, next_add.mAddress, std::nullopt, next_add.mAddress.mPosition, std::nullopt } );
+                flush( false );
+                has_add = added.Next( next_add );
+                ++slot;
+            };
+
+            ReadSnapshot( old_path, [&]( SpilledAddress&& record )
+            {
+                while( has_add && next_add.mAddress.mPosition <= slot ) put_add();
+                if( has_delete && next_delete.mIndex == record.mIndex )
+                {
+                    PatchCodec::PutOperation( deleted_out, { OPERATION_TYPE::DELETED, record.mAddress, std::nullopt, record.mAddress.mPosition, std::nullopt } );
+                    if( deleted_out.size() >= 1 << 16 ) deleted_section.Write( deleted_out );
+                    has_delete = deleted.Next( next_delete );
+                }
+                else
+                {
+                    copy_positions.Push( { record.mAddress.mId, copy++ } );
+                }
+                ++slot;
+            } );
+            while( has_add ) put_add();
+            deleted_section.Write( deleted_out );
+            deleted_section.Rewind();
+        }
+        copy_positions.Finish();
+        stats.mSpilledRuns += added.Runs() + deleted.Runs();
+
+        /* Удаления дописываются после добавлений, затем изменения */
+        flush( true );
+        SpillReader reader( deleted_section.Get(), READ_BUFFER );
+        while( reader.Next( [&]( std::string_view& data ) { out.append( data ); data.remove_prefix( data.size() ); return true; } ) ) flush( false );
+
+        PatchCodec::PutVarint( out, changed.Size() );
+        SpilledChange change{ 0, {}, {} };
+        while( changed.Next( change ) )
+        {
+            PatchCodec::PutOperation( out, { OPERATION_TYPE::CHANGED, change.mOld, change.mNew, change.mNew.mPosition, std::nullopt } );
+            flush( false );
+        }
+        stats.mSpilledRuns += changed.Runs();
+
+        /* Перемещений нет - порядок задает перестановка */
+        PatchCodec::PutVarint( out, 0 );
+    }
+
+    /* 4. Позиция в новом снимке -> позиция после добавлений и удалений: это и есть перестановка */
+    ExternalSorter< SpilledPair, ByKey > permutation( budget / 2, directory );
+    {
+        SpillReader indexes( updated_indexes.Get(), READ_BUFFER );
+        SpilledPair index{ 0, 0 }, copy_position{ 0, 0 };
+        while( indexes.Next( [&]( std::string_view& data ) { return GetRecord( data, index ); } ) )
+        {
+            /* Оба потока содержат одни и те же идентификаторы; расхождение дало бы неверную перестановку, поэтому проверяется и без assert */
+            if( !copy_positions.Next( copy_position ) || copy_position.mKey != index.mKey ) throw std::runtime_error( "inconsistent ids in snapshot" );
+            permutation.Push( { index.mValue, copy_position.mValue } );
+        }
+    }
+    permutation.Finish();
+    stats.mSpilledRuns += copy_positions.Runs();
+
+    /* Перестановка обрезается после последней позиции, которая меняется; ее длина должна стоять перед ней */
+    SpillFile permutation_values( directory );
+    {
+        std::string values;
+        SpilledPair entry{ 0, 0 };
+        size_t previous = 0;
+        while( permutation.Next( entry ) )
+        {
+            if( entry.mKey != entry.mValue ) stats.mPermutationSize = entry.mKey + 1;
+            PatchCodec::PutVarint( values, PatchCodec::ZigZag( entry.mValue, previous ) );
+            previous = entry.mValue;
+            if( values.size() >= 1 << 16 ) permutation_values.Write( values );
+        }
+        permutation_values.Write( values );
+        permutation_values.Rewind();
+    }
+    stats.mSpilledRuns += permutation.Runs();
+
+    if( stats.mPermutationSize != 0 )
+    {
+        PatchCodec::PutVarint( out, stats.mPermutationSize );
+        SpillReader reader( permutation_values.Get(), READ_BUFFER );
+        uint64_t value;
+        for( size_t i = 0; i < stats.mPermutationSize; ++i )
+        {
+            reader.Next( [&]( std::string_view& data ) { return PatchCodec::GetVarint( data, value ); } );
+            PatchCodec::PutVarint( out, value );
+            flush( false );
+        }
+    }
+    flush( true );
+
+    /* Признак формата известен только теперь */
+    if( stats.mPermutationSize != 0 )
+    {
+        std::fseek( patch, 0, SEEK_SET );
+        std::fputc( PatchCodec::PERMUTATION_PATCH_MAGIC, patch );
+    }
+    if( std::fflush( patch ) != 0 ) throw std::system_error( errno, std::generic_category(), "fflush " + patch_path );
+    return stats;
+}
+
+ExternalApplyStats ExternalDiffer::Apply( const std::string& old_path, const std::string& patch_path, const std::string& updated_path )
+{
+    std::FILE* file = std::fopen( patch_path.c_str(), "rb" );
+    if( !file ) throw std::system_error( errno, std::generic_category(), "fopen " + patch_path );
+    std::unique_ptr< std::FILE, int(*)( std::FILE* ) > guard( file, std::fclose );
+
+    std::string encoded( READ_BUFFER, '\0' );
+    size_t size = 0;
+    while( size_t read = std::fread( encoded.data() + size, 1, encoded.size() - size, file ) )
+    {
+        size += read;
+        if( size == encoded.size() ) encoded.resize( size * 2 );
+    }
+    if( std::ferror( file ) ) throw std::system_error( errno, std::generic_category(), "fread " + patch_path );
+    encoded.resize( size );
+
+    CompareResult< Address > patch;
+    if( !PatchCodec::DecodePatch( encoded, patch ) ) throw std::runtime_error( "not a patch: " + patch_path );
+    return Apply( old_path, patch, updated_path );
+}
+
+ExternalApplyStats ExternalDiffer::Apply( const std::string& old_path, const CompareResult< Address >& patch, const std::string& updated_path )
+{
+    ExternalApplyStats stats;
+    SnapshotReader old_snapshot( old_path, READ_BUFFER );
+
+    /* Место каждого добавления в списке после всех вставок */
+    const auto& added = patch.mAddedOperations;
+    for( size_t k = 0; k < added.size(); ++k )
+    {
+        size_t position = added[ k ].mPositionStart;
+        if( position > old_snapshot.Size() + k ) throw std::out_of_range( "add position " + std::to_string( position ) + " is out of range" );
+    }
+    auto add_slots = DifferAddress::AddedSlots( added );
+    std::vector< size_t > add_order( added.size() );
+    std::iota( add_order.begin(), add_order.end(), 0 );
+    std::sort( add_order.begin(), add_order.end(), [&]( size_t a, size_t b ){ return add_slots[ a ] < add_slots[ b ]; } );
+
+    /* Удаления и изменения находят элемент по идентификатору: первый подходящий, как поиск в DoEditorialPrescription */
+    std::unordered_map< size_t, size_t > deletes;
+    for( const auto& elem : patch.mDeletedOperations ) ++deletes[ elem.mValue.mId ];
+    std::unordered_map< size_t, InternedString > changes;
+    for( const auto& elem : patch.mChandedOperations ) changes[ elem.mValue.mId ] = elem.mNewValue->mValue;
+
+    /* Перемещения и следующая за ними перестановка сводятся к одной: order[ i ] - откуда встает элемент на позицию i */
+    auto moves = DifferAddress::MovesToPermutation( patch.mMovedOperations );
+    const auto& permutation = patch.mPermutation;
+    std::vector< size_t > order( std::max( moves.size(), permutation.size() ) );
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+        size_t from = i < permutation.size() ? permutation[ i ] : i;
+        order[ i ] = from < moves.size() ? moves[ from ] : from;
+    }
+    stats.mReorderedPrefix = order.size();
+
+    const size_t updated_size = old_snapshot.Size() + added.size() - std::min( old_snapshot.Size() + added.size(), patch.mDeletedOperations.size() );
+    if( order.size() > updated_size ) throw std::out_of_range( "reorder is longer than the list" );
+
+    std::FILE* updated = std::fopen( updated_path.c_str(), "wb" );
+    if( !updated ) throw std::system_error( errno, std::generic_category(), "fopen " + updated_path );
+    std::unique_ptr< std::FILE, int(*)( std::FILE* ) > updated_guard( updated, std::fclose );
+    std::string out;
+    auto flush = [&]( bool force )
+    {
+        if( ( force || out.size() >= 1 << 16 ) && !out.empty() )
+        {
+            if( std::fwrite( out.data(), 1, out.size(), updated ) != out.size() ) throw std::system_error( errno, std::generic_category(), "fwrite " + updated_path );
+            out.clear();
+        }
+    };
+    auto write = [&]( Address& address )
+    {
+        address.mPosition = stats.mWritten++;
+        PatchCodec::PutAddress( out, address );
+        flush( false );
+    };
+    out.push_back( PatchCodec::SNAPSHOT_MAGIC );
+    PatchCodec::PutVarint( out, updated_size );
+
+    /* Старый снимок с добавленными на своих местах */
+    size_t slot = 0;
+    size_t next_add = 0;
+    auto next_inserted = [&]( Address& address )
+    {
+        if( next_add < add_order.size() && add_slots[ add_order[ next_add ] ] == slot )
+        {
+            address = added[ add_order[ next_add++ ] ].mValue;
+        }
+        else if( old_snapshot.Next( address ) )
+        {
+            ++stats.mRead;
+        }
+        else
+        {
+            if( next_add < add_order.size() ) throw std::out_of_range( "add position is out of range" );
+            return false;
+        }
+        ++slot;
+        return true;
+    };
+
+    /* Затем без удаленных и с новыми значениями измененных */
+    auto next_edited = [&]( Address& address )
+    {
+        while( next_inserted( address ) )
+        {
+            if( auto it = deletes.find( address.mId ); it != deletes.end() )
+            {
+                if( --it->second == 0 ) deletes.erase( it );
+                continue;
+            }
+            if( auto it = changes.find( address.mId ); it != changes.end() )
+            {
+                address.mValue = std::move( it->second );
+                changes.erase( it );
+            }
+            return true;
+        }
+        return false;
+    };
+
+    /* Переставляемое начало: элементы, прочитанные раньше своей позиции, ждут в памяти */
+    Address address{};
+    std::unordered_map< size_t, Address > waiting;
+    size_t edited = 0;
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+        if( auto it = waiting.find( order[ i ] ); it != waiting.end() )
+        {
+            write( it->second );
+            waiting.erase( it );
+            continue;
+        }
+        while( true )
+        {
+            if( !next_edited( address ) ) throw std::out_of_range( "reorder is longer than the list" );
+            if( edited++ == order[ i ] ) break;
+            waiting.emplace( edited - 1, std::move( address ) );
+            stats.mPeakWaiting = std::max( stats.mPeakWaiting, waiting.size() );
+        }
+        write( address );
+    }
+    while( next_edited( address ) ) write( address );
+
+    if( !deletes.empty() ) throw std::runtime_error( "patch deletes an id missing from " + old_path );
+    if( !changes.empty() ) throw std::runtime_error( "patch changes an id missing from " + old_path );
+    flush( true );
+    if( std::fflush( updated ) != 0 ) throw std::system_error( errno, std::generic_category(), "fflush " + updated_path );
+    return stats;
+}
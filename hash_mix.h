@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * @brief Перемешивает биты 64-битного значения: финализатор splitmix64.
+ * @details Общий для отпечатков DiffCache, приоритетов PersistentAddressList и хешей ReconciliationSketch.
+ * @param value Значение.
+ * @return Перемешанное значение.
+ */
+uint64_t MixHash( uint64_t value )
+{
+    value = ( value ^ ( value >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    value = ( value ^ ( value >> 27 ) ) * 0x94d049bb133111ebULL;
+    return value ^ ( value >> 31 );
+}
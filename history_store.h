@@ -0,0 +1,329 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <utility>
+#include <stdexcept>
+#include "address_differ.h"
+#include "patch_codec.h"
+#include "transport_cost.h"
+
+/* @brief Настройки хранилища истории */
+struct HistoryConfig
+{
+    /*
+     * Контрольная точка назначается, когда оценка применения предписаний после предыдущей точки
+     * превышает оценку загрузки полного списка, умноженную на этот коэффициент.
+     */
+    double mCheckpointCost = 1.0;
+
+    /* Наибольшее количество предписаний между контрольными точками */
+    size_t mMaxChain = 64;
+
+    /* Сколько последних версий хранить. Более старые удаляются при уплотнении */
+    size_t mRetainVersions = SIZE_MAX;
+
+    /* Уплотнять в фоновом потоке. Иначе - только вызовом Compact */
+    bool mBackgroundCompaction = true;
+
+    /* Модель стоимости применения предписаний и загрузки полных списков */
+    TransportCostModel mCostModel;
+};
+
+/*
+ * @brief История версий списка адресов: предписания между соседними версиями и контрольные точки - полные списки.
+ * Любая версия восстанавливается загрузкой ближайшей контрольной точки и применением не более mMaxChain предписаний,
+ * суммарная оценка стоимости которых не больше mCheckpointCost загрузок полного списка.
+ * Добавление только кодирует предписание и назначает контрольную точку; сами точки строятся при уплотнении,
+ * которое также удаляет версии старше mRetainVersions. Пока назначенная точка не построена,
+ * ее версии восстанавливаются от предыдущей точки.
+ * Чтение и добавление можно выполнять из разных потоков.
+ */
+class HistoryStore
+{
+public:
+
+    /*
+     * @param initial Начальный список адресов (версия 0).
+     * @param config Настройки.
+     */
+    explicit HistoryStore( const std::vector< Address >& initial, HistoryConfig config = {} );
+    ~HistoryStore();
+
+    HistoryStore( const HistoryStore& ) = delete;
+    HistoryStore& operator=( const HistoryStore& ) = delete;
+
+    /*
+     * @brief Добавляет предписание от последней версии к новой.
+     * @details Пробрасывает исключение, возникшее при фоновом уплотнении.
+     * @param compare_result Редакционное предписание.
+     * @return Номер новой версии.
+     */
+    size_t Append( const CompareResult< Address >& compare_result );
+
+    /*
+     * @brief Восстанавливает версию.
+     * @details std::out_of_range - версия удалена уплотнением или еще не добавлена.
+     * @param version Номер версии.
+     */
+    std::vector< Address > At( size_t version ) const;
+
+    /* @brief Строит назначенные контрольные точки и удаляет версии старше mRetainVersions */
+    void Compact();
+
+    /* @brief Количество предписаний, применяемых при восстановлении версии */
+    size_t ReplayLength( size_t version ) const;
+
+    size_t Oldest() const;
+    size_t Latest() const;
+    size_t Checkpoints() const;
+
+    /* @brief Количество назначенных, но еще не построенных контрольных точек */
+    size_t PendingCheckpoints() const;
+
+private:
+
+    /* Восстанавливает версию. Вызывается под mMutex */
+    std::vector< Address > Reconstruct( size_t version ) const;
+
+    /* Строит контрольную точку для версии */
+    void MakeCheckpoint( size_t version );
+
+    /* Фоновое уплотнение */
+    void CompactionLoop();
+
+    HistoryConfig mConfig;
+
+    mutable std::shared_mutex mMutex;
+
+    /* Контрольные точки: номер версии -> закодированный список. Точка для mOldest есть всегда */
+    std::map< size_t, std::string > mCheckpoints;
+
+    /* Закодированные предписания версий mOldest + 1 .. mLatest */
+    std::deque< std::string > mPatches;
+    size_t mOldest = 0;
+    size_t mLatest = 0;
+
+    /* Назначенные контрольные точки */
+    std::deque< size_t > mPending;
+
+    /* Размер последней версии и стоимость загрузки полного списка на элемент - для назначения точек */
+    size_t mLatestSize;
+    double mSnapshotNsPerElement = 0;
+
+    /* Предписания после последней назначенной точки */
+    double mChainCost = 0;
+    size_t mChainLength = 0;
+
+    /* Уплотнения не выполняются одновременно */
+    std::mutex mCompactMutex;
+
+    std::thread mCompactor;
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    bool mWork = false;
+    bool mStop = false;
+    std::exception_ptr mError;
+};
+
+HistoryStore::HistoryStore( const std::vector< Address >& initial, HistoryConfig config )
+    : mConfig( std::move( config ) ), mLatestSize( initial.size() )
+{
+    std::string encoded;
+    PatchCodec::EncodeSnapshot( initial, encoded );
+    mCheckpoints.emplace( 0, std::move( encoded ) );
+    mSnapshotNsPerElement = mConfig.mCostModel.EstimateSnapshot( initial ).mApplyNs / std::max< size_t >( initial.size(), 1 );
+
+    if( mConfig.mBackgroundCompaction ) mCompactor = std::thread( &HistoryStore::CompactionLoop, this );
+}
+
+HistoryStore::~HistoryStore()
+{
+    if( mCompactor.joinable() )
+    {
+        {
+            std::lock_guard< std::mutex > lock( mWakeMutex );
+            mStop = true;
+        }
+        mWake.notify_one();
+        mCompactor.join();
+    }
+}
+
+size_t HistoryStore::Append( const CompareResult< Address >& compare_result )
+{
+    {
+        std::lock_guard< std::mutex > lock( mWakeMutex );
+        if( mError ) std::rethrow_exception( std::exchange( mError, nullptr ) );
+    }
+
+    std::string encoded;
+    PatchCodec::EncodePatch( compare_result, encoded );
+
+    bool wake = mConfig.mRetainVersions != SIZE_MAX;
+    size_t version;
+    {
+        std::unique_lock< std::shared_mutex > lock( mMutex );
+        mChainCost += mConfig.mCostModel.EstimatePatch( compare_result, mLatestSize ).mApplyNs;
+        mLatestSize = mLatestSize + compare_result.mAddedOperations.size() - compare_result.mDeletedOperations.size();
+        ++mChainLength;
+        mPatches.push_back( std::move( encoded ) );
+        version = ++mLatest;
+
+        if( mChainLength >= mConfig.mMaxChain || mChainCost > mConfig.mCheckpointCost * mSnapshotNsPerElement * mLatestSize )
+        {
+            mPending.push_back( version );
+            mChainCost = 0;
+            mChainLength = 0;
+            wake = true;
+        }
+    }
+
+    if( wake && mCompactor.joinable() )
+    {
+        {
+            std::lock_guard< std::mutex > lock( mWakeMutex );
+            mWork = true;
+        }
+        mWake.notify_one();
+    }
+    return version;
+}
+
+std::vector< Address > HistoryStore::At( size_t version ) const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    return Reconstruct( version );
+}
+
+std::vector< Address > HistoryStore::Reconstruct( size_t version ) const
+{
+    if( version < mOldest || version > mLatest ) throw std::out_of_range( "version " + std::to_string( version ) + " is not in history" );
+
+    auto checkpoint = std::prev( mCheckpoints.upper_bound( version ) );
+    std::vector< Address > addresses;
+    if( !PatchCodec::DecodeSnapshot( checkpoint->second, addresses ) ) throw std::runtime_error( "corrupted checkpoint" );
+
+    DifferAddress differ( false );
+    CompareResult< Address > patch;
+    for( size_t v = checkpoint->first + 1; v <= version; ++v )
+    {
+        if( !PatchCodec::DecodePatch( mPatches[ v - mOldest - 1 ], patch ) ) throw std::runtime_error( "corrupted patch" );
+        addresses = differ.DoEditorialPrescription( patch, addresses );
+    }
+    return addresses;
+}
+
+void HistoryStore::MakeCheckpoint( size_t version )
+{
+    /* Восстановление идет под разделяемой блокировкой - читатели не ждут */
+    std::string encoded;
+    double ns_per_element;
+    {
+        std::shared_lock< std::shared_mutex > lock( mMutex );
+        if( version < mOldest || mCheckpoints.count( version ) ) return;
+        auto addresses = Reconstruct( version );
+        PatchCodec::EncodeSnapshot( addresses, encoded );
+        ns_per_element = mConfig.mCostModel.EstimateSnapshot( addresses ).mApplyNs / std::max< size_t >( addresses.size(), 1 );
+    }
+
+    std::unique_lock< std::shared_mutex > lock( mMutex );
+    if( version < mOldest ) return;
+    mCheckpoints.emplace( version, std::move( encoded ) );
+    mSnapshotNsPerElement = ns_per_element;
+}
+
+void HistoryStore::Compact()
+{
+    std::lock_guard< std::mutex > compact_lock( mCompactMutex );
+
+    /* Назначенные контрольные точки */
+    while( true )
+    {
+        size_t version;
+        {
+            std::shared_lock< std::shared_mutex > lock( mMutex );
+            if( mPending.empty() ) break;
+            version = mPending.front();
+        }
+        MakeCheckpoint( version );
+
+        std::unique_lock< std::shared_mutex > lock( mMutex );
+        mPending.pop_front();
+    }
+
+    /* Удаление старых версий: самая старая оставшаяся версия становится контрольной точкой */
+    size_t horizon;
+    {
+        std::shared_lock< std::shared_mutex > lock( mMutex );
+        if( mConfig.mRetainVersions == SIZE_MAX || mLatest - mOldest <= mConfig.mRetainVersions ) return;
+        horizon = mLatest - mConfig.mRetainVersions;
+    }
+    MakeCheckpoint( horizon );
+
+    std::unique_lock< std::shared_mutex > lock( mMutex );
+    mCheckpoints.erase( mCheckpoints.begin(), mCheckpoints.find( horizon ) );
+    mPatches.erase( mPatches.begin(), mPatches.begin() + ( horizon - mOldest ) );
+    mOldest = horizon;
+}
+
+void HistoryStore::CompactionLoop()
+{
+    std::unique_lock< std::mutex > lock( mWakeMutex );
+    while( true )
+    {
+        mWake.wait( lock, [this]{ return mStop || mWork; } );
+        if( mStop ) return;
+        mWork = false;
+        lock.unlock();
+        try
+        {
+            Compact();
+        }
+        catch( ... )
+        {
+            lock.lock();
+            mError = std::current_exception();
+            continue;
+        }
+        lock.lock();
+    }
+}
+
+size_t HistoryStore::ReplayLength( size_t version ) const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    if( version < mOldest || version > mLatest ) throw std::out_of_range( "version " + std::to_string( version ) + " is not in history" );
+    return version - std::prev( mCheckpoints.upper_bound( version ) )->first;
+}
+
+size_t HistoryStore::Oldest() const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    return mOldest;
+}
+
+size_t HistoryStore::Latest() const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    return mLatest;
+}
+
+size_t HistoryStore::Checkpoints() const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    return mCheckpoints.size();
+}
+
+size_t HistoryStore::PendingCheckpoints() const
+{
+    std::shared_lock< std::shared_mutex > lock( mMutex );
+    return mPending.size();
+}
@@ -4,19 +4,77 @@
 #include <algorithm>
 #include <optional>
 #include <cassert>
+#include <random>
+#include <string>
 #include <address_differ.h>
+#include <address_list.h>
+#include <address_arena.h>
+#include <address_loader.h>
+#include <versioned_snapshot.h>
+#include <patch_codec.h>
+#include <replication.h>
+#include <diff_pipeline.h>
+#include <parallel_apply.h>
+#include <bounded_compare.h>
+#include <cancellable_compare.h>
+#include <transport_cost.h>
+#include <external_diff.h>
+#include <history_store.h>
+#include <merge.h>
+#include <diff_cache.h>
+#include <positions.h>
+#include <patch_overlay.h>
+#include <persistent_list.h>
+#include <reconciliation.h>
+#include <allocation_hooks.h>
+#include <fstream>
+#include <thread>
+#include <sstream>
 
 /*
  * @brief Сортирует массив адресов, если он не сортирован. Сортировка прводится по порядковому номеру в списке
+ * @details Элементы ставятся сразу на места своих позиций за O(n), см. NormalizePositions.
  * @param vector Исходный вектор.
 */
 void SortIfNot( std::vector< Address >& vector )
 {
-    auto less_address_sort = []( const Address& a, const Address& b ) { return a.mPosition < b.mPosition; } ;
-    if( !std::is_sorted( vector.begin(),vector.end(), less_address_sort ) )
+    NormalizePositions( vector );
+}
+
+/*
+ * @brief Формирует пару списков адресов со случайными добавлениями, удалениями, изменениями и перемещениями.
+ * @param size Размер старого списка.
+ * @param seed Начальное значение генератора.
+ * @return Старый и новый списки, отсортированные по позиции.
+ */
+std::pair< std::vector< Address >, std::vector< Address > > MakeRandomLists( size_t size, unsigned seed )
+{
+    std::mt19937 gen( seed );
+    std::vector< Address > old;
+    for( size_t i = 0; i < size; ++i )
+    {
+        old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    }
+
+    std::vector< Address > updated;
+    size_t next_id = size + 1;
+    for( const auto& elem : old )
+    {
+        auto dice = gen() % 10;
+        if( dice == 0 ) continue;
+        if( dice == 1 ) updated.push_back( { "changed_" + std::to_string( elem.mId ), elem.mId, 0 } );
+        else updated.push_back( elem );
+        if( dice == 2 ) updated.push_back( { "added_" + std::to_string( next_id ), next_id, 0 } ), ++next_id;
+    }
+    for( size_t i = 0; i < updated.size() / 8; ++i )
+    {
+        std::swap( updated[ gen() % updated.size() ], updated[ gen() % updated.size() ] );
+    }
+    for( size_t i = 0; i < updated.size(); ++i )
     {
-        std::sort( vector.begin(), vector.end(), less_address_sort );
+        updated[ i ].mPosition = i;
     }
+    return { old, updated };
 }
 
 void test_full_delete_address()
@@ -923,6 +981,1396 @@ void test_all_operations()
     assert( res_2 == updated );
 }
 
+void test_interned_values()
+{
+    std::cout << "test_interned_values" <<std::endl;
+    auto pool_size = StringPool::Instance().Size();
+    {
+        auto old = std::vector<Address>
+        {
+            { "interned_first", 1, 0 },
+            { "interned_second", 2, 1 }
+        };
+        auto updated = std::vector<Address>
+        {
+            { std::string( "interned_" ) + "first", 1, 0 },
+            { "interned_second_new", 2, 1 }
+        };
+
+        /* Одинаковые значения из разных снимков ссылаются на одну запись пула */
+        assert( &old[ 0 ].mValue.Str() == &updated[ 0 ].mValue.Str() );
+        assert( StringPool::Instance().Size() == pool_size + 3 );
+
+        auto res = DifferAddress().Compare( old, updated );
+        assert( res.mChandedOperations.size() == 1 );
+        assert( &res.mChandedOperations[ 0 ].mValue.mValue.Str() == &old[ 1 ].mValue.Str() );
+        assert( res.mChandedOperations[ 0 ].mNewValue->mValue == "interned_second_new" );
+        assert( StringPool::Instance().Size() == pool_size + 3 );
+    }
+    /* Значения без ссылок удаляются из пула */
+    assert( StringPool::Instance().Size() == pool_size );
+}
+
+void test_address_list_compare()
+{
+    std::cout << "test_address_list_compare" <<std::endl;
+    auto old = std::vector<Address>
+    {
+        { "first", 1, 0 },
+        { "second", 2, 1 },
+        { "third", 3, 2 },
+        { "fourth", 4, 3 }
+    };
+    auto updated = std::vector<Address>
+    {
+        { "third", 3, 0 },
+        { "second_new", 2, 1 },
+        { "fourth", 4, 2 },
+        { "fifth", 5, 3 },
+        { "sixth", 6, 4 }
+    };
+
+    assert( AddressList( old ).ToVector() == old );
+
+    auto res = DifferAddress().Compare( AddressList( old ), AddressList( updated ) );
+    auto expected = DifferAddress().Compare( old, updated );
+    assert( res.mAddedOperations == expected.mAddedOperations );
+    assert( res.mDeletedOperations == expected.mDeletedOperations );
+    assert( res.mChandedOperations == expected.mChandedOperations );
+    assert( res.mMovedOperations == expected.mMovedOperations );
+
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 40, seed );
+        auto random_res = DifferAddress().Compare( AddressList( lists.first ), AddressList( lists.second ) );
+        auto random_expected = DifferAddress().Compare( lists.first, lists.second );
+        assert( random_res.mAddedOperations == random_expected.mAddedOperations );
+        assert( random_res.mDeletedOperations == random_expected.mDeletedOperations );
+        assert( random_res.mChandedOperations == random_expected.mChandedOperations );
+        assert( random_res.mMovedOperations == random_expected.mMovedOperations );
+    }
+}
+
+void test_address_arena()
+{
+    std::cout << "test_address_arena" <<std::endl;
+    auto old = std::vector<Address>
+    {
+        { "first", 1, 0 },
+        { "", 2, 1 },
+        { "third", 3, 2 }
+    };
+    AddressArena arena( old );
+    assert( arena.ToVector() == old );
+    assert( arena.Bytes() == 10 && arena.Value( 1 ).empty() && arena.Value( 2 ) == "third" );
+
+    std::string encoded;
+    PatchCodec::EncodeSnapshot( old, encoded );
+    AddressArena decoded;
+    assert( AddressArena::FromSnapshot( encoded, decoded ) && decoded == arena );
+    assert( !AddressArena::FromSnapshot( encoded.substr( 0, encoded.size() - 1 ), decoded ) );
+
+    DifferAddress differ( false );
+    for( unsigned seed = 0; seed < 20; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto res = differ.Compare( AddressArena( lists.first ), AddressArena( lists.second ) );
+        auto expected = differ.Compare( lists.first, lists.second );
+        assert( res.mAddedOperations == expected.mAddedOperations );
+        assert( res.mDeletedOperations == expected.mDeletedOperations );
+        assert( res.mChandedOperations == expected.mChandedOperations );
+        assert( res.mMovedOperations == expected.mMovedOperations );
+
+        /* Применение дает тот же список, что и для вектора адресов, в том числе с перестановкой из кодека */
+        assert( differ.DoEditorialPrescription( res, AddressArena( lists.first ) ) == AddressArena( lists.second ) );
+        std::string patch;
+        PatchCodec::EncodePatch( res, patch );
+        CompareResult< Address > decoded_patch;
+        assert( PatchCodec::DecodePatch( patch, decoded_patch ) );
+        assert( differ.DoEditorialPrescription( decoded_patch, AddressArena( lists.first ) ).ToVector() == lists.second );
+    }
+
+    /* Добавления не по возрастанию позиций применяются по одному, как в векторе адресов */
+    CompareResult< Address > unordered;
+    unordered.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, { "x", 10, 2 }, std::nullopt, 2, std::nullopt } );
+    unordered.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, { "y", 11, 0 }, std::nullopt, 0, std::nullopt } );
+    unordered.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, { "z", 12, 0 }, std::nullopt, 0, std::nullopt } );
+    assert( differ.DoEditorialPrescription( unordered, arena ).ToVector() == differ.DoEditorialPrescription( unordered, old ) );
+}
+
+void test_address_loader()
+{
+    std::cout << "test_address_loader" <<std::endl;
+
+    /* Поиск разделителя совпадает с посимвольным на любом смещении внутри слова */
+    std::string text = "0123456789abcdef,0123456789\n0123456789abcdef";
+    for( size_t begin = 0; begin < text.size(); ++begin )
+    {
+        const char* expected = text.data() + begin;
+        while( expected < text.data() + text.size() && *expected != ',' && *expected != '\n' ) ++expected;
+        assert( AddressLoader::FindSeparator( text.data() + begin, text.data() + text.size(), ',' ) == expected );
+    }
+
+    /* Заголовок, CRLF, пустые строки и разделители внутри значения */
+    auto csv = AddressLoader::Parse( "id,position,value\r\n1,0,street 1, house 2\r\n\n2,1,\n3,2,last" );
+    assert( csv.ToVector() == ( std::vector< Address >{ { "street 1, house 2", 1, 0 }, { "", 2, 1 }, { "last", 3, 2 } } ) );
+    auto tsv = AddressLoader::Parse( "10\t1\ta,b\n20\t0\tc\td\n" );
+    assert( tsv.ToVector() == ( std::vector< Address >{ { "a,b", 10, 1 }, { "c\td", 20, 0 } } ) );
+    assert( AddressLoader::SortByPosition( tsv ).ToVector() == ( std::vector< Address >{ { "c\td", 20, 0 }, { "a,b", 10, 1 } } ) );
+
+    for( auto bad : { "1,0,a\n2,x,b", "1,0,a\n2", "1,0\n", "1,0,a\n99999999999999999999999,0,b" } )
+    {
+        bool thrown = false;
+        try { AddressLoader::Parse( bad ); }
+        catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+    }
+
+    /* Загрузка из файла и сравнение с перестановкой дают тот же результат применения, что и Compare */
+    DifferAddress differ( false );
+    for( unsigned seed = 0; seed < 10; ++seed )
+    {
+        auto lists = MakeRandomLists( 80, seed );
+        std::string path = "/tmp/address_loader_test_" + std::to_string( getpid() ) + ".csv";
+        {
+            std::ofstream file( path );
+            for( const auto& elem : lists.second ) file << elem.mId << "," << elem.mPosition << "," << elem.mValue << "\n";
+        }
+        auto loaded = AddressLoader::Load( path );
+        std::remove( path.c_str() );
+        assert( loaded == AddressArena( lists.second ) );
+
+        AddressArena old_arena( lists.first );
+        auto permuted = differ.ComparePermutation( old_arena, loaded );
+        auto expected = differ.Compare( lists.first, lists.second );
+        assert( permuted.mMovedOperations.empty() );
+        assert( permuted.mAddedOperations == expected.mAddedOperations );
+        assert( permuted.mDeletedOperations == expected.mDeletedOperations );
+        assert( permuted.mChandedOperations == expected.mChandedOperations );
+        assert( differ.DoEditorialPrescription( permuted, old_arena ) == loaded );
+        assert( differ.DoEditorialPrescription( permuted, lists.first ) == lists.second );
+    }
+}
+
+void test_versioned_snapshot()
+{
+    std::cout << "test_versioned_snapshot" <<std::endl;
+
+    /* Каждая версия целиком состоит из значений одного поколения */
+    auto make_generation = []( size_t generation )
+    {
+        std::vector< Address > result;
+        for( size_t i = 0; i < 32; ++i )
+        {
+            result.push_back( { "gen_" + std::to_string( generation ), i + 1, i } );
+        }
+        return result;
+    };
+
+    VersionedSnapshot snapshot( make_generation( 0 ), 8 );
+    {
+        auto guard = snapshot.Read();
+        assert( guard->mVersion == 0 );
+        assert( guard->mAddresses == make_generation( 0 ) );
+
+        /* Читатель держит версию 0, поэтому она не освобождается. Применение патча ничего не печатает */
+        auto patch = DifferAddress( false ).Compare( make_generation( 0 ), make_generation( 1 ) );
+        std::ostringstream output;
+        auto* cout_buffer = std::cout.rdbuf( output.rdbuf() );
+        assert( snapshot.Apply( patch ) == 1 );
+        std::cout.rdbuf( cout_buffer );
+        assert( output.str().empty() );
+        assert( snapshot.RetiredCount() == 1 );
+        assert( guard->mAddresses == make_generation( 0 ) );
+        assert( snapshot.Read()->mAddresses == make_generation( 1 ) );
+    }
+    assert( snapshot.Reclaim() == 1 );
+    assert( snapshot.RetiredCount() == 0 );
+
+    /* Читателей больше, чем слотов: лишнее чтение не ждет, а завершается исключением */
+    {
+        VersionedSnapshot small( make_generation( 0 ), 2 );
+        auto first = small.Read();
+        auto second = small.Read();
+        bool thrown = false;
+        try { small.Read(); }
+        catch( const std::runtime_error& ) { thrown = true; }
+        assert( thrown );
+        { auto released = std::move( first ); }
+        assert( small.Read()->mVersion == 0 );
+    }
+
+    const size_t generations = 200;
+    std::atomic< bool > stop{ false };
+    std::atomic< bool > consistent{ true };
+    std::vector< std::thread > readers;
+    for( size_t r = 0; r < 4; ++r )
+    {
+        readers.emplace_back( [&]()
+        {
+            while( !stop.load() )
+            {
+                auto guard = snapshot.Read();
+                auto expected_value = guard->mAddresses.front().mValue;
+                for( const auto& elem : guard->mAddresses )
+                {
+                    if( elem.mValue != expected_value ) consistent = false;
+                }
+            }
+        } );
+    }
+    for( size_t generation = 2; generation <= generations; ++generation )
+    {
+        snapshot.Publish( make_generation( generation ) );
+    }
+    stop = true;
+    for( auto& reader : readers ) reader.join();
+
+    assert( consistent );
+    assert( snapshot.Read()->mVersion == generations );
+    snapshot.Reclaim();
+    assert( snapshot.RetiredCount() == 0 );
+}
+
+void test_patch_codec()
+{
+    std::cout << "test_patch_codec" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 40, seed );
+        auto res = DifferAddress().Compare( lists.first, lists.second );
+
+        std::string encoded;
+        PatchCodec::EncodePatch( res, encoded );
+        CompareResult< Address > decoded;
+        assert( PatchCodec::DecodePatch( encoded, decoded ) );
+        assert( decoded.mAddedOperations == res.mAddedOperations );
+        assert( decoded.mDeletedOperations == res.mDeletedOperations );
+        assert( decoded.mChandedOperations == res.mChandedOperations );
+        /* Много перемещений кодек может заменить перестановкой - результат применения тот же */
+        assert( decoded.mPermutation.empty() ? decoded.mMovedOperations == res.mMovedOperations : decoded.mMovedOperations.empty() );
+        assert( DifferAddress( false ).DoEditorialPrescription( decoded, lists.first ) == lists.second );
+        assert( PatchCodec::EncodedSize( res ) == encoded.size() );
+        assert( !PatchCodec::DecodePatch( std::string_view( encoded ).substr( 0, encoded.size() - 1 ), decoded ) );
+
+        std::string snapshot;
+        PatchCodec::EncodeSnapshot( lists.second, snapshot );
+        std::vector< Address > decoded_snapshot;
+        assert( PatchCodec::DecodeSnapshot( snapshot, decoded_snapshot ) );
+        assert( decoded_snapshot == lists.second );
+    }
+}
+
+void test_replication()
+{
+    std::cout << "test_replication" <<std::endl;
+    auto socket_path = "/tmp/address_differ_test_" + std::to_string( getpid() ) + ".sock";
+    auto lists = MakeRandomLists( 30, 1 );
+
+    ReplicationPublisher publisher( socket_path, lists.first );
+    ReplicationSubscriber subscriber( socket_path );
+    assert( publisher.AcceptSubscribers( 1000 ) == 1 );
+    while( subscriber.Poll( 1000 ) == 0 ) {}
+    assert( subscriber.State().Synced() );
+    assert( subscriber.State().Addresses() == lists.first );
+
+    /* Версии применяются по порядку; часть из них издатель может отправить полным списком */
+    std::vector< Address > current = lists.second;
+    publisher.Publish( current );
+    for( unsigned seed = 2; seed < 5; ++seed )
+    {
+        auto next = MakeRandomLists( 30, seed ).second;
+        publisher.Publish( next );
+        current = next;
+    }
+    while( subscriber.State().Sequence() != publisher.Sequence() ) subscriber.Poll( 1000 );
+    assert( subscriber.State().PatchesApplied() == publisher.PatchesPublished() );
+    assert( subscriber.State().SnapshotsApplied() == 1 + publisher.SnapshotsPublished() );
+    assert( publisher.PatchesPublished() + publisher.SnapshotsPublished() == 4 );
+    assert( subscriber.State().Addresses() == current );
+
+    /* Пропуск номера: реплика запрашивает полный список и игнорирует предписания до его получения */
+    ReplicationFrame skipped{ FRAME_TYPE::PATCH, publisher.Sequence() + 2, SteadyNowNs(), {} };
+    assert( subscriber.Handle( skipped ) == ReplicaState::RESULT::NEED_RESYNC );
+    assert( !subscriber.State().Synced() );
+    publisher.Publish( lists.first );
+    while( publisher.ServeRequests() == 0 ) {}
+    while( subscriber.State().SnapshotsApplied() != 2 + publisher.SnapshotsPublished() ) subscriber.Poll( 1000 );
+    assert( subscriber.State().Synced() );
+    assert( subscriber.State().Gaps() == 1 );
+    assert( subscriber.State().Sequence() == publisher.Sequence() );
+    assert( subscriber.State().Addresses() == lists.first );
+
+    /* Числа заголовка записываются младшим байтом вперед независимо от платформы */
+    int fds[ 2 ];
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    FrameChannel writer( fds[ 0 ] ), reader( fds[ 1 ] );
+    ReplicationFrame frame{ FRAME_TYPE::PATCH, 0x0102030405060708ULL, 0x1112131415161718ULL, "abc" };
+    assert( writer.Send( frame ) );
+    char raw[ FrameChannel::HEADER_SIZE + 3 ];
+    assert( recv( fds[ 1 ], raw, sizeof( raw ), MSG_PEEK | MSG_WAITALL ) == sizeof( raw ) );
+    assert( raw[ 0 ] == static_cast< char >( FRAME_TYPE::PATCH ) );
+    assert( raw[ 1 ] == 0x08 && raw[ 8 ] == 0x01 && raw[ 9 ] == 0x18 && raw[ 16 ] == 0x11 );
+    assert( raw[ 17 ] == 3 && raw[ 18 ] == 0 && raw[ 19 ] == 0 && raw[ 20 ] == 0 );
+    ReplicationFrame received;
+    assert( reader.Receive() && reader.Next( received ) );
+    assert( received.mSequence == frame.mSequence && received.mTimestamp == frame.mTimestamp && received.mPayload == "abc" );
+
+    /* Подписчик, который не читает сокет, отключается по времени отправки и не задерживает остальных */
+    auto slow_path = "/tmp/address_differ_slow_" + std::to_string( getpid() ) + ".sock";
+    auto make_version = []( size_t version )
+    {
+        std::vector< Address > result;
+        for( size_t i = 0; i < 2000; ++i ) result.push_back( { "version_" + std::to_string( version ) + "_" + std::to_string( i ), i + 1, i } );
+        return result;
+    };
+    ReplicationPublisher slow_publisher( slow_path, make_version( 0 ), {}, 50 );
+    ReplicationSubscriber fast( slow_path ), slow( slow_path );
+    assert( slow_publisher.AcceptSubscribers( 1000 ) == 2 );
+    for( size_t version = 1; slow_publisher.SubscribersDropped() == 0; ++version )
+    {
+        assert( version < 1000 );
+        auto started = std::chrono::steady_clock::now();
+        slow_publisher.Publish( make_version( version ) );
+        assert( std::chrono::steady_clock::now() - started < std::chrono::seconds( 5 ) );
+        while( fast.State().Sequence() != slow_publisher.Sequence() ) fast.Poll( 1000 );
+    }
+    assert( slow_publisher.SubscribersCount() == 1 );
+    assert( fast.Connected() && fast.State().Addresses() == make_version( slow_publisher.Sequence() ) );
+    while( slow.Connected() ) slow.Poll( 1000 );
+    assert( slow.State().Sequence() < slow_publisher.Sequence() );
+}
+
+void test_diff_pipeline()
+{
+    std::cout << "test_diff_pipeline" <<std::endl;
+    std::vector< std::vector< Address > > snapshots{ MakeRandomLists( 30, 0 ).first };
+    for( unsigned seed = 0; seed < 12; ++seed )
+    {
+        snapshots.push_back( MakeRandomLists( 30, seed ).second );
+    }
+
+    std::vector< std::string > expected;
+    for( size_t i = 1; i < snapshots.size(); ++i )
+    {
+        std::string out;
+        PatchCodec::EncodePatch( DifferAddress().Compare( snapshots[ i - 1 ], snapshots[ i ] ), out );
+        expected.push_back( out );
+    }
+
+    for( size_t threads : { 1, 3 } )
+    {
+        DiffPipelineConfig config;
+        config.mLoadThreads = threads;
+        config.mIndexThreads = threads;
+        config.mCompareThreads = threads;
+        config.mEncodeThreads = threads;
+        config.mQueueCapacity = 2;
+        config.mWindow = 4;
+
+        std::vector< std::string > written;
+        DiffPipeline( config ).Run( snapshots.size(),
+            [&]( size_t index )
+            {
+                /* Снимок приходит неотсортированным - стадия индекса должна его упорядочить */
+                auto snapshot = snapshots[ index ];
+                std::reverse( snapshot.begin(), snapshot.end() );
+                return snapshot;
+            },
+            [&]( size_t index, std::string&& patch )
+            {
+                assert( index == written.size() + 1 );
+                written.push_back( std::move( patch ) );
+            } );
+        assert( written == expected );
+    }
+
+    /* Ошибка загрузки останавливает конвейер и пробрасывается наружу */
+    bool thrown = false;
+    try
+    {
+        DiffPipeline().Run( snapshots.size(),
+            [&]( size_t index ) { if( index == 5 ) throw std::runtime_error( "load failed" ); return snapshots[ index ]; },
+            []( size_t, std::string&& ) {} );
+    }
+    catch( const std::runtime_error& )
+    {
+        thrown = true;
+    }
+    assert( thrown );
+}
+
+void test_parallel_prescription()
+{
+    std::cout << "test_parallel_prescription" <<std::endl;
+    /* Большой список без перемещений: удаления и изменения */
+    std::vector< Address > big_old, big_updated;
+    for( size_t i = 0; i < 8000; ++i )
+    {
+        big_old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+        if( i % 7 == 0 ) continue;
+        big_updated.push_back( { ( i % 3 == 0 ? "changed_" : "value_" ) + std::to_string( i ), i + 1, big_updated.size() } );
+    }
+
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = seed == 0 ? std::make_pair( big_old, big_updated ) : MakeRandomLists( 200, seed );
+        auto res = DifferAddress( false ).Compare( AddressList( lists.first ), AddressList( lists.second ) );
+        for( size_t threads : { 1, 4 } )
+        {
+            auto parallel = ParallelPrescription( threads ).Apply( res, lists.first );
+            assert( parallel == DifferAddress( false ).DoEditorialPrescription( res, lists.first ) );
+            assert( parallel == lists.second );
+        }
+    }
+
+    /* Добавления на одну позицию сдвигают друг друга - результат все равно совпадает с последовательным */
+    auto old = std::vector<Address>
+    {
+        { "first", 1, 0 },
+        { "second", 2, 1 }
+    };
+    CompareResult< Address > res{
+        { { OPERATION_TYPE::ADDED, { "third", 3, 0 }, std::nullopt, 0, std::nullopt },
+          { OPERATION_TYPE::ADDED, { "fourth", 4, 0 }, std::nullopt, 0, std::nullopt } },
+        { { OPERATION_TYPE::DELETED, { "first", 1, 0 }, std::nullopt, 0, std::nullopt } },
+        { { OPERATION_TYPE::CHANGED, { "second", 2, 1 }, Address{ "second_new", 2, 1 }, 1, std::nullopt } },
+        { { OPERATION_TYPE::MOVED, { "third", 3, 0 }, std::nullopt, 1, 0 } } };
+    assert( ParallelPrescription( 4 ).Apply( res, old ) == DifferAddress( false ).DoEditorialPrescription( res, old ) );
+}
+
+void test_selected_operations_compare()
+{
+    std::cout << "test_selected_operations_compare" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+
+        auto membership = DifferAddress().Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED >( lists.first, lists.second );
+        assert( membership.mAddedOperations == full.mAddedOperations );
+        assert( membership.mDeletedOperations == full.mDeletedOperations );
+        assert( membership.mChandedOperations.empty() && membership.mMovedOperations.empty() );
+
+        auto changed = DifferAddress().Compare< OPERATION_TYPE::CHANGED >( lists.first, lists.second );
+        assert( changed.mChandedOperations == full.mChandedOperations );
+        assert( changed.mAddedOperations.empty() && changed.mDeletedOperations.empty() && changed.mMovedOperations.empty() );
+
+        auto moved = DifferAddress().Compare< OPERATION_TYPE::MOVED >( lists.first, lists.second );
+        assert( moved.mMovedOperations == full.mMovedOperations );
+        assert( moved.mAddedOperations.empty() && moved.mDeletedOperations.empty() && moved.mChandedOperations.empty() );
+
+        auto all = DifferAddress().Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( lists.first, lists.second );
+        assert( all.mAddedOperations == full.mAddedOperations );
+        assert( all.mDeletedOperations == full.mDeletedOperations );
+        assert( all.mChandedOperations == full.mChandedOperations );
+        assert( all.mMovedOperations == full.mMovedOperations );
+    }
+}
+
+void test_rvalue_compare()
+{
+    std::cout << "test_rvalue_compare" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+
+        /* Значения переносятся из списков в операции, идентификаторы и позиции остаются */
+        auto old = lists.first;
+        auto updated = lists.second;
+        auto stolen = DifferAddress().Compare( std::move( old ), std::move( updated ) );
+        assert( stolen.mAddedOperations == full.mAddedOperations );
+        assert( stolen.mDeletedOperations == full.mDeletedOperations );
+        assert( stolen.mChandedOperations == full.mChandedOperations );
+        assert( stolen.mMovedOperations == full.mMovedOperations );
+        for( size_t i = 0; i < updated.size(); ++i ) assert( updated[ i ].mId == lists.second[ i ].mId && updated[ i ].mPosition == i );
+        for( const auto& elem : full.mAddedOperations ) assert( updated[ elem.mPositionStart ].mValue.Empty() );
+
+        /* Предписание переносится в результат: значения добавлений и изменений пусты */
+        auto applied = DifferAddress( false ).DoEditorialPrescription( std::move( stolen ), lists.first );
+        assert( applied == lists.second );
+        for( const auto& elem : stolen.mAddedOperations ) assert( elem.mValue.mValue.Empty() );
+        for( const auto& elem : stolen.mChandedOperations ) assert( elem.mNewValue->mValue.Empty() );
+    }
+}
+
+void test_bounded_compare()
+{
+    std::cout << "test_bounded_compare" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+        auto same = [&full]( const CompareResult< Address >& result )
+        {
+            return result.mAddedOperations == full.mAddedOperations && result.mDeletedOperations == full.mDeletedOperations &&
+                   result.mChandedOperations == full.mChandedOperations && result.mMovedOperations == full.mMovedOperations;
+        };
+        std::string encoded;
+        PatchCodec::EncodePatch( full, encoded );
+        size_t operations = full.mAddedOperations.size() + full.mDeletedOperations.size() + full.mChandedOperations.size() + full.mMovedOperations.size();
+
+        /* Без ограничений - полный результат и точный размер */
+        auto unbounded = DifferAddress().CompareBounded( lists.first, lists.second, {} );
+        assert( !unbounded.mOverBudget );
+        assert( same( unbounded.mResult ) );
+        assert( unbounded.mEstimatedOperations == operations );
+        assert( unbounded.mEstimatedBytes == encoded.size() );
+
+        /* Бюджет ровно по размеру предписания не превышен */
+        auto exact = DifferAddress().CompareBounded( lists.first, lists.second, { operations, encoded.size() } );
+        assert( !exact.mOverBudget && same( exact.mResult ) );
+
+        /* Малый бюджет: сравнение прерывается, оценка не меньше бюджета */
+        auto small_ops = DifferAddress().CompareBounded( lists.first, lists.second, { operations / 4, SIZE_MAX } );
+        assert( small_ops.mOverBudget );
+        assert( small_ops.mEstimatedOperations > operations / 4 );
+
+        auto small_bytes = DifferAddress().CompareBounded( lists.first, lists.second, { SIZE_MAX, encoded.size() - 1 } );
+        assert( small_bytes.mOverBudget );
+        assert( small_bytes.mEstimatedBytes >= encoded.size() - 1 );
+    }
+
+    /* Сильно переставленный список: перемещения прерываются на первом превышении */
+    std::vector< Address > old, reversed;
+    for( size_t i = 0; i < 2000; ++i ) old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    for( size_t i = 0; i < old.size(); ++i ) reversed.push_back( { old[ old.size() - 1 - i ].mValue, old.size() - i, i } );
+    auto bounded = DifferAddress().CompareBounded( old, reversed, { 10, SIZE_MAX } );
+    assert( bounded.mOverBudget );
+    assert( bounded.mResult.mMovedOperations.size() == 11 );
+    assert( bounded.mEstimatedOperations > 10 );
+}
+
+void test_cancellable_compare()
+{
+    std::cout << "test_cancellable_compare" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+
+        /* Без отмены - полный результат */
+        CancellationToken token;
+        auto compared = DifferAddress().Compare( lists.first, lists.second, token );
+        assert( compared.mComplete );
+        assert( compared.mScanned == lists.first.size() + lists.second.size() );
+        assert( compared.mResult.mAddedOperations == full.mAddedOperations );
+        assert( compared.mResult.mDeletedOperations == full.mDeletedOperations );
+        assert( compared.mResult.mChandedOperations == full.mChandedOperations );
+        assert( compared.mResult.mMovedOperations == full.mMovedOperations );
+
+        auto applied = DifferAddress( false ).DoEditorialPrescription( full, lists.first, token );
+        assert( applied.mComplete );
+        assert( applied.mAppliedOperations == applied.mTotalOperations );
+        assert( applied.mAddresses == lists.second );
+
+        /* Отмененный признак - ничего не делается */
+        CancellationToken cancelled;
+        cancelled.Cancel();
+        auto not_compared = DifferAddress().Compare( lists.first, lists.second, cancelled );
+        assert( !not_compared.mComplete && not_compared.mScanned == 0 && not_compared.mResult.mDeletedOperations.empty() );
+        auto not_applied = DifferAddress( false ).DoEditorialPrescription( full, lists.first, cancelled );
+        assert( !not_applied.mComplete && not_applied.mAppliedOperations == 0 && not_applied.mAddresses.empty() );
+    }
+
+    /* Срок истек во время применения: выполненные операции подсчитаны, список не возвращается */
+    std::vector< Address > old, reversed;
+    for( size_t i = 0; i < 2000; ++i ) old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    for( size_t i = 0; i < old.size(); ++i ) reversed.push_back( { old[ old.size() - 1 - i ].mValue, old.size() - i, i } );
+    auto moves = DifferAddress().Compare< OPERATION_TYPE::MOVED >( old, reversed );
+    auto expired = CancellationToken::After( std::chrono::seconds( 0 ) );
+    auto not_applied = DifferAddress( false ).DoEditorialPrescription( moves, old, expired );
+    assert( !not_applied.mComplete && not_applied.mAppliedOperations == 0 && not_applied.mTotalOperations == moves.mMovedOperations.size() );
+
+    /* Сильно переставленный большой список: срок проверяется и внутри построения копии и выбора перемещения */
+    std::vector< Address > large, large_reversed;
+    for( size_t i = 0; i < 20000; ++i ) large.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    for( size_t i = 0; i < large.size(); ++i ) large_reversed.push_back( { large[ large.size() - 1 - i ].mValue, large.size() - i, i } );
+    auto short_deadline = CancellationToken::After( std::chrono::milliseconds( 5 ) );
+    auto large_partial = DifferAddress().Compare( large, large_reversed, short_deadline );
+    assert( !large_partial.mComplete );
+    assert( large_partial.mResult.mMovedOperations.size() < large.size() );
+    assert( large_partial.mMisplaced == 0 || large_partial.mScanned == large.size() + large_reversed.size() );
+}
+
+void test_transport_cost()
+{
+    std::cout << "test_transport_cost" <<std::endl;
+    TransportCostModel model;
+
+    /* Размеры совпадают с кодировкой PatchCodec */
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 60, seed );
+        auto patch = DifferAddress().Compare( lists.first, lists.second );
+        std::string encoded_patch, encoded_snapshot;
+        PatchCodec::EncodePatch( patch, encoded_patch );
+        PatchCodec::EncodeSnapshot( lists.second, encoded_snapshot );
+        assert( model.EstimatePatch( patch, lists.first.size() ).mBytes == encoded_patch.size() );
+        assert( model.EstimateSnapshot( lists.second ).mBytes == encoded_snapshot.size() );
+    }
+
+    /* Одно изменение и обратный порядок (кодируется перестановкой) - предписание, изменение всех значений - полный список */
+    std::vector< Address > old, changed, reversed, rewritten;
+    for( size_t i = 0; i < 1000; ++i ) old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    changed = old;
+    changed[ 500 ].mValue = "changed";
+    for( size_t i = 0; i < old.size(); ++i ) reversed.push_back( { old[ old.size() - 1 - i ].mValue, old.size() - i, i } );
+    for( size_t i = 0; i < old.size(); ++i ) rewritten.push_back( { "rewritten_" + std::to_string( i ), reversed[ i ].mId, i } );
+
+    auto small_patch = DifferAddress( false ).Compare( AddressList( old ), AddressList( changed ) );
+    assert( !model.PreferSnapshot( small_patch, old.size(), changed ) );
+    auto reorder_patch = DifferAddress( false ).Compare( AddressList( old ), AddressList( reversed ) );
+    assert( !model.PreferSnapshot( reorder_patch, old.size(), reversed ) );
+    auto rewrite_patch = DifferAddress( false ).Compare( AddressList( reversed ), AddressList( rewritten ) );
+    assert( model.PreferSnapshot( rewrite_patch, reversed.size(), rewritten ) );
+
+    auto calibrated = TransportCostModel::Calibrate( 500 );
+    assert( calibrated.GetCoefficients().mCopyNsPerElement > 0 );
+    assert( calibrated.GetCoefficients().mTransferNsPerByte > 0 );
+
+    /* Издатель сам выбирает полный список для изменения всех значений */
+    auto socket_path = "/tmp/address_differ_cost_" + std::to_string( getpid() ) + ".sock";
+    ReplicationPublisher publisher( socket_path, old );
+    ReplicationSubscriber subscriber( socket_path );
+    assert( publisher.AcceptSubscribers( 1000 ) == 1 );
+    publisher.Publish( changed );
+    publisher.Publish( reversed );
+    publisher.Publish( rewritten );
+    while( subscriber.State().Sequence() != publisher.Sequence() ) subscriber.Poll( 1000 );
+    assert( publisher.PatchesPublished() == 2 && publisher.SnapshotsPublished() == 1 );
+    assert( subscriber.State().PatchesApplied() == 2 && subscriber.State().SnapshotsApplied() == 2 );
+    assert( subscriber.State().Addresses() == rewritten );
+}
+
+void test_permutation_patch()
+{
+    std::cout << "test_permutation_patch" <<std::endl;
+    std::vector< Address > old, reversed;
+    for( size_t i = 0; i < 200; ++i ) old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    for( size_t i = 0; i < old.size(); ++i ) reversed.push_back( { old[ old.size() - 1 - i ].mValue, old.size() - i, i } );
+
+    /* Обратный порядок кодируется перестановкой, она короче перемещений */
+    auto res = DifferAddress( false ).Compare( AddressList( old ), AddressList( reversed ) );
+    std::string encoded;
+    PatchCodec::EncodePatch( res, encoded );
+    size_t moves_size = 0;
+    for( const auto& elem : res.mMovedOperations ) moves_size += PatchCodec::EncodedSize( elem );
+    assert( encoded.size() < moves_size );
+
+    CompareResult< Address > decoded;
+    assert( PatchCodec::DecodePatch( encoded, decoded ) );
+    assert( decoded.mMovedOperations.empty() && decoded.mPermutation.size() == old.size() );
+    assert( DifferAddress( false ).DoEditorialPrescription( decoded, old ) == reversed );
+    assert( ParallelPrescription( 4 ).Apply( decoded, old ) == reversed );
+    assert( DifferAddress::MovesToPermutation( res.mMovedOperations ) == decoded.mPermutation );
+
+    /* Перестановка выполняется после перемещений и покрывает только начало списка */
+    CompareResult< Address > mixed{ {}, {}, {}, { { OPERATION_TYPE::MOVED, old[ 0 ], std::nullopt, 0, 3 } }, { 2, 0, 1 } };
+    auto expected = old;
+    std::rotate( expected.begin(), expected.begin() + 1, expected.begin() + 4 );
+    std::rotate( expected.begin(), expected.begin() + 2, expected.begin() + 3 );
+    for( size_t i = 0; i < expected.size(); ++i ) expected[ i ].mPosition = i;
+    assert( DifferAddress( false ).DoEditorialPrescription( mixed, old ) == expected );
+    assert( ParallelPrescription( 4 ).Apply( mixed, old ) == expected );
+
+    std::string mixed_encoded;
+    PatchCodec::EncodePatch( mixed, mixed_encoded );
+    assert( PatchCodec::DecodePatch( mixed_encoded, decoded ) );
+    assert( DifferAddress( false ).DoEditorialPrescription( decoded, old ) == expected );
+
+    /* Повторяющийся индекс - не перестановка */
+    assert( PatchCodec::DecodePatch( std::string( "R\0\0\0\0\x02\x02\x01", 8 ), decoded ) );
+    assert( decoded.mPermutation == std::vector< size_t >( { 1, 0 } ) );
+    assert( !PatchCodec::DecodePatch( std::string( "R\0\0\0\0\x02\0\0", 8 ), decoded ) );
+}
+
+void test_external_diff()
+{
+    std::cout << "test_external_diff" <<std::endl;
+    auto prefix = "/tmp/address_differ_external_" + std::to_string( getpid() );
+    auto write_snapshot = []( const std::string& path, const std::vector< Address >& addresses )
+    {
+        std::string encoded;
+        PatchCodec::EncodeSnapshot( addresses, encoded );
+        std::ofstream( path, std::ios::binary ) << encoded;
+    };
+    auto read_file = []( const std::string& path )
+    {
+        std::ifstream file( path, std::ios::binary );
+        return std::string( std::istreambuf_iterator< char >( file ), std::istreambuf_iterator< char >() );
+    };
+
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 300, seed );
+        write_snapshot( prefix + ".old", lists.first );
+        write_snapshot( prefix + ".new", lists.second );
+
+        /* Маленький бюджет - сортировки сбрасывают отрезки на диск */
+        ExternalDiffConfig config;
+        config.mMemoryBudget = 4096;
+        auto stats = ExternalDiffer( config ).Compare( prefix + ".old", prefix + ".new", prefix + ".patch" );
+        assert( stats.mSpilledRuns > 0 );
+
+        CompareResult< Address > patch;
+        auto encoded = read_file( prefix + ".patch" );
+        assert( PatchCodec::DecodePatch( encoded, patch ) );
+        auto full = DifferAddress().Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED >( lists.first, lists.second );
+        assert( patch.mAddedOperations == full.mAddedOperations );
+        assert( patch.mDeletedOperations == full.mDeletedOperations );
+        assert( patch.mChandedOperations == full.mChandedOperations );
+        assert( patch.mMovedOperations.empty() && patch.mPermutation.size() == stats.mPermutationSize );
+        assert( stats.mAdded == full.mAddedOperations.size() && stats.mDeleted == full.mDeletedOperations.size() );
+        assert( DifferAddress( false ).DoEditorialPrescription( patch, lists.first ) == lists.second );
+        assert( ParallelPrescription( 4 ).Apply( patch, lists.first ) == lists.second );
+
+        /* Все в памяти - то же предписание без обращения к диску */
+        auto in_memory = ExternalDiffer().Compare( prefix + ".old", prefix + ".new", prefix + ".patch" );
+        assert( in_memory.mSpilledRuns == 0 );
+        assert( read_file( prefix + ".patch" ) == encoded );
+    }
+
+    /* Пик памяти сравнения не выходит за бюджет больше, чем на буферы ввода-вывода */
+    {
+        auto large = MakeRandomLists( 20000, 7 );
+        write_snapshot( prefix + ".old", large.first );
+        write_snapshot( prefix + ".new", large.second );
+        ExternalDiffConfig config;
+        config.mMemoryBudget = 1 << 20;
+        const size_t allowance = 512 << 10;
+
+        AllocationProfiler::Reset();
+        AllocationProfiler::Enable( true );
+        ExternalDiffStats stats;
+        {
+            AllocationPhase phase( "test.external" );
+            stats = ExternalDiffer( config ).Compare( prefix + ".old", prefix + ".new", prefix + ".patch" );
+        }
+        AllocationProfiler::Enable( false );
+        auto peak = AllocationProfiler::Report()[ "test.external" ].mPeakLiveBytes;
+        AllocationProfiler::Reset();
+        assert( stats.mSpilledRuns > 0 );
+        assert( peak <= config.mMemoryBudget + allowance );
+
+        CompareResult< Address > patch;
+        assert( PatchCodec::DecodePatch( read_file( prefix + ".patch" ), patch ) );
+        assert( DifferAddress( false ).DoEditorialPrescription( patch, large.first ) == large.second );
+    }
+
+    /* Без перестановок предписание обычное */
+    auto lists = MakeRandomLists( 50, 1 );
+    write_snapshot( prefix + ".old", lists.first );
+    write_snapshot( prefix + ".new", lists.first );
+    auto stats = ExternalDiffer().Compare( prefix + ".old", prefix + ".new", prefix + ".patch" );
+    assert( stats.mPermutationSize == 0 && stats.mAdded == 0 && stats.mDeleted == 0 && stats.mChanged == 0 );
+    assert( read_file( prefix + ".patch" ) == std::string( "P\0\0\0\0", 5 ) );
+
+    /* Поврежденный снимок */
+    std::ofstream( prefix + ".new", std::ios::binary ) << "S\x05";
+    bool thrown = false;
+    try { ExternalDiffer().Compare( prefix + ".old", prefix + ".new", prefix + ".patch" ); }
+    catch( const std::runtime_error& ) { thrown = true; }
+    assert( thrown );
+
+    for( auto suffix : { ".old", ".new", ".patch" } ) std::remove( ( prefix + suffix ).c_str() );
+}
+
+void test_streaming_apply()
+{
+    std::cout << "test_streaming_apply" <<std::endl;
+    auto prefix = "/tmp/address_differ_streaming_" + std::to_string( getpid() );
+    auto write_file = []( const std::string& path, const std::string& data ) { std::ofstream( path, std::ios::binary ) << data; };
+    auto read_snapshot = []( const std::string& path )
+    {
+        std::ifstream file( path, std::ios::binary );
+        std::string encoded( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
+        std::vector< Address > addresses;
+        assert( PatchCodec::DecodeSnapshot( encoded, addresses ) );
+        return addresses;
+    };
+
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 300, seed );
+        std::string snapshot;
+        PatchCodec::EncodeSnapshot( lists.first, snapshot );
+        write_file( prefix + ".old", snapshot );
+
+        /* Предписание с перемещениями */
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+        auto stats = ExternalDiffer().Apply( prefix + ".old", full, prefix + ".new" );
+        assert( read_snapshot( prefix + ".new" ) == lists.second );
+        assert( stats.mRead == lists.first.size() && stats.mWritten == lists.second.size() );
+
+        /* Предписание из файла; кодек может заменить перемещения перестановкой */
+        std::string encoded;
+        PatchCodec::EncodePatch( full, encoded );
+        write_file( prefix + ".patch", encoded );
+        ExternalDiffer().Apply( prefix + ".old", prefix + ".patch", prefix + ".new" );
+        assert( read_snapshot( prefix + ".new" ) == lists.second );
+    }
+
+    /* Перенос первого элемента в конец: ждет только он */
+    std::vector< Address > old;
+    for( size_t i = 0; i < 1000; ++i ) old.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    std::string snapshot;
+    PatchCodec::EncodeSnapshot( old, snapshot );
+    write_file( prefix + ".old", snapshot );
+    CompareResult< Address > rotate;
+    rotate.mMovedOperations.push_back( { OPERATION_TYPE::MOVED, old.front(), std::nullopt, 0, old.size() - 1 } );
+    auto stats = ExternalDiffer().Apply( prefix + ".old", rotate, prefix + ".new" );
+    assert( read_snapshot( prefix + ".new" ) == DifferAddress( false ).DoEditorialPrescription( rotate, old ) );
+    assert( stats.mReorderedPrefix == old.size() && stats.mPeakWaiting == 1 );
+
+    /* Добавления не по порядку позиций вставляются так же, как в DoEditorialPrescription */
+    CompareResult< Address > unordered;
+    for( size_t position : { 500, 0, 500, 1003, 2 } )
+    {
+        unordered.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, { "added_" + std::to_string( position ), 2000 + unordered.mAddedOperations.size(), position }, std::nullopt, position, std::nullopt } );
+    }
+    ExternalDiffer().Apply( prefix + ".old", unordered, prefix + ".new" );
+    assert( read_snapshot( prefix + ".new" ) == DifferAddress( false ).DoEditorialPrescription( unordered, old ) );
+
+    /* Предписание не подходит к снимку */
+    CompareResult< Address > missing;
+    missing.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, { "absent", 5000, 0 }, std::nullopt, 0, std::nullopt } );
+    bool thrown = false;
+    try { ExternalDiffer().Apply( prefix + ".old", missing, prefix + ".new" ); }
+    catch( const std::runtime_error& ) { thrown = true; }
+    assert( thrown );
+
+    for( auto suffix : { ".old", ".new", ".patch" } ) std::remove( ( prefix + suffix ).c_str() );
+}
+
+void test_patch_overlay()
+{
+    std::cout << "test_patch_overlay" <<std::endl;
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 200, seed );
+        auto full = DifferAddress().Compare( lists.first, lists.second );
+
+        /* Перемещения и перестановка, которой кодек заменяет многочисленные перемещения */
+        std::string encoded;
+        PatchCodec::EncodePatch( full, encoded );
+        CompareResult< Address > decoded;
+        assert( PatchCodec::DecodePatch( encoded, decoded ) );
+        for( const auto* patch : { &full, &decoded } )
+        {
+            PatchOverlay overlay( lists.first, *patch );
+            assert( overlay.Size() == lists.second.size() );
+            for( size_t i = 0; i < lists.second.size(); ++i ) assert( overlay.At( i ) == lists.second[ i ] );
+            assert( overlay.Range( 0, overlay.Size() ) == lists.second );
+            auto window = overlay.Range( 50, 70 );
+            assert( std::equal( window.begin(), window.end(), lists.second.begin() + 50, lists.second.begin() + 70 ) );
+            assert( overlay.Range( 10, 10 ).empty() );
+        }
+    }
+
+    /* Добавления не по порядку позиций и перемещения через весь список */
+    std::vector< Address > base;
+    for( size_t i = 0; i < 100; ++i ) base.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    CompareResult< Address > patch;
+    for( size_t position : { 50, 0, 50, 103, 2 } )
+    {
+        patch.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, { "added_" + std::to_string( position ), 1000 + patch.mAddedOperations.size(), position }, std::nullopt, position, std::nullopt } );
+    }
+    patch.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, base[ 7 ], std::nullopt, 7, std::nullopt } );
+    patch.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, base[ 9 ], Address{ "changed", 10, 0 }, 0, std::nullopt } );
+    patch.mMovedOperations.push_back( { OPERATION_TYPE::MOVED, base[ 0 ], std::nullopt, 0, 103 } );
+    patch.mMovedOperations.push_back( { OPERATION_TYPE::MOVED, base[ 50 ], std::nullopt, 90, 3 } );
+    auto expected = DifferAddress( false ).DoEditorialPrescription( patch, base );
+    PatchOverlay overlay( base, patch );
+    assert( overlay.Range( 0, overlay.Size() ) == expected );
+    for( size_t i = 0; i < expected.size(); ++i ) assert( overlay.At( i ) == expected[ i ] );
+
+    bool thrown = false;
+    try { overlay.At( expected.size() ); }
+    catch( const std::out_of_range& ) { thrown = true; }
+    assert( thrown );
+}
+
+void test_persistent_list()
+{
+    std::cout << "test_persistent_list" <<std::endl;
+
+    /* Цепочка предписаний: каждая версия совпадает с вектором, предыдущие не меняются */
+    auto lists = MakeRandomLists( 500, 0 );
+    PersistentAddressList version( lists.first );
+    std::vector< Address > expected = lists.first;
+    assert( version.ToVector() == expected );
+    for( unsigned seed = 1; seed < 6; ++seed )
+    {
+        auto next = MakeRandomLists( 500, seed ).second;
+        auto patch = DifferAddress( false ).Compare( expected, next );
+        auto applied = DifferAddress( false ).DoEditorialPrescription( patch, version );
+        assert( applied.ToVector() == next );
+        assert( version.ToVector() == expected );
+        for( size_t i = 0; i < next.size(); i += 37 ) assert( applied.At( i ) == next[ i ] );
+
+        /* Сравнение версий совпадает со сравнением векторов */
+        auto persistent = DifferAddress( false ).Compare( version, applied );
+        assert( persistent.mAddedOperations == patch.mAddedOperations );
+        assert( persistent.mDeletedOperations == patch.mDeletedOperations );
+        assert( persistent.mChandedOperations == patch.mChandedOperations );
+        assert( persistent.mMovedOperations == patch.mMovedOperations );
+
+        version = applied;
+        expected = next;
+    }
+
+    /* Небольшое предписание копирует только затронутые отрезки */
+    std::vector< Address > base;
+    for( size_t i = 0; i < 10000; ++i ) base.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    PersistentAddressList old_version( base );
+    auto updated = base;
+    updated[ 5000 ].mValue = "changed";
+    updated.insert( updated.begin() + 7000, Address{ "added", 20000, 0 } );
+    for( size_t i = 0; i < updated.size(); ++i ) updated[ i ].mPosition = i;
+    auto patch = DifferAddress( false ).Compare( base, updated );
+    auto new_version = DifferAddress( false ).DoEditorialPrescription( patch, old_version );
+    assert( new_version.ToVector() == updated );
+
+    auto old_chunks = old_version.Chunks();
+    auto new_chunks = new_version.Chunks();
+    std::sort( old_chunks.begin(), old_chunks.end() );
+    size_t shared = 0;
+    for( auto* chunk : new_chunks ) shared += std::binary_search( old_chunks.begin(), old_chunks.end(), chunk ) ? 1 : 0;
+    assert( shared + 2 >= new_chunks.size() );
+
+    auto diff = DifferAddress( false ).Compare( old_version, new_version );
+    assert( diff.mAddedOperations == patch.mAddedOperations && diff.mChandedOperations == patch.mChandedOperations );
+    assert( diff.mDeletedOperations.empty() && diff.mMovedOperations.empty() );
+
+    /* Вставки до переполнения отрезка и удаления до пустого */
+    PersistentAddressList list;
+    for( size_t i = 0; i < 1000; ++i ) list = list.Insert( i / 2, { "value_" + std::to_string( i ), i + 1, 0 } );
+    assert( list.Size() == 1000 && list.Chunks().size() > 1000 / ( 2 * PersistentAddressList::CHUNK_SIZE ) );
+    while( list.Size() > 0 ) list = list.Erase( list.Size() / 3 );
+    assert( list.Chunks().empty() );
+
+    bool thrown = false;
+    try { list.At( 0 ); }
+    catch( const std::out_of_range& ) { thrown = true; }
+    assert( thrown );
+}
+
+void test_reconciliation()
+{
+    std::cout << "test_reconciliation" <<std::endl;
+    auto ids = []( const std::vector< OperationData< Address > >& operations )
+    {
+        std::vector< size_t > result;
+        for( const auto& elem : operations ) result.push_back( elem.mValue.mId );
+        return result;
+    };
+
+    for( unsigned seed = 0; seed < 5; ++seed )
+    {
+        auto lists = MakeRandomLists( 300, seed );
+        auto full = DifferAddress( false ).Compare( lists.first, lists.second );
+
+        /* Реплика отправляет эскиз; если он мал, издатель просит вдвое больший */
+        CompareResult< Address > patch;
+        size_t cells = ReconciliationSketch::CellsFor( 4 );
+        while( true )
+        {
+            std::string encoded;
+            ReconciliationSketch::FromList( lists.first, cells ).Encode( encoded );
+            ReconciliationSketch sketch( ReconciliationSketch::HASH_COUNT );
+            assert( ReconciliationSketch::Decode( encoded, sketch ) && sketch.Cells() == cells );
+            if( DifferAddress( false ).Compare( sketch, lists.second, patch ) ) break;
+            cells = ReconciliationSketch::CellsFor( cells * 2 );
+        }
+        assert( DifferAddress( false ).DoEditorialPrescription( patch, lists.first ) == lists.second );
+        assert( patch.mAddedOperations == full.mAddedOperations );
+        assert( patch.mMovedOperations == full.mMovedOperations );
+        assert( ids( patch.mDeletedOperations ) == ids( full.mDeletedOperations ) );
+        assert( ids( patch.mChandedOperations ) == ids( full.mChandedOperations ) );
+    }
+
+    /* Размер эскиза зависит от количества отличий, а не от размера списка */
+    std::vector< Address > base;
+    for( size_t i = 0; i < 20000; ++i ) base.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    auto updated = base;
+    updated[ 100 ].mValue = "changed";
+    updated.erase( updated.begin() + 5000 );
+    updated.insert( updated.begin() + 12000, Address{ "added", 50000, 0 } );
+    std::rotate( updated.begin() + 15000, updated.begin() + 15001, updated.begin() + 15010 );
+    for( size_t i = 0; i < updated.size(); ++i ) updated[ i ].mPosition = i;
+
+    /* Изменение - 2 записи, удаление и добавление - по 3, перемещение - 6 */
+    auto sketch = ReconciliationSketch::FromList( base, ReconciliationSketch::CellsFor( 14 ) );
+    std::string encoded, snapshot;
+    sketch.Encode( encoded );
+    PatchCodec::EncodeSnapshot( base, snapshot );
+    assert( encoded.size() * 100 < snapshot.size() );
+
+    CompareResult< Address > patch;
+    assert( DifferAddress( false ).Compare( sketch, updated, patch ) );
+    assert( DifferAddress( false ).DoEditorialPrescription( patch, base ) == updated );
+    assert( patch.mChandedOperations.size() == 1 && patch.mChandedOperations.front().mNewValue->mValue == "changed" );
+    assert( patch.mDeletedOperations.size() == 1 && patch.mDeletedOperations.front().mValue.mId == 5001 );
+
+    /* Эскиз из 12 ячеек не вмещает 14 записей */
+    CompareResult< Address > small;
+    assert( !DifferAddress( false ).Compare( ReconciliationSketch::FromList( base, 4 * ReconciliationSketch::HASH_COUNT ), updated, small ) );
+
+    /* Поврежденные данные */
+    ReconciliationSketch decoded( ReconciliationSketch::HASH_COUNT );
+    assert( !ReconciliationSketch::Decode( encoded.substr( 0, encoded.size() - 1 ), decoded ) );
+    assert( !ReconciliationSketch::Decode( "P", decoded ) );
+
+    bool thrown = false;
+    try { ReconciliationSketch( 10 ); }
+    catch( const std::invalid_argument& ) { thrown = true; }
+    assert( thrown );
+}
+
+void test_allocation_profiler()
+{
+    std::cout << "test_allocation_profiler" <<std::endl;
+    assert( AllocationProfiler::HooksInstalled() );
+    auto lists = MakeRandomLists( 100, 0 );
+
+    /* Выключенный профилировщик ничего не записывает */
+    AllocationProfiler::Reset();
+    DifferAddress( false ).Compare( lists.first, lists.second );
+    assert( AllocationProfiler::Report().empty() );
+
+    AllocationProfiler::Enable( true );
+    auto patch = DifferAddress( false ).Compare( lists.first, lists.second );
+    auto applied = DifferAddress( false ).DoEditorialPrescription( patch, lists.first );
+    AllocationProfiler::Enable( false );
+    assert( applied == lists.second );
+
+    auto report = AllocationProfiler::Report();
+    for( auto name : { "compare", "compare.reserve", "compare.set_difference", "compare.copy", "compare.changes", "compare.moves", "apply", "apply.copy", "apply.added" } )
+    {
+        assert( report.count( name ) != 0 && report[ name ].mCalls == 1 );
+    }
+
+    /* Семь векторов под операции и элементы; внешняя фаза - сумма шагов, ее пик не меньше пика любого шага */
+    assert( report[ "compare.reserve" ].mAllocations == 7 );
+    size_t steps = 0;
+    for( const auto& [ name, stats ] : report )
+    {
+        if( name.rfind( "compare.", 0 ) != 0 ) continue;
+        steps += stats.mAllocations;
+        assert( stats.mPeakLiveBytes <= report[ "compare" ].mPeakLiveBytes );
+    }
+    assert( steps == report[ "compare" ].mAllocations );
+
+    /* Копия списка - одно выделение: значения интернированы и при копировании не выделяют память */
+    assert( report[ "apply.copy" ].mAllocations == 1 );
+    assert( report[ "apply.copy" ].mBytes >= lists.first.size() * sizeof( Address ) );
+
+    /* Освобожденное внутри фазы не входит в прирост внешней, но входит в ее пик */
+    AllocationProfiler::Reset();
+    AllocationProfiler::Enable( true );
+    {
+        AllocationPhase outer( "test.outer" );
+        std::vector< char > kept( 100 );
+        {
+            AllocationPhase inner( "test.inner" );
+            std::vector< char > temporary( 10000 );
+        }
+        /* Выделения других потоков не учитываются */
+        std::thread( []{ std::vector< char > other( 100000 ); } ).join();
+    }
+    AllocationProfiler::Enable( false );
+    report = AllocationProfiler::Report();
+    assert( report[ "test.inner" ].mAllocations == 1 && report[ "test.inner" ].mFrees == 1 );
+    assert( report[ "test.inner" ].mPeakLiveBytes >= 10000 );
+    assert( report[ "test.outer" ].mPeakLiveBytes >= 10100 && report[ "test.outer" ].mPeakLiveBytes < 100000 );
+    AllocationProfiler::Reset();
+}
+
+void test_small_compare()
+{
+    std::cout << "test_small_compare" <<std::endl;
+    DifferAddress differ( false );
+    CompareResult< Address > result;
+    DifferAddress::ReserveSmall( result );
+
+    /* Совпадает со сравнением по столбцам - отдельной реализацией без перехода на короткий путь */
+    for( unsigned seed = 0; seed < 200; ++seed )
+    {
+        auto lists = MakeRandomLists( seed % 56, seed );
+        assert( differ.CompareSmall( lists.first, lists.second, result ) );
+        auto expected = differ.Compare( AddressList( lists.first ), AddressList( lists.second ) );
+        assert( result.mAddedOperations == expected.mAddedOperations );
+        assert( result.mDeletedOperations == expected.mDeletedOperations );
+        assert( result.mChandedOperations == expected.mChandedOperations );
+        assert( result.mMovedOperations == expected.mMovedOperations );
+        assert( differ.DoEditorialPrescription( result, lists.first ) == lists.second );
+    }
+
+    /* Полный переворот: перемещений больше всего */
+    std::vector< Address > forward, backward;
+    for( size_t i = 0; i < DifferAddress::SMALL_LIST_SIZE; ++i ) forward.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    backward.assign( forward.rbegin(), forward.rend() );
+    for( size_t i = 0; i < backward.size(); ++i ) backward[ i ].mPosition = i;
+    assert( differ.CompareSmall( forward, backward, result ) );
+    assert( result.mMovedOperations == differ.Compare( AddressList( forward ), AddressList( backward ) ).mMovedOperations );
+
+    /* С зарезервированным результатом память не выделяется */
+    auto lists = MakeRandomLists( 50, 7 );
+    AllocationProfiler::Reset();
+    AllocationProfiler::Enable( true );
+    {
+        AllocationPhase phase( "test.small" );
+        for( int i = 0; i < 10; ++i ) differ.CompareSmall( lists.first, lists.second, result );
+        differ.CompareSmall( forward, backward, result );
+    }
+    AllocationProfiler::Enable( false );
+    assert( AllocationProfiler::Report()[ "test.small" ].mAllocations == 0 );
+    AllocationProfiler::Reset();
+
+    /* Перемещения сверх емкости не выделяют память: короткий путь отказывается, Compare находит их все */
+    CompareResult< Address > tight;
+    tight.mMovedOperations.reserve( 8 );
+    const size_t tight_capacity = tight.mMovedOperations.capacity();
+    auto all_moves = differ.Compare( AddressList( forward ), AddressList( backward ) ).mMovedOperations;
+    assert( all_moves.size() > tight_capacity );
+    AllocationProfiler::Enable( true );
+    {
+        AllocationPhase phase( "test.small_overflow" );
+        assert( !differ.CompareSmall( forward, backward, tight ) );
+    }
+    AllocationProfiler::Enable( false );
+    assert( AllocationProfiler::Report()[ "test.small_overflow" ].mAllocations == 0 );
+    AllocationProfiler::Reset();
+    assert( tight.mMovedOperations.empty() && tight.mMovedOperations.capacity() == tight_capacity );
+    assert( tight.mAddedOperations.empty() && tight.mDeletedOperations.empty() && tight.mChandedOperations.empty() );
+    assert( ( differ.Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >( forward, backward ).mMovedOperations == all_moves ) );
+
+    /* Длинные списки и повторяющиеся идентификаторы - полным сравнением */
+    forward.push_back( { "extra", 1000, forward.size() } );
+    assert( !differ.CompareSmall( forward, backward, result ) && result.mMovedOperations.empty() );
+    std::vector< Address > duplicates{ { "a", 1, 0 }, { "b", 1, 1 } };
+    assert( !differ.CompareSmall( duplicates, lists.second, result ) );
+}
+
+void test_history_store()
+{
+    std::cout << "test_history_store" <<std::endl;
+    std::vector< std::vector< Address > > versions{ MakeRandomLists( 60, 0 ).first };
+    for( unsigned seed = 1; seed <= 40; ++seed ) versions.push_back( MakeRandomLists( 60, seed ).second );
+    auto patch = []( const std::vector< Address >& a, const std::vector< Address >& b ) { return DifferAddress( false ).Compare( AddressList( a ), AddressList( b ) ); };
+
+    /* Контрольные точки ограничивают восстановление */
+    HistoryConfig config;
+    config.mBackgroundCompaction = false;
+    config.mMaxChain = 8;
+    HistoryStore store( versions.front(), config );
+    for( size_t v = 1; v < versions.size(); ++v ) assert( store.Append( patch( versions[ v - 1 ], versions[ v ] ) ) == v );
+    assert( store.Latest() == 40 && store.PendingCheckpoints() > 0 );
+    for( size_t v = 0; v < versions.size(); ++v ) assert( store.At( v ) == versions[ v ] );
+
+    store.Compact();
+    assert( store.PendingCheckpoints() == 0 && store.Checkpoints() > 1 );
+    for( size_t v = 0; v < versions.size(); ++v )
+    {
+        assert( store.ReplayLength( v ) < config.mMaxChain );
+        assert( store.At( v ) == versions[ v ] );
+    }
+
+    /* Фоновое уплотнение и удаление старых версий */
+    config.mBackgroundCompaction = true;
+    config.mRetainVersions = 10;
+    HistoryStore retained( versions.front(), config );
+    for( size_t v = 1; v < versions.size(); ++v ) retained.Append( patch( versions[ v - 1 ], versions[ v ] ) );
+    while( retained.Oldest() != 30 || retained.PendingCheckpoints() != 0 ) std::this_thread::yield();
+    for( size_t v = 30; v < versions.size(); ++v ) assert( retained.At( v ) == versions[ v ] );
+    bool thrown = false;
+    try { retained.At( 29 ); }
+    catch( const std::out_of_range& ) { thrown = true; }
+    assert( thrown );
+}
+
+void test_merge()
+{
+    std::cout << "test_merge" <<std::endl;
+    auto make = []( std::vector< std::pair< size_t, std::string > > elems )
+    {
+        std::vector< Address > addresses;
+        for( auto& [ id, value ] : elems ) addresses.push_back( { value, id, addresses.size() } );
+        return addresses;
+    };
+    DifferAddress differ( false );
+
+    /* Изменения без конфликтов: изменения значений, удаления, добавления и перемещения с обеих сторон */
+    auto base = make( { { 1, "v1" }, { 2, "v2" }, { 3, "v3" }, { 4, "v4" }, { 5, "v5" }, { 6, "v6" }, { 7, "v7" }, { 8, "v8" } } );
+    auto ours = make( { { 5, "v5" }, { 1, "v1" }, { 2, "o2" }, { 3, "v3" }, { 100, "o100" }, { 4, "v4" }, { 6, "v6" }, { 8, "v8" } } );
+    auto theirs = make( { { 2, "v2" }, { 3, "t3" }, { 4, "v4" }, { 5, "v5" }, { 6, "v6" }, { 200, "t200" }, { 7, "v7" }, { 1, "v1" } } );
+    auto merged = differ.Merge( base, ours, theirs );
+    assert( merged.mConflicts.empty() );
+    assert( merged.mMerged == make( { { 5, "v5" }, { 2, "o2" }, { 3, "t3" }, { 100, "o100" }, { 4, "v4" }, { 6, "v6" }, { 200, "t200" }, { 1, "v1" } } ) );
+
+    /* Конфликты разрешаются в пользу ours, удаление уступает изменению */
+    base = make( { { 1, "v1" }, { 2, "v2" }, { 3, "v3" }, { 4, "v4" }, { 5, "v5" } } );
+    ours = make( { { 5, "v5" }, { 1, "a1" }, { 2, "a2" }, { 4, "v4" }, { 10, "a10" } } );
+    theirs = make( { { 1, "b1" }, { 5, "v5" }, { 3, "b3" }, { 4, "v4" }, { 10, "b10" } } );
+    merged = differ.Merge( base, ours, theirs );
+    assert( merged.mMerged == make( { { 5, "v5" }, { 1, "a1" }, { 2, "a2" }, { 3, "b3" }, { 4, "v4" }, { 10, "a10" } } ) );
+    std::vector< CONFLICT_TYPE > types;
+    for( const auto& conflict : merged.mConflicts ) types.push_back( conflict.mType );
+    assert( ( types == std::vector< CONFLICT_TYPE >{ CONFLICT_TYPE::MOVE_MOVE, CONFLICT_TYPE::CHANGE_CHANGE, CONFLICT_TYPE::DELETE_CHANGE,
+                                                     CONFLICT_TYPE::ADD_ADD, CONFLICT_TYPE::DELETE_CHANGE } ) );
+    assert( merged.mConflicts[ 2 ].mId == 2 && merged.mConflicts[ 2 ].mOurs && !merged.mConflicts[ 2 ].mTheirs );
+    assert( merged.mConflicts[ 3 ].mId == 10 && !merged.mConflicts[ 3 ].mBase && merged.mConflicts[ 3 ].mTheirs->mValue == "b10" );
+
+    /* Слияние с неизмененной стороной и с самим собой дает измененный список */
+    for( unsigned seed = 0; seed < 20; ++seed )
+    {
+        auto lists = MakeRandomLists( 80, seed );
+        for( const auto& result : { differ.Merge( lists.first, lists.second, lists.first ), differ.Merge( lists.first, lists.first, lists.second ),
+                                    differ.Merge( lists.first, lists.second, lists.second ) } )
+        {
+            assert( result.mConflicts.empty() );
+            assert( result.mMerged == lists.second );
+        }
+    }
+
+    /* Большие списки: непересекающиеся правки сливаются без конфликтов */
+    base.clear();
+    for( size_t i = 0; i < 200000; ++i ) base.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    ours = base;
+    theirs.clear();
+    for( size_t i = 0; i < base.size(); ++i )
+    {
+        if( i % 7 == 0 ) ours[ i ].mValue = "ours_" + std::to_string( i );
+        if( i % 7 != 3 ) theirs.push_back( base[ i ] );
+    }
+    std::rotate( ours.begin(), ours.begin() + 1, ours.begin() + 1000 );
+    std::vector< Address > expected;
+    for( const auto& elem : ours )
+    {
+        if( ( elem.mId - 1 ) % 7 != 3 ) expected.push_back( { elem.mValue, elem.mId, expected.size() } );
+    }
+    merged = differ.Merge( base, ours, theirs );
+    assert( merged.mConflicts.empty() );
+    assert( merged.mMerged == expected );
+}
+
+void test_diff_cache()
+{
+    std::cout << "test_diff_cache" <<std::endl;
+    auto lists = MakeRandomLists( 60, 1 );
+    DiffCache cache;
+
+    /* Повторный запрос возвращает то же предписание без вычисления */
+    auto patch = cache.Get( lists.first, lists.second );
+    assert( cache.Get( lists.first, lists.second ) == patch );
+    assert( cache.Misses() == 1 && cache.Hits() == 1 && cache.Bytes() == patch->size() );
+    CompareResult< Address > decoded;
+    assert( PatchCodec::DecodePatch( *patch, decoded ) );
+    assert( DifferAddress( false ).DoEditorialPrescription( decoded, lists.first ) == lists.second );
+
+    /* Отпечаток зависит от значений и порядка */
+    auto changed = lists.second;
+    changed[ 0 ].mValue = changed[ 0 ].mValue.Str() + "'";
+    assert( DiffCache::Fingerprint( changed ) != DiffCache::Fingerprint( lists.second ) );
+    std::swap( changed[ 0 ], changed[ 1 ] );
+    std::swap( changed[ 0 ].mPosition, changed[ 1 ].mPosition );
+    assert( DiffCache::Fingerprint( changed ) != DiffCache::Fingerprint( lists.second ) );
+    assert( cache.Get( lists.first, changed ) != patch && cache.Misses() == 2 );
+
+    /* Вытеснение давно не запрошенных */
+    DiffCache small( 100 );
+    auto make = []( size_t bytes ){ return [bytes]{ return std::string( bytes, 'p' ); }; };
+    small.Get( 1, 2, make( 40 ) );
+    small.Get( 2, 3, make( 40 ) );
+    small.Get( 1, 2, make( 40 ) );
+    small.Get( 3, 4, make( 40 ) );
+    assert( small.Entries() == 2 && small.Bytes() == 80 );
+    assert( small.Get( 1, 2, make( 40 ) )->size() == 40 && small.Misses() == 3 );
+    assert( small.Get( 2, 3, make( 30 ) )->size() == 30 && small.Misses() == 4 );
+
+    /* Одновременные одинаковые запросы ждут одного вычисления */
+    std::atomic< int > computed{ 0 };
+    std::vector< std::thread > threads;
+    std::vector< DiffCache::Patch > results( 8 );
+    for( size_t i = 0; i < results.size(); ++i )
+    {
+        threads.emplace_back( [&, i]
+        {
+            results[ i ] = cache.Get( 10, 20, [&]
+            {
+                ++computed;
+                std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+                return std::string( "patch" );
+            } );
+        } );
+    }
+    for( auto& thread : threads ) thread.join();
+    assert( computed == 1 );
+    for( const auto& result : results ) assert( result == results.front() && *result == "patch" );
+
+    /* Ошибка вычисления не кешируется */
+    bool thrown = false;
+    try { cache.Get( 30, 40, []() -> std::string { throw std::runtime_error( "compare failed" ); } ); }
+    catch( const std::runtime_error& ) { thrown = true; }
+    assert( thrown );
+    assert( *cache.Get( 30, 40, []{ return std::string( "retry" ); } ) == "retry" );
+}
+
+void test_normalize_positions()
+{
+    std::cout << "test_normalize_positions" <<std::endl;
+    auto thrown = []( auto fn )
+    {
+        try { fn(); }
+        catch( const std::logic_error& ) { return true; }
+        return false;
+    };
+
+    /* Перестановка позиций: элементы встают на свои места */
+    std::mt19937 gen( 7 );
+    std::vector< Address > ordered;
+    for( size_t i = 0; i < 1000; ++i ) ordered.push_back( { "value_" + std::to_string( i ), i + 1, i } );
+    auto shuffled = ordered;
+    std::shuffle( shuffled.begin(), shuffled.end(), gen );
+    NormalizePositions( shuffled );
+    assert( shuffled == ordered );
+    NormalizePositions( shuffled );
+    assert( shuffled == ordered );
+
+    /* Позиции с пропусками: только с sparse, после сортировки перенумеровываются */
+    std::vector< Address > sparse{ { "c", 3, 300 }, { "a", 1, 7 }, { "b", 2, size_t( 1 ) << 40 } };
+    assert( thrown( [&]{ auto copy = sparse; NormalizePositions( copy ); } ) );
+    NormalizePositions( sparse, true );
+    assert( sparse == ( std::vector< Address >{ { "a", 1, 0 }, { "c", 3, 1 }, { "b", 2, 2 } } ) );
+
+    /* Повторяющиеся позиции */
+    std::vector< Address > duplicates{ { "a", 1, 1 }, { "b", 2, 1 } };
+    assert( thrown( [&]{ auto copy = duplicates; NormalizePositions( copy ); } ) );
+    duplicates.push_back( { "c", 3, 100 } );
+    assert( thrown( [&]{ auto copy = duplicates; NormalizePositions( copy, true ); } ) );
+
+    /* Большой список: поразрядная сортировка совпадает с сортировкой сравнением */
+    std::vector< size_t > keys( 300000 );
+    for( auto& key : keys ) key = gen() * uint64_t( 1 ) << 20 | ( &key - keys.data() );
+    auto order = PositionOrder( keys.size(), [&]( size_t i ){ return keys[ i ]; }, true );
+    std::vector< size_t > expected( keys.size() );
+    std::iota( expected.begin(), expected.end(), 0 );
+    std::sort( expected.begin(), expected.end(), [&]( size_t a, size_t b ){ return keys[ a ] < keys[ b ]; } );
+    assert( order == expected );
+    std::vector< std::pair< size_t, size_t > > pairs;
+    for( size_t i = 0; i < keys.size(); ++i ) pairs.emplace_back( keys[ i ] % 100000, i );
+    auto sorted_pairs = pairs;
+    std::stable_sort( sorted_pairs.begin(), sorted_pairs.end(), []( const auto& a, const auto& b ){ return a.first < b.first; } );
+    positions_detail::RadixSort( pairs, 100000, 4 );
+    assert( pairs == sorted_pairs );
+
+    /* Загрузчик перенумеровывает позиции */
+    auto loaded = AddressLoader::SortByPosition( AddressLoader::Parse( "5,40,x\n6,10,y\n" ) );
+    assert( loaded.ToVector() == ( std::vector< Address >{ { "y", 6, 0 }, { "x", 5, 1 } } ) );
+}
+
 void run_simple_tests()
 {
     test_full_delete_address();
@@ -936,6 +2384,32 @@ void run_simple_tests()
     test_moved_address();
     test_no_changes();
     test_repeat_string_address();
+    test_interned_values();
+    test_address_list_compare();
+    test_address_arena();
+    test_address_loader();
+    test_versioned_snapshot();
+    test_patch_codec();
+    test_replication();
+    test_diff_pipeline();
+    test_parallel_prescription();
+    test_selected_operations_compare();
+    test_rvalue_compare();
+    test_bounded_compare();
+    test_cancellable_compare();
+    test_transport_cost();
+    test_permutation_patch();
+    test_external_diff();
+    test_streaming_apply();
+    test_patch_overlay();
+    test_persistent_list();
+    test_reconciliation();
+    test_allocation_profiler();
+    test_small_compare();
+    test_history_store();
+    test_merge();
+    test_diff_cache();
+    test_normalize_positions();
 }
 
 void run_complex_tests()
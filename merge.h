@@ -0,0 +1,251 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include "address_differ.h"
+
+/* @brief Тип конфликта слияния */
+enum class CONFLICT_TYPE
+{
+    /* Элемент изменен в обоих списках по-разному */
+    CHANGE_CHANGE,
+
+    /* Элемент удален в одном списке и изменен в другом */
+    DELETE_CHANGE,
+
+    /* Элемент с одним идентификатором добавлен в оба списка с разными значениями */
+    ADD_ADD,
+
+    /* Элемент перемещен в обоих списках на разные места */
+    MOVE_MOVE,
+};
+
+/* @brief Конфликт слияния и версии элемента в каждом из списков */
+struct MergeConflict
+{
+    CONFLICT_TYPE mType;
+    size_t mId;
+    std::optional< Address > mBase;
+    std::optional< Address > mOurs;
+    std::optional< Address > mTheirs;
+};
+
+/* @brief Результат трехстороннего слияния */
+struct MergeResult
+{
+    /*
+     * Объединенный список. Конфликты в нем разрешены так: CHANGE_CHANGE, ADD_ADD и MOVE_MOVE - в пользу ours,
+     * DELETE_CHANGE - измененный элемент остается.
+     */
+    std::vector< Address > mMerged;
+
+    /* Конфликты в порядке ours, затем элементы, которых нет в ours */
+    std::vector< MergeConflict > mConflicts;
+};
+
+namespace merge_detail
+{
+
+/*
+ * @brief Отмечает элементы списка, не перемещенные относительно базового: наибольшую возрастающую
+ * по базовым позициям подпоследовательность общих с базовым элементов. Остальные общие элементы считаются перемещенными.
+ * @param side Измененный список.
+ * @param base_index Идентификатор -> позиция в базовом списке.
+ * @return Признак для каждой позиции side.
+ */
+std::vector< bool > StableElements( const std::vector< Address >& side, const std::unordered_map< size_t, size_t >& base_index )
+{
+    std::vector< size_t > positions;
+    std::vector< size_t > base_positions;
+    positions.reserve( side.size() );
+    base_positions.reserve( side.size() );
+    for( size_t i = 0; i < side.size(); ++i )
+    {
+        auto it = base_index.find( side[ i ].mId );
+        if( it == base_index.end() ) continue;
+        positions.push_back( i );
+        base_positions.push_back( it->second );
+    }
+
+    /* tails[ k ] - индекс последнего элемента самой выгодной подпоследовательности длины k + 1 */
+    std::vector< size_t > tails;
+    std::vector< size_t > previous( base_positions.size(), SIZE_MAX );
+    for( size_t i = 0; i < base_positions.size(); ++i )
+    {
+        auto it = std::lower_bound( tails.begin(), tails.end(), base_positions[ i ],
+            [&]( size_t tail, size_t value ){ return base_positions[ tail ] < value; } );
+        if( it != tails.begin() ) previous[ i ] = *std::prev( it );
+        if( it == tails.end() ) tails.push_back( i );
+        else *it = i;
+    }
+
+    std::vector< bool > stable( side.size(), false );
+    for( size_t i = tails.empty() ? SIZE_MAX : tails.back(); i != SIZE_MAX; i = previous[ i ] )
+    {
+        stable[ positions[ i ] ] = true;
+    }
+    return stable;
+}
+
+std::unordered_map< size_t, size_t > IndexById( const std::vector< Address >& addresses )
+{
+    std::unordered_map< size_t, size_t > index;
+    index.reserve( addresses.size() );
+    for( size_t i = 0; i < addresses.size(); ++i )
+    {
+        index.emplace( addresses[ i ].mId, i );
+    }
+    return index;
+}
+
+}
+
+/*
+ * Членство и значения определяются по индексам идентификаторов за линейный проход по каждому списку.
+ * Порядок: элементы, не перемещенные ни в одном списке, - опоры - идут в базовом порядке. Остальные элементы
+ * ставит тот список, в котором элемент перемещен или добавлен: сразу за ближайшей предшествующей опорой этого списка.
+ * Опоры в обоих списках идут в базовом порядке, поэтому элементы каждого списка уже упорядочены по опорам
+ * и сливаются с ними за один проход: за опорой сначала элементы ours, затем theirs, каждые в порядке своего списка.
+ * Поиск неперемещенных элементов - O(n log n), остальное линейно.
+ */
+MergeResult DifferAddress::Merge( const std::vector< Address >& base, const std::vector< Address >& ours, const std::vector< Address >& theirs )
+{
+    using merge_detail::IndexById;
+
+    MergeResult result;
+    const auto base_index = IndexById( base );
+    const auto ours_index = IndexById( ours );
+    const auto theirs_index = IndexById( theirs );
+    const auto ours_stable = merge_detail::StableElements( ours, base_index );
+    const auto theirs_stable = merge_detail::StableElements( theirs, base_index );
+
+    /* Значение элемента, если его ставит этот список или это опора; nullptr - элемент не ставится */
+    std::vector< const InternedString* > anchor_value( base.size(), nullptr );
+    std::vector< const InternedString* > ours_value( ours.size(), nullptr );
+    std::vector< const InternedString* > theirs_value( theirs.size(), nullptr );
+
+    auto conflict = [&]( CONFLICT_TYPE type, size_t id, const Address* b, const Address* o, const Address* t )
+    {
+        auto optional = []( const Address* elem ){ return elem ? std::optional< Address >( *elem ) : std::nullopt; };
+        result.mConflicts.push_back( { type, id, optional( b ), optional( o ), optional( t ) } );
+    };
+
+    for( size_t i = 0; i < ours.size(); ++i )
+    {
+        const auto& elem = ours[ i ];
+        auto base_it = base_index.find( elem.mId );
+        auto theirs_it = theirs_index.find( elem.mId );
+        const Address* t = theirs_it != theirs_index.end() ? &theirs[ theirs_it->second ] : nullptr;
+
+        if( base_it == base_index.end() )
+        {
+            /* Добавлен в ours, возможно и в theirs */
+            if( t && t->mValue != elem.mValue ) conflict( CONFLICT_TYPE::ADD_ADD, elem.mId, nullptr, &elem, t );
+            ours_value[ i ] = &elem.mValue;
+            continue;
+        }
+
+        const auto& b = base[ base_it->second ];
+        if( !t )
+        {
+            /* Удален в theirs */
+            if( elem.mValue == b.mValue ) continue;
+            conflict( CONFLICT_TYPE::DELETE_CHANGE, elem.mId, &b, &elem, nullptr );
+            ours_value[ i ] = &elem.mValue;
+            continue;
+        }
+
+        const InternedString* value = &elem.mValue;
+        if( elem.mValue == b.mValue ) value = &t->mValue;
+        else if( t->mValue != b.mValue && t->mValue != elem.mValue ) conflict( CONFLICT_TYPE::CHANGE_CHANGE, elem.mId, &b, &elem, t );
+
+        size_t j = theirs_it->second;
+        if( ours_stable[ i ] && theirs_stable[ j ] )
+        {
+            anchor_value[ base_it->second ] = value;
+        }
+        else if( !ours_stable[ i ] )
+        {
+            /* Перемещен в обоих списках: не конфликт, если оба поставили его за один и тот же элемент */
+            if( !theirs_stable[ j ] && ( i == 0 ? j != 0 : j == 0 || ours[ i - 1 ].mId != theirs[ j - 1 ].mId ) )
+            {
+                conflict( CONFLICT_TYPE::MOVE_MOVE, elem.mId, &b, &elem, t );
+            }
+            ours_value[ i ] = value;
+        }
+        else
+        {
+            theirs_value[ j ] = value;
+        }
+    }
+
+    /* Элементы, которых нет в ours: добавлены в theirs или удалены в ours */
+    for( size_t j = 0; j < theirs.size(); ++j )
+    {
+        const auto& elem = theirs[ j ];
+        if( ours_index.count( elem.mId ) != 0 ) continue;
+
+        auto base_it = base_index.find( elem.mId );
+        if( base_it == base_index.end() )
+        {
+            theirs_value[ j ] = &elem.mValue;
+            continue;
+        }
+        const auto& b = base[ base_it->second ];
+        if( elem.mValue == b.mValue ) continue;
+        conflict( CONFLICT_TYPE::DELETE_CHANGE, elem.mId, &b, nullptr, &elem );
+        theirs_value[ j ] = &elem.mValue;
+    }
+
+    /* Номер опоры, за которой стоит каждый элемент, ставящийся списком; 0 - перед первой опорой */
+    std::vector< size_t > anchor_order( base.size(), 0 );
+    std::vector< size_t > anchors;
+    for( size_t k = 0; k < base.size(); ++k )
+    {
+        if( !anchor_value[ k ] ) continue;
+        anchors.push_back( k );
+        anchor_order[ k ] = anchors.size();
+    }
+    auto placed = [&]( const std::vector< Address >& side, const std::vector< const InternedString* >& values )
+    {
+        std::vector< std::pair< size_t, size_t > > slots;
+        size_t slot = 0;
+        for( size_t i = 0; i < side.size(); ++i )
+        {
+            if( values[ i ] )
+            {
+                slots.emplace_back( slot, i );
+                continue;
+            }
+            auto it = base_index.find( side[ i ].mId );
+            if( it != base_index.end() && anchor_value[ it->second ] ) slot = anchor_order[ it->second ];
+        }
+        return slots;
+    };
+    const auto ours_slots = placed( ours, ours_value );
+    const auto theirs_slots = placed( theirs, theirs_value );
+
+    auto& merged = result.mMerged;
+    merged.reserve( anchors.size() + ours_slots.size() + theirs_slots.size() );
+    auto emit = [&]( const Address& elem, const InternedString& value )
+    {
+        merged.push_back( { value, elem.mId, merged.size() } );
+    };
+    size_t o = 0;
+    size_t t = 0;
+    for( size_t slot = 0; slot <= anchors.size(); ++slot )
+    {
+        for( ; o < ours_slots.size() && ours_slots[ o ].first == slot; ++o )
+        {
+            emit( ours[ ours_slots[ o ].second ], *ours_value[ ours_slots[ o ].second ] );
+        }
+        for( ; t < theirs_slots.size() && theirs_slots[ t ].first == slot; ++t )
+        {
+            emit( theirs[ theirs_slots[ t ].second ], *theirs_value[ theirs_slots[ t ].second ] );
+        }
+        if( slot < anchors.size() ) emit( base[ anchors[ slot ] ], *anchor_value[ anchors[ slot ] ] );
+    }
+    return result;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <numeric>
+#include <unordered_map>
+#include <algorithm>
+#include "address_differ.h"
+
+/*
+ * @brief Выполняет fn( begin, end ) для отрезков диапазона [ first, last ) в нескольких потоках.
+ * Потоки разбирают отрезки из общего счетчика, поэтому быстрый поток забирает работу у медленного.
+ * @param first Начало диапазона.
+ * @param last Конец диапазона.
+ * @param threads Количество потоков.
+ * @param fn Функция обработки отрезка.
+ */
+template< typename Fn >
+void ParallelFor( size_t first, size_t last, size_t threads, Fn fn )
+{
+    if( first >= last ) return;
+    threads = std::max< size_t >( 1, std::min( threads, ( last - first + 1023 ) / 1024 ) );
+    if( threads == 1 )
+    {
+        fn( first, last );
+        return;
+    }
+
+    /* Отрезков больше, чем потоков, чтобы было что забирать у отстающих */
+    const size_t grain = std::max< size_t >( 1024, ( last - first ) / ( threads * 8 ) );
+    std::atomic< size_t > next{ first };
+    auto worker = [&]()
+    {
+        for( size_t begin = next.fetch_add( grain ); begin < last; begin = next.fetch_add( grain ) )
+        {
+            fn( begin, std::min( begin + grain, last ) );
+        }
+    };
+
+    std::vector< std::thread > workers;
+    for( size_t i = 1; i < threads; ++i ) workers.emplace_back( worker );
+    worker();
+    for( auto& thread : workers ) thread.join();
+}
+
+/*
+ * @brief Параллельное выполнение редакционного предписания.
+ * Результат совпадает с DifferAddress::DoEditorialPrescription.
+ * Удаления и изменения находят свои элементы через индекс идентификаторов предписания и размечаются параллельно,
+ * затем добавления, удаления и изменения выполняются одним параллельным проходом уплотнения,
+ * а перемещения переигрываются на массиве индексов и применяются одной перестановкой.
+ */
+class ParallelPrescription
+{
+public:
+
+    /*
+     * @param threads Количество потоков.
+     */
+    explicit ParallelPrescription( size_t threads = std::max( 1u, std::thread::hardware_concurrency() ) )
+        : mThreads( threads ) {}
+
+    /*
+     * @brief Выполняет редакционное предписание для массива адресов.
+     * @param compare_result Редакционное предписание.
+     * @param old_adresses Начальный массив адресов.
+     * @return Новый массив адресов.
+     */
+    std::vector< Address > Apply( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses );
+
+private:
+
+    /* Элемент, на который ссылаются удаления и изменения предписания */
+    struct Target
+    {
+        /* Индекс элемента в старом списке. npos - не найден */
+        std::atomic< size_t > mIndex{ npos };
+
+        /* Количество элементов списка с этим идентификатором */
+        std::atomic< size_t > mCount{ 0 };
+
+        /* Элемент удаляется */
+        bool mDeleted = false;
+
+        /* Последнее изменение элемента */
+        const InternedString* mNewValue = nullptr;
+    };
+
+    static constexpr size_t npos = static_cast< size_t >( -1 );
+
+    size_t mThreads;
+};
+
+std::vector< Address > ParallelPrescription::Apply( const CompareResult< Address >& compare_result, const std::vector< Address >& old_adresses )
+{
+    const auto& added = compare_result.mAddedOperations;
+    const size_t old_size = old_adresses.size();
+    const size_t layout_size = old_size + added.size();
+
+    /*
+     * Добавления на строго возрастающие позиции не сдвигают друг друга: каждый добавленный элемент остается на своей позиции,
+     * а старые элементы заполняют оставшиеся места по порядку. Иначе, а также для предписаний, которые последовательное
+     * выполнение не примет, используем последовательный алгоритм.
+     */
+    auto serial = [&]() { return DifferAddress( false ).DoEditorialPrescription( compare_result, old_adresses ); };
+    for( size_t i = 0; i < added.size(); ++i )
+    {
+        if( added[ i ].mPositionStart > old_size + i || ( i > 0 && added[ i ].mPositionStart <= added[ i - 1 ].mPositionStart ) ) return serial();
+    }
+
+    /* Индекс идентификаторов, на которые ссылаются удаления и изменения */
+    std::unordered_map< size_t, size_t > target_index;
+    target_index.reserve( compare_result.mDeletedOperations.size() + compare_result.mChandedOperations.size() );
+    std::vector< Target > targets( compare_result.mDeletedOperations.size() + compare_result.mChandedOperations.size() );
+    size_t targets_count = 0;
+    auto get_target = [&]( size_t id ) -> Target&
+    {
+        auto it = target_index.emplace( id, targets_count ).first;
+        if( it->second == targets_count ) ++targets_count;
+        return targets[ it->second ];
+    };
+    for( const auto& elem : compare_result.mDeletedOperations )
+    {
+        auto& target = get_target( elem.mValue.mId );
+        if( target.mDeleted ) return serial();
+        target.mDeleted = true;
+    }
+    for( const auto& elem : compare_result.mChandedOperations )
+    {
+        if( !elem.mNewValue ) return serial();
+        auto& target = get_target( elem.mValue.mId );
+        if( target.mDeleted ) return serial();
+        target.mNewValue = &elem.mNewValue->mValue;
+    }
+    for( const auto& elem : added )
+    {
+        if( target_index.count( elem.mValue.mId ) ) return serial();
+    }
+
+    /* Параллельно находим элементы старого списка, на которые ссылается предписание */
+    ParallelFor( 0, old_size, mThreads, [&]( size_t begin, size_t end )
+    {
+        for( size_t i = begin; i < end; ++i )
+        {
+            auto it = target_index.find( old_adresses[ i ].mId );
+            if( it == target_index.end() ) continue;
+            auto& target = targets[ it->second ];
+            target.mCount.fetch_add( 1, std::memory_order_relaxed );
+            target.mIndex.store( i, std::memory_order_relaxed );
+        }
+    } );
+
+    /* Разметка старых элементов: удален ли элемент и его новое значение */
+    std::vector< uint8_t > deleted( old_size, 0 );
+    std::vector< const InternedString* > new_values( old_size, nullptr );
+    for( size_t t = 0; t < targets_count; ++t )
+    {
+        /* Элемент не найден или идентификатор не уникален - последовательный алгоритм разберется с этим так же, как раньше */
+        if( targets[ t ].mCount.load() != 1 ) return serial();
+        auto index = targets[ t ].mIndex.load();
+        deleted[ index ] = targets[ t ].mDeleted;
+        new_values[ index ] = targets[ t ].mNewValue;
+    }
+
+    /* Позиции добавленных элементов в списке после добавлений */
+    std::vector< size_t > added_slots;
+    added_slots.reserve( added.size() );
+    for( const auto& elem : added ) added_slots.push_back( elem.mPositionStart );
+
+    /* Уплотнение: считаем оставшиеся элементы в каждом отрезке, затем раскладываем их по своим местам */
+    const size_t chunk = std::max< size_t >( 4096, layout_size / ( mThreads * 8 ) + 1 );
+    const size_t chunks = ( layout_size + chunk - 1 ) / chunk;
+    auto for_each_in_layout = [&]( size_t begin, size_t end, auto fn )
+    {
+        size_t add = std::lower_bound( added_slots.begin(), added_slots.end(), begin ) - added_slots.begin();
+        size_t old_index = begin - add;
+        for( size_t pos = begin; pos < end; ++pos )
+        {
+            if( add < added_slots.size() && added_slots[ add ] == pos ) fn( &added[ add++ ].mValue, nullptr );
+            else
+            {
+                if( !deleted[ old_index ] ) fn( &old_adresses[ old_index ], new_values[ old_index ] );
+                ++old_index;
+            }
+        }
+    };
+
+    std::vector< size_t > offsets( chunks + 1, 0 );
+    ParallelFor( 0, chunks, mThreads, [&]( size_t begin, size_t end )
+    {
+        for( size_t c = begin; c < end; ++c )
+        {
+            size_t count = 0;
+            for_each_in_layout( c * chunk, std::min( layout_size, ( c + 1 ) * chunk ), [&count]( const Address*, const InternedString* ) { ++count; } );
+            offsets[ c + 1 ] = count;
+        }
+    } );
+    std::partial_sum( offsets.begin(), offsets.end(), offsets.begin() );
+
+    std::vector< Address > compacted( offsets.back() );
+    ParallelFor( 0, chunks, mThreads, [&]( size_t begin, size_t end )
+    {
+        for( size_t c = begin; c < end; ++c )
+        {
+            size_t out = offsets[ c ];
+            for_each_in_layout( c * chunk, std::min( layout_size, ( c + 1 ) * chunk ), [&]( const Address* address, const InternedString* new_value )
+            {
+                auto& target = compacted[ out ];
+                target.mId = address->mId;
+                target.mValue = new_value ? *new_value : address->mValue;
+                target.mPosition = out++;
+            } );
+        }
+    } );
+
+    if( compare_result.mMovedOperations.empty() && compare_result.mPermutation.empty() ) return compacted;
+
+    /* Перемещения зависят друг от друга, поэтому переигрываются последовательно, но на массиве индексов, а не на адресах */
+    std::vector< size_t > order = DifferAddress::MovesToPermutation( compare_result.mMovedOperations );
+    assert( order.size() <= compacted.size() );
+    for( size_t i = order.size(); i < compacted.size(); ++i ) order.push_back( i );
+
+    /* Перестановка предписания выполняется после перемещений */
+    if( const auto& permutation = compare_result.mPermutation; !permutation.empty() )
+    {
+        assert( permutation.size() <= order.size() );
+        std::vector< size_t > combined( order );
+        for( size_t i = 0; i < permutation.size(); ++i ) combined[ i ] = order[ permutation[ i ] ];
+        order = std::move( combined );
+    }
+
+    std::vector< Address > result( compacted.size() );
+    ParallelFor( 0, result.size(), mThreads, [&]( size_t begin, size_t end )
+    {
+        for( size_t i = begin; i < end; ++i )
+        {
+            result[ i ] = std::move( compacted[ order[ i ] ] );
+            result[ i ].mPosition = i;
+        }
+    } );
+    return result;
+}
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "address_differ.h"
+
+/*
+ * @brief Двоичное кодирование редакционных предписаний и полных списков адресов.
+ * Числа кодируются как varint, строки - длиной и байтами. Порядок байт не зависит от платформы.
+ * Если перемещений много и перестановка короче, перемещения кодируются одной перестановкой
+ * с разностями соседних индексов - ее применение выполняется за один проход.
+ */
+class PatchCodec
+{
+public:
+
+    /* Признаки формата */
+    static constexpr char PATCH_MAGIC = 'P';
+    static constexpr char PERMUTATION_PATCH_MAGIC = 'R';
+    static constexpr char SNAPSHOT_MAGIC = 'S';
+
+    /*
+     * @brief Кодирует редакционное предписание и дописывает его в конец буфера.
+     * @param compare_result Редакционное предписание.
+     * @param out Выходной буфер.
+     */
+    static void EncodePatch( const CompareResult< Address >& compare_result, std::string& out );
+
+    /*
+     * @brief Размер закодированного редакционного предписания в байтах.
+     * @param compare_result Редакционное предписание.
+     */
+    static size_t EncodedSize( const CompareResult< Address >& compare_result );
+
+    /*
+     * @brief Определяет, будут ли перемещения закодированы перестановкой.
+     * @param compare_result Редакционное предписание.
+     * @param permutation Перестановка, заменяющая перемещения и перестановку предписания.
+     * @return true - предписание кодируется перестановкой.
+     */
+    static bool PermutationFor( const CompareResult< Address >& compare_result, std::vector< size_t >& permutation );
+
+    /*
+     * @brief Декодирует редакционное предписание.
+     * @param data Закодированные данные.
+     * @param compare_result Результат декодирования.
+     * @return false - данные повреждены.
+     */
+    static bool DecodePatch( std::string_view data, CompareResult< Address >& compare_result );
+
+    /*
+     * @brief Кодирует список адресов и дописывает его в конец буфера.
+     * @param addresses Список адресов.
+     * @param out Выходной буфер.
+     */
+    static void EncodeSnapshot( const std::vector< Address >& addresses, std::string& out );
+
+    /*
+     * @brief Декодирует список адресов.
+     * @param data Закодированные данные.
+     * @param addresses Результат декодирования.
+     * @return false - данные повреждены.
+     */
+    static bool DecodeSnapshot( std::string_view data, std::vector< Address >& addresses );
+
+    /*
+     * @brief Размер закодированной операции в байтах.
+     * @param operation Операция.
+     */
+    static size_t EncodedSize( const OperationData< Address >& operation );
+
+    /*
+     * @brief Размер закодированного адреса в байтах.
+     * @param address Адрес.
+     */
+    static size_t EncodedSize( const Address& address );
+
+    /*
+     * @brief Размер закодированной перестановки в байтах.
+     * @param permutation Перестановка.
+     */
+    static size_t EncodedSize( const std::vector< size_t >& permutation );
+
+    /* @brief Размер varint в байтах */
+    static size_t VarintSize( uint64_t value );
+
+    static void PutVarint( std::string& out, uint64_t value );
+    static bool GetVarint( std::string_view& data, uint64_t& value );
+
+    static void PutAddress( std::string& out, const Address& address );
+    static bool GetAddress( std::string_view& data, Address& address );
+
+    /* @brief Кодирует одну операцию. Для потоковой записи предписания: перед операциями раздела пишется их количество */
+    static void PutOperation( std::string& out, const OperationData< Address >& operation );
+
+    /* @brief Разность соседних индексов перестановки со знаком в varint */
+    static uint64_t ZigZag( size_t current, size_t previous );
+
+private:
+
+    /* Флаги необязательных полей операции */
+    static constexpr uint8_t HAS_NEW_VALUE = 1;
+    static constexpr uint8_t HAS_POSITION_END = 2;
+
+    /* Минимальное количество перемещений, при котором рассматривается перестановка */
+    static constexpr size_t PERMUTATION_MIN_MOVES = 8;
+
+    static void PutOperations( std::string& out, const std::vector< OperationData< Address > >& operations );
+    static bool GetOperations( std::string_view& data, OPERATION_TYPE type, std::vector< OperationData< Address > >& operations );
+    static void PutPermutation( std::string& out, const std::vector< size_t >& permutation );
+    static bool GetPermutation( std::string_view& data, std::vector< size_t >& permutation );
+};
+
+size_t PatchCodec::VarintSize( uint64_t value )
+{
+    size_t size = 1;
+    while( value >= 0x80 )
+    {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+size_t PatchCodec::EncodedSize( const Address& address )
+{
+    const auto& value = address.mValue.Str();
+    return VarintSize( address.mId ) + VarintSize( address.mPosition ) + VarintSize( value.size() ) + value.size();
+}
+
+size_t PatchCodec::EncodedSize( const OperationData< Address >& operation )
+{
+    size_t size = 1 + EncodedSize( operation.mValue ) + VarintSize( operation.mPositionStart );
+    if( operation.mNewValue ) size += EncodedSize( *operation.mNewValue );
+    if( operation.mPositionEnd ) size += VarintSize( *operation.mPositionEnd );
+    return size;
+}
+
+size_t PatchCodec::EncodedSize( const std::vector< size_t >& permutation )
+{
+    size_t size = VarintSize( permutation.size() );
+    size_t previous = 0;
+    for( auto index : permutation )
+    {
+        size += VarintSize( ZigZag( index, previous ) );
+        previous = index;
+    }
+    return size;
+}
+
+size_t PatchCodec::EncodedSize( const CompareResult< Address >& compare_result )
+{
+    std::vector< size_t > permutation;
+    bool reorder = PermutationFor( compare_result, permutation );
+
+    size_t size = 1;
+    for( const auto* operations : { &compare_result.mAddedOperations, &compare_result.mDeletedOperations, &compare_result.mChandedOperations, &compare_result.mMovedOperations } )
+    {
+        if( reorder && operations == &compare_result.mMovedOperations )
+        {
+            size += VarintSize( 0 ) + EncodedSize( permutation );
+            break;
+        }
+        size += VarintSize( operations->size() );
+        for( const auto& elem : *operations ) size += EncodedSize( elem );
+    }
+    return size;
+}
+
+bool PatchCodec::PermutationFor( const CompareResult< Address >& compare_result, std::vector< size_t >& permutation )
+{
+    const auto& moves = compare_result.mMovedOperations;
+    if( moves.size() < PERMUTATION_MIN_MOVES && compare_result.mPermutation.empty() ) return false;
+
+    /* Перестановка предписания выполняется после перемещений: итоговая берет элементы через обе */
+    permutation = DifferAddress::MovesToPermutation( moves );
+    if( !compare_result.mPermutation.empty() )
+    {
+        const auto& after = compare_result.mPermutation;
+        for( size_t i = permutation.size(); i < after.size(); ++i ) permutation.push_back( i );
+        std::vector< size_t > combined( std::max( permutation.size(), after.size() ) );
+        for( size_t i = 0; i < combined.size(); ++i )
+        {
+            combined[ i ] = permutation[ i < after.size() ? after[ i ] : i ];
+        }
+        permutation = std::move( combined );
+        return true;
+    }
+
+    size_t moves_size = 0;
+    for( const auto& elem : moves ) moves_size += EncodedSize( elem );
+    return EncodedSize( permutation ) < moves_size;
+}
+
+uint64_t PatchCodec::ZigZag( size_t current, size_t previous )
+{
+    auto delta = static_cast< int64_t >( current - previous );
+    return ( static_cast< uint64_t >( delta ) << 1 ) ^ static_cast< uint64_t >( delta >> 63 );
+}
+
+void PatchCodec::PutVarint( std::string& out, uint64_t value )
+{
+    while( value >= 0x80 )
+    {
+        out.push_back( static_cast< char >( ( value & 0x7F ) | 0x80 ) );
+        value >>= 7;
+    }
+    out.push_back( static_cast< char >( value ) );
+}
+
+bool PatchCodec::GetVarint( std::string_view& data, uint64_t& value )
+{
+    value = 0;
+    for( size_t i = 0, shift = 0; i < data.size() && shift < 64; ++i, shift += 7 )
+    {
+        auto byte = static_cast< uint8_t >( data[ i ] );
+        value |= static_cast< uint64_t >( byte & 0x7F ) << shift;
+        if( ( byte & 0x80 ) == 0 )
+        {
+            data.remove_prefix( i + 1 );
+            return true;
+        }
+    }
+    return false;
+}
+
+void PatchCodec::PutAddress( std::string& out, const Address& address )
+{
+    PutVarint( out, address.mId );
+    PutVarint( out, address.mPosition );
+    const auto& value = address.mValue.Str();
+    PutVarint( out, value.size() );
+    out.append( value );
+}
+
+bool PatchCodec::GetAddress( std::string_view& data, Address& address )
+{
+    uint64_t id, position, size;
+    if( !GetVarint( data, id ) || !GetVarint( data, position ) || !GetVarint( data, size ) || size > data.size() ) return false;
+    address.mId = id;
+    address.mPosition = position;
+    address.mValue = InternedString( data.substr( 0, size ) );
+    data.remove_prefix( size );
+    return true;
+}
+
+void PatchCodec::PutOperations( std::string& out, const std::vector< OperationData< Address > >& operations )
+{
+    PutVarint( out, operations.size() );
+    for( const auto& operation : operations )
+    {
+        PutOperation( out, operation );
+    }
+}
+
+void PatchCodec::PutOperation( std::string& out, const OperationData< Address >& operation )
+{
+    uint8_t flags = ( operation.mNewValue ? HAS_NEW_VALUE : 0 ) | ( operation.mPositionEnd ? HAS_POSITION_END : 0 );
+    out.push_back( static_cast< char >( flags ) );
+    PutAddress( out, operation.mValue );
+    if( operation.mNewValue ) PutAddress( out, *operation.mNewValue );
+    PutVarint( out, operation.mPositionStart );
+    if( operation.mPositionEnd ) PutVarint( out, *operation.mPositionEnd );
+}
+
+bool PatchCodec::GetOperations( std::string_view& data, OPERATION_TYPE type, std::vector< OperationData< Address > >& operations )
+{
+    uint64_t count;
+    if( !GetVarint( data, count ) || count > data.size() ) return false;
+    operations.clear();
+    operations.reserve( count );
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        if( data.empty() ) return false;
+        auto flags = static_cast< uint8_t >( data.front() );
+        data.remove_prefix( 1 );
+
+        OperationData< Address > operation{ type, {}, std::nullopt, 0, std::nullopt };
+        if( !GetAddress( data, operation.mValue ) ) return false;
+        if( flags & HAS_NEW_VALUE )
+        {
+            operation.mNewValue.emplace();
+            if( !GetAddress( data, *operation.mNewValue ) ) return false;
+        }
+        uint64_t position;
+        if( !GetVarint( data, position ) ) return false;
+        operation.mPositionStart = position;
+        if( flags & HAS_POSITION_END )
+        {
+            if( !GetVarint( data, position ) ) return false;
+            operation.mPositionEnd = position;
+        }
+        operations.push_back( std::move( operation ) );
+    }
+    return true;
+}
+
+void PatchCodec::PutPermutation( std::string& out, const std::vector< size_t >& permutation )
+{
+    PutVarint( out, permutation.size() );
+    size_t previous = 0;
+    for( auto index : permutation )
+    {
+        PutVarint( out, ZigZag( index, previous ) );
+        previous = index;
+    }
+}
+
+bool PatchCodec::GetPermutation( std::string_view& data, std::vector< size_t >& permutation )
+{
+    uint64_t count;
+    if( !GetVarint( data, count ) || count > data.size() ) return false;
+    permutation.clear();
+    permutation.reserve( count );
+
+    /* Каждый индекс должен встретиться ровно один раз */
+    std::vector< bool > seen( count, false );
+    uint64_t previous = 0;
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        uint64_t value;
+        if( !GetVarint( data, value ) ) return false;
+        uint64_t index = previous + ( ( value >> 1 ) ^ ( ~( value & 1 ) + 1 ) );
+        if( index >= count || seen[ index ] ) return false;
+        seen[ index ] = true;
+        permutation.push_back( index );
+        previous = index;
+    }
+    return true;
+}
+
+void PatchCodec::EncodePatch( const CompareResult< Address >& compare_result, std::string& out )
+{
+    std::vector< size_t > permutation;
+    bool reorder = PermutationFor( compare_result, permutation );
+
+    out.push_back( reorder ? PERMUTATION_PATCH_MAGIC : PATCH_MAGIC );
+    PutOperations( out, compare_result.mAddedOperations );
+    PutOperations( out, compare_result.mDeletedOperations );
+    PutOperations( out, compare_result.mChandedOperations );
+    if( reorder )
+    {
+        PutVarint( out, 0 );
+        PutPermutation( out, permutation );
+    }
+    else
+    {
+        PutOperations( out, compare_result.mMovedOperations );
+    }
+}
+
+bool PatchCodec::DecodePatch( std::string_view data, CompareResult< Address >& compare_result )
+{
+    if( data.empty() || ( data.front() != PATCH_MAGIC && data.front() != PERMUTATION_PATCH_MAGIC ) ) return false;
+    bool reorder = data.front() == PERMUTATION_PATCH_MAGIC;
+    data.remove_prefix( 1 );
+    compare_result.mPermutation.clear();
+    return GetOperations( data, OPERATION_TYPE::ADDED, compare_result.mAddedOperations ) &&
+           GetOperations( data, OPERATION_TYPE::DELETED, compare_result.mDeletedOperations ) &&
+           GetOperations( data, OPERATION_TYPE::CHANGED, compare_result.mChandedOperations ) &&
+           GetOperations( data, OPERATION_TYPE::MOVED, compare_result.mMovedOperations ) &&
+           ( !reorder || GetPermutation( data, compare_result.mPermutation ) ) &&
+           data.empty();
+}
+
+void PatchCodec::EncodeSnapshot( const std::vector< Address >& addresses, std::string& out )
+{
+    out.push_back( SNAPSHOT_MAGIC );
+    PutVarint( out, addresses.size() );
+    for( const auto& address : addresses )
+    {
+        PutAddress( out, address );
+    }
+}
+
+bool PatchCodec::DecodeSnapshot( std::string_view data, std::vector< Address >& addresses )
+{
+    if( data.empty() || data.front() != SNAPSHOT_MAGIC ) return false;
+    data.remove_prefix( 1 );
+
+    uint64_t count;
+    if( !GetVarint( data, count ) || count > data.size() ) return false;
+    addresses.clear();
+    addresses.reserve( count );
+    for( uint64_t i = 0; i < count; ++i )
+    {
+        Address address{};
+        if( !GetAddress( data, address ) ) return false;
+        addresses.push_back( std::move( address ) );
+    }
+    return data.empty();
+}
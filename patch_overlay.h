@@ -0,0 +1,309 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include "address_differ.h"
+
+/*
+ * @brief Новая версия списка, заданная базовым снимком и предписанием, без применения предписания.
+ * Добавления и удаления хранятся отсортированными местами, изменения - по идентификатору. Перемещения переигрываются
+ * на декартовом дереве по неявному ключу, вершины которого - отрезки списка после удалений: каждое перемещение разрезает
+ * не больше трех отрезков. Элемент по позиции находится за O(log k), m подряд идущих элементов - за O(log k + m),
+ * где k - размер предписания. Базовый снимок не копируется.
+ * @warning Базовый снимок должен жить дольше наложения. Идентификаторы уникальны, позиции базового снимка - 0..n-1 по порядку.
+ */
+class PatchOverlay
+{
+public:
+
+    /*
+     * @details std::invalid_argument - удаляемого элемента нет в базовом снимке,
+     * std::out_of_range - позиция операции за пределами списка.
+     * @param base Базовый снимок.
+     * @param patch Редакционное предписание к базовому снимку.
+     */
+    PatchOverlay( const std::vector< Address >& base, const CompareResult< Address >& patch );
+
+    /* @brief Размер новой версии */
+    size_t Size() const { return mSize; }
+
+    /*
+     * @brief Элемент новой версии.
+     * @details std::out_of_range - позиция за пределами списка.
+     * @param position Позиция в новой версии.
+     */
+    Address At( size_t position ) const;
+
+    /*
+     * @brief Отрезок новой версии [first, last).
+     * @details std::out_of_range - отрезок за пределами списка.
+     * @param first Первая позиция.
+     * @param last Позиция за последней.
+     */
+    std::vector< Address > Range( size_t first, size_t last ) const;
+
+private:
+
+    static constexpr size_t NIL = static_cast< size_t >( -1 );
+
+    /* Отрезок списка после удалений */
+    struct Piece
+    {
+        /* Первая позиция отрезка в списке после удалений */
+        size_t mFirst;
+        size_t mLength;
+
+        /* Суммарная длина отрезков поддерева */
+        size_t mSize;
+        uint64_t mPriority;
+        size_t mLeft = NIL;
+        size_t mRight = NIL;
+    };
+
+    size_t NewPiece( size_t first, size_t length );
+    size_t SubtreeSize( size_t node ) const { return node == NIL ? 0 : mPieces[ node ].mSize; }
+    void Update( size_t node );
+
+    /* Отделяет первые count элементов дерева node; отрезок на границе разрезается */
+    void Split( size_t node, size_t count, size_t& left, size_t& right );
+    size_t Merge( size_t left, size_t right );
+
+    /* Переставляет элемент с позиции from на позицию to, как перемещение в DoEditorialPrescription */
+    void Move( size_t from, size_t to );
+
+    /* Позиция в списке после удалений для позиции после перемещений */
+    size_t Locate( size_t position ) const;
+
+    /* Дописывает в out count элементов списка после удалений, начиная с edited; position - позиция первого в новой версии */
+    void Emit( size_t edited, size_t count, size_t position, std::vector< Address >& out ) const;
+
+    /* Отрезки поддерева node, пересекающие позиции [from, to); offset - позиция начала поддерева */
+    void Collect( size_t node, size_t offset, size_t from, size_t to, std::vector< Address >& out ) const;
+
+    const std::vector< Address >& mBase;
+
+    /* Добавленные элементы и их места в списке после вставок, по возрастанию мест */
+    std::vector< Address > mAdded;
+    std::vector< size_t > mAddedSlots;
+
+    /* Места удаленных элементов в списке после вставок, по возрастанию */
+    std::vector< size_t > mDeletedSlots;
+
+    /* Новые значения измененных элементов */
+    std::unordered_map< size_t, InternedString > mChanges;
+
+    /* Перестановка предписания, выполняемая после перемещений */
+    std::vector< size_t > mPermutation;
+
+    std::vector< Piece > mPieces;
+    size_t mRoot = NIL;
+    size_t mSize = 0;
+    std::mt19937_64 mRandom{ 0x9E3779B97F4A7C15ULL };
+};
+
+PatchOverlay::PatchOverlay( const std::vector< Address >& base, const CompareResult< Address >& patch )
+    : mBase( base ), mPermutation( patch.mPermutation )
+{
+    const auto& added = patch.mAddedOperations;
+    for( size_t k = 0; k < added.size(); ++k )
+    {
+        if( added[ k ].mPositionStart > base.size() + k ) throw std::out_of_range( "add position " + std::to_string( added[ k ].mPositionStart ) + " is out of range" );
+    }
+    auto slots = DifferAddress::AddedSlots( added );
+    std::vector< size_t > order( added.size() );
+    std::iota( order.begin(), order.end(), 0 );
+    std::sort( order.begin(), order.end(), [&]( size_t a, size_t b ){ return slots[ a ] < slots[ b ]; } );
+    for( auto k : order )
+    {
+        mAdded.push_back( added[ k ].mValue );
+        mAddedSlots.push_back( slots[ k ] );
+    }
+
+    /* Удаленный элемент ищется по своей позиции в операции; если там другой, индекс идентификаторов строится один раз */
+    std::unordered_map< size_t, size_t > base_index;
+    for( const auto& elem : patch.mDeletedOperations )
+    {
+        size_t index = elem.mPositionStart;
+        if( index >= base.size() || base[ index ].mId != elem.mValue.mId )
+        {
+            if( base_index.empty() )
+            {
+                base_index.reserve( base.size() );
+                for( size_t i = 0; i < base.size(); ++i ) base_index.emplace( base[ i ].mId, i );
+            }
+            auto it = base_index.find( elem.mValue.mId );
+            if( it == base_index.end() ) throw std::invalid_argument( "deleted id " + std::to_string( elem.mValue.mId ) + " is not in the base snapshot" );
+            index = it->second;
+        }
+        mDeletedSlots.push_back( DifferAddress::SkipSlots( mAddedSlots, index ) );
+    }
+    std::sort( mDeletedSlots.begin(), mDeletedSlots.end() );
+    if( std::adjacent_find( mDeletedSlots.begin(), mDeletedSlots.end() ) != mDeletedSlots.end() ) throw std::invalid_argument( "an element is deleted twice" );
+
+    for( const auto& elem : patch.mChandedOperations ) mChanges[ elem.mValue.mId ] = elem.mNewValue->mValue;
+
+    mSize = base.size() + mAdded.size() - mDeletedSlots.size();
+    if( mSize != 0 ) mRoot = NewPiece( 0, mSize );
+    for( const auto& elem : patch.mMovedOperations )
+    {
+        if( !elem.mPositionEnd || elem.mPositionStart >= mSize || *elem.mPositionEnd >= mSize ) throw std::out_of_range( "move is out of range" );
+        Move( elem.mPositionStart, *elem.mPositionEnd );
+    }
+    if( mPermutation.size() > mSize ) throw std::out_of_range( "permutation is longer than the list" );
+}
+
+size_t PatchOverlay::NewPiece( size_t first, size_t length )
+{
+    mPieces.push_back( { first, length, length, mRandom() } );
+    return mPieces.size() - 1;
+}
+
+void PatchOverlay::Update( size_t node )
+{
+    auto& piece = mPieces[ node ];
+    piece.mSize = SubtreeSize( piece.mLeft ) + piece.mLength + SubtreeSize( piece.mRight );
+}
+
+void PatchOverlay::Split( size_t node, size_t count, size_t& left, size_t& right )
+{
+    if( node == NIL )
+    {
+        left = right = NIL;
+        return;
+    }
+    size_t left_size = SubtreeSize( mPieces[ node ].mLeft );
+    size_t length = mPieces[ node ].mLength;
+    if( count <= left_size )
+    {
+        size_t inner_right;
+        Split( mPieces[ node ].mLeft, count, left, inner_right );
+        mPieces[ node ].mLeft = inner_right;
+        Update( node );
+        right = node;
+    }
+    else if( count >= left_size + length )
+    {
+        size_t inner_left;
+        Split( mPieces[ node ].mRight, count - left_size - length, inner_left, right );
+        mPieces[ node ].mRight = inner_left;
+        Update( node );
+        left = node;
+    }
+    else
+    {
+        /* Граница внутри отрезка: хвост становится новой вершиной. NewPiece может переместить mPieces - ссылки не держим */
+        size_t offset = count - left_size;
+        size_t tail = NewPiece( mPieces[ node ].mFirst + offset, length - offset );
+        size_t old_right = mPieces[ node ].mRight;
+        mPieces[ node ].mLength = offset;
+        mPieces[ node ].mRight = NIL;
+        Update( node );
+        left = node;
+        right = Merge( tail, old_right );
+    }
+}
+
+size_t PatchOverlay::Merge( size_t left, size_t right )
+{
+    if( left == NIL ) return right;
+    if( right == NIL ) return left;
+    if( mPieces[ left ].mPriority > mPieces[ right ].mPriority )
+    {
+        mPieces[ left ].mRight = Merge( mPieces[ left ].mRight, right );
+        Update( left );
+        return left;
+    }
+    mPieces[ right ].mLeft = Merge( left, mPieces[ right ].mLeft );
+    Update( right );
+    return right;
+}
+
+void PatchOverlay::Move( size_t from, size_t to )
+{
+    if( from == to ) return;
+    size_t before, rest, moved, after;
+    Split( mRoot, from, before, rest );
+    Split( rest, 1, moved, after );
+    mRoot = Merge( before, after );
+    Split( mRoot, to, before, after );
+    mRoot = Merge( Merge( before, moved ), after );
+}
+
+size_t PatchOverlay::Locate( size_t position ) const
+{
+    if( position < mPermutation.size() ) position = mPermutation[ position ];
+    size_t node = mRoot;
+    while( true )
+    {
+        const auto& piece = mPieces[ node ];
+        size_t left_size = SubtreeSize( piece.mLeft );
+        if( position < left_size )
+        {
+            node = piece.mLeft;
+            continue;
+        }
+        position -= left_size;
+        if( position < piece.mLength ) return piece.mFirst + position;
+        position -= piece.mLength;
+        node = piece.mRight;
+    }
+}
+
+void PatchOverlay::Emit( size_t edited, size_t count, size_t position, std::vector< Address >& out ) const
+{
+    /* Позиция в списке после вставок; дальше удаленные места пропускаются, а вставки отсчитываются курсорами */
+    size_t slot = DifferAddress::SkipSlots( mDeletedSlots, edited );
+    size_t deleted = std::lower_bound( mDeletedSlots.begin(), mDeletedSlots.end(), slot ) - mDeletedSlots.begin();
+    size_t added = std::lower_bound( mAddedSlots.begin(), mAddedSlots.end(), slot ) - mAddedSlots.begin();
+    for( size_t i = 0; i < count; ++i, ++slot )
+    {
+        while( deleted < mDeletedSlots.size() && mDeletedSlots[ deleted ] == slot ) ++deleted, ++slot;
+        while( added < mAddedSlots.size() && mAddedSlots[ added ] < slot ) ++added;
+        bool is_added = added < mAddedSlots.size() && mAddedSlots[ added ] == slot;
+        out.push_back( is_added ? mAdded[ added ] : mBase[ slot - added ] );
+
+        auto& address = out.back();
+        if( auto it = mChanges.find( address.mId ); it != mChanges.end() ) address.mValue = it->second;
+        address.mPosition = position + i;
+    }
+}
+
+void PatchOverlay::Collect( size_t node, size_t offset, size_t from, size_t to, std::vector< Address >& out ) const
+{
+    if( node == NIL || from >= offset + mPieces[ node ].mSize || to <= offset ) return;
+    const auto& piece = mPieces[ node ];
+    Collect( piece.mLeft, offset, from, to, out );
+
+    size_t begin = offset + SubtreeSize( piece.mLeft );
+    size_t first = std::max( from, begin );
+    size_t last = std::min( to, begin + piece.mLength );
+    if( first < last ) Emit( piece.mFirst + first - begin, last - first, first, out );
+
+    Collect( piece.mRight, begin + piece.mLength, from, to, out );
+}
+
+Address PatchOverlay::At( size_t position ) const
+{
+    if( position >= mSize ) throw std::out_of_range( "position " + std::to_string( position ) + " is out of range" );
+    std::vector< Address > out;
+    Emit( Locate( position ), 1, position, out );
+    return std::move( out.front() );
+}
+
+std::vector< Address > PatchOverlay::Range( size_t first, size_t last ) const
+{
+    if( first > last || last > mSize ) throw std::out_of_range( "range is out of range" );
+    std::vector< Address > out;
+    out.reserve( last - first );
+
+    /* Переставленное начало - по одному элементу, остальное - отрезками дерева */
+    for( ; first < last && first < mPermutation.size(); ++first ) Emit( Locate( first ), 1, first, out );
+    Collect( mRoot, 0, first, last, out );
+    return out;
+}
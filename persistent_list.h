@@ -0,0 +1,560 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "address_differ.h"
+#include "hash_mix.h"
+
+/*
+ * @brief Неизменяемый список адресов с общими частями между версиями.
+ * Элементы хранятся отрезками до 2 * CHUNK_SIZE штук в вершинах декартова дерева по неявному ключу. Изменение копирует
+ * только путь от корня до измененного отрезка и сам отрезок, поэтому новая версия стоит O(CHUNK_SIZE + log n) памяти
+ * на операцию, а остальные отрезки разделяются с предыдущей версией. Позиции в отрезках не хранятся - они меняются
+ * при вставках перед отрезком; At и ToVector проставляют их заново.
+ * Версии неизменяемы, поэтому их можно читать из разных потоков без блокировок.
+ */
+class PersistentAddressList
+{
+public:
+
+    /* Элементы одного отрезка */
+    using Chunk = std::vector< Address >;
+
+    /* Размер отрезков при построении; переполненный вдвое отрезок делится пополам */
+    static constexpr size_t CHUNK_SIZE = 64;
+
+    PersistentAddressList() = default;
+
+    /*
+     * @param addresses Список адресов по порядку позиций.
+     */
+    explicit PersistentAddressList( const std::vector< Address >& addresses );
+
+    size_t Size() const { return SubtreeSize( mRoot ); }
+
+    /*
+     * @brief Элемент по позиции.
+     * @details std::out_of_range - позиция за пределами списка.
+     */
+    Address At( size_t position ) const;
+
+    std::vector< Address > ToVector() const;
+
+    /*
+     * @brief Отрезки в порядке списка. Одинаковые указатели в двух версиях - общий, не менявшийся отрезок.
+     * @details Указатели действительны, пока жива версия.
+     */
+    std::vector< const Chunk* > Chunks() const;
+
+    /*
+     * @brief Новая версия со вставленным элементом.
+     * @details std::out_of_range - позиция больше размера.
+     */
+    PersistentAddressList Insert( size_t position, const Address& address ) const;
+
+    /*
+     * @brief Новая версия без элемента.
+     * @details std::out_of_range - позиция за пределами списка.
+     */
+    PersistentAddressList Erase( size_t position ) const;
+
+    /*
+     * @brief Новая версия с новым значением элемента.
+     * @details std::out_of_range - позиция за пределами списка.
+     */
+    PersistentAddressList SetValue( size_t position, const InternedString& value ) const;
+
+    /*
+     * @brief Новая версия с переставленным началом: на позицию i встает элемент с позиции permutation[ i ].
+     * @details Начало собирается заново, остальная часть разделяется. std::out_of_range - перестановка длиннее списка.
+     */
+    PersistentAddressList Permute( const std::vector< size_t >& permutation ) const;
+
+    /*
+     * @brief Позиция первого элемента с идентификатором, перебором.
+     * @return Позиция или Size(), если элемента нет.
+     */
+    size_t Find( size_t id ) const;
+
+private:
+
+    struct Node;
+    using NodePtr = std::shared_ptr< const Node >;
+
+    struct Node
+    {
+        /* Отрезок разделяется между копиями вершины, пока его содержимое не меняется */
+        std::shared_ptr< const Chunk > mChunk;
+        NodePtr mLeft;
+        NodePtr mRight;
+
+        /* Количество элементов поддерева */
+        size_t mSize = 0;
+        uint64_t mPriority = 0;
+    };
+
+    explicit PersistentAddressList( NodePtr root )
+        : mRoot( std::move( root ) ) {}
+
+    static size_t SubtreeSize( const NodePtr& node ) { return node ? node->mSize : 0; }
+    static NodePtr MakeNode( std::shared_ptr< const Chunk > chunk, NodePtr left, NodePtr right, uint64_t priority );
+
+    /* Приоритеты вершин: перемешанный счетчик, одинаковый от запуска к запуску */
+    static uint64_t NextPriority();
+
+    /* Строит дерево из отрезков по CHUNK_SIZE элементов за линейное время */
+    static NodePtr Build( const std::vector< Address >& addresses );
+
+    static NodePtr Merge( const NodePtr& left, const NodePtr& right );
+    static void Split( const NodePtr& node, size_t count, NodePtr& left, NodePtr& right );
+    static NodePtr InsertAt( const NodePtr& node, size_t position, const Address& address );
+    static NodePtr EraseAt( const NodePtr& node, size_t position );
+    static NodePtr SetAt( const NodePtr& node, size_t position, const InternedString& value );
+
+    template< typename Fn >
+    static void ForEachChunk( const NodePtr& node, Fn& fn );
+
+    NodePtr mRoot;
+};
+
+PersistentAddressList::PersistentAddressList( const std::vector< Address >& addresses )
+    : mRoot( Build( addresses ) ) {}
+
+uint64_t PersistentAddressList::NextPriority()
+{
+    static std::atomic< uint64_t > counter{ 0 };
+    return MixHash( counter.fetch_add( 0x9E3779B97F4A7C15ULL, std::memory_order_relaxed ) );
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::MakeNode( std::shared_ptr< const Chunk > chunk, NodePtr left, NodePtr right, uint64_t priority )
+{
+    auto node = std::make_shared< Node >();
+    node->mSize = SubtreeSize( left ) + chunk->size() + SubtreeSize( right );
+    node->mChunk = std::move( chunk );
+    node->mLeft = std::move( left );
+    node->mRight = std::move( right );
+    node->mPriority = priority;
+    return node;
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::Build( const std::vector< Address >& addresses )
+{
+    /*
+     * Декартово дерево по порядку отрезков: в стеке - правая ветвь. Вершина, снятая со стека, больше не меняется,
+     * поэтому ее размер считается при снятии.
+     */
+    std::vector< std::shared_ptr< Node > > spine;
+    auto finish = []( Node& node ){ node.mSize = SubtreeSize( node.mLeft ) + node.mChunk->size() + SubtreeSize( node.mRight ); };
+    for( size_t first = 0; first < addresses.size(); first += CHUNK_SIZE )
+    {
+        auto node = std::make_shared< Node >();
+        node->mChunk = std::make_shared< const Chunk >( addresses.begin() + first, addresses.begin() + std::min( addresses.size(), first + CHUNK_SIZE ) );
+        node->mPriority = NextPriority();
+        std::shared_ptr< Node > popped;
+        while( !spine.empty() && spine.back()->mPriority < node->mPriority )
+        {
+            popped = spine.back();
+            spine.pop_back();
+            finish( *popped );
+        }
+        node->mLeft = popped;
+        if( !spine.empty() ) spine.back()->mRight = node;
+        spine.push_back( node );
+    }
+    if( spine.empty() ) return nullptr;
+    while( spine.size() > 1 )
+    {
+        finish( *spine.back() );
+        spine.pop_back();
+    }
+    finish( *spine.front() );
+    return spine.front();
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::Merge( const NodePtr& left, const NodePtr& right )
+{
+    if( !left ) return right;
+    if( !right ) return left;
+    if( left->mPriority > right->mPriority ) return MakeNode( left->mChunk, left->mLeft, Merge( left->mRight, right ), left->mPriority );
+    return MakeNode( right->mChunk, Merge( left, right->mLeft ), right->mRight, right->mPriority );
+}
+
+void PersistentAddressList::Split( const NodePtr& node, size_t count, NodePtr& left, NodePtr& right )
+{
+    if( !node )
+    {
+        left = right = nullptr;
+        return;
+    }
+    size_t left_size = SubtreeSize( node->mLeft );
+    size_t length = node->mChunk->size();
+    if( count <= left_size )
+    {
+        NodePtr inner;
+        Split( node->mLeft, count, left, inner );
+        right = MakeNode( node->mChunk, inner, node->mRight, node->mPriority );
+    }
+    else if( count >= left_size + length )
+    {
+        NodePtr inner;
+        Split( node->mRight, count - left_size - length, inner, right );
+        left = MakeNode( node->mChunk, node->mLeft, inner, node->mPriority );
+    }
+    else
+    {
+        size_t offset = count - left_size;
+        auto head = std::make_shared< const Chunk >( node->mChunk->begin(), node->mChunk->begin() + offset );
+        auto tail = std::make_shared< const Chunk >( node->mChunk->begin() + offset, node->mChunk->end() );
+        left = MakeNode( head, node->mLeft, nullptr, node->mPriority );
+        right = Merge( MakeNode( tail, nullptr, nullptr, NextPriority() ), node->mRight );
+    }
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::InsertAt( const NodePtr& node, size_t position, const Address& address )
+{
+    if( !node ) return MakeNode( std::make_shared< const Chunk >( 1, address ), nullptr, nullptr, NextPriority() );
+
+    size_t left_size = SubtreeSize( node->mLeft );
+    size_t length = node->mChunk->size();
+    if( position < left_size ) return MakeNode( node->mChunk, InsertAt( node->mLeft, position, address ), node->mRight, node->mPriority );
+    if( position > left_size + length ) return MakeNode( node->mChunk, node->mLeft, InsertAt( node->mRight, position - left_size - length, address ), node->mPriority );
+
+    auto chunk = std::make_shared< Chunk >( *node->mChunk );
+    chunk->insert( chunk->begin() + ( position - left_size ), address );
+    if( chunk->size() <= 2 * CHUNK_SIZE ) return MakeNode( std::move( chunk ), node->mLeft, node->mRight, node->mPriority );
+
+    /* Переполненный отрезок делится пополам; у второй половины приоритет ниже, чтобы она ушла в правое поддерево */
+    auto tail = std::make_shared< const Chunk >( chunk->begin() + CHUNK_SIZE, chunk->end() );
+    chunk->resize( CHUNK_SIZE );
+    auto tail_node = MakeNode( tail, nullptr, nullptr, node->mPriority == 0 ? 0 : NextPriority() % node->mPriority );
+    return MakeNode( std::move( chunk ), node->mLeft, Merge( tail_node, node->mRight ), node->mPriority );
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::EraseAt( const NodePtr& node, size_t position )
+{
+    size_t left_size = SubtreeSize( node->mLeft );
+    size_t length = node->mChunk->size();
+    if( position < left_size ) return MakeNode( node->mChunk, EraseAt( node->mLeft, position ), node->mRight, node->mPriority );
+    if( position >= left_size + length ) return MakeNode( node->mChunk, node->mLeft, EraseAt( node->mRight, position - left_size - length ), node->mPriority );
+
+    if( length == 1 ) return Merge( node->mLeft, node->mRight );
+    auto chunk = std::make_shared< Chunk >( *node->mChunk );
+    chunk->erase( chunk->begin() + ( position - left_size ) );
+    return MakeNode( std::move( chunk ), node->mLeft, node->mRight, node->mPriority );
+}
+
+PersistentAddressList::NodePtr PersistentAddressList::SetAt( const NodePtr& node, size_t position, const InternedString& value )
+{
+    size_t left_size = SubtreeSize( node->mLeft );
+    size_t length = node->mChunk->size();
+    if( position < left_size ) return MakeNode( node->mChunk, SetAt( node->mLeft, position, value ), node->mRight, node->mPriority );
+    if( position >= left_size + length ) return MakeNode( node->mChunk, node->mLeft, SetAt( node->mRight, position - left_size - length, value ), node->mPriority );
+
+    auto chunk = std::make_shared< Chunk >( *node->mChunk );
+    ( *chunk )[ position - left_size ].mValue = value;
+    return MakeNode( std::move( chunk ), node->mLeft, node->mRight, node->mPriority );
+}
+
+template< typename Fn >
+void PersistentAddressList::ForEachChunk( const NodePtr& node, Fn& fn )
+{
+    if( !node ) return;
+    ForEachChunk( node->mLeft, fn );
+    fn( *node->mChunk );
+    ForEachChunk( node->mRight, fn );
+}
+
+Address PersistentAddressList::At( size_t position ) const
+{
+    if( position >= Size() ) throw std::out_of_range( "position " + std::to_string( position ) + " is out of range" );
+    const Node* node = mRoot.get();
+    size_t offset = position;
+    while( true )
+    {
+        size_t left_size = SubtreeSize( node->mLeft );
+        if( offset < left_size )
+        {
+            node = node->mLeft.get();
+            continue;
+        }
+        offset -= left_size;
+        if( offset < node->mChunk->size() )
+        {
+            Address address = ( *node->mChunk )[ offset ];
+            address.mPosition = position;
+            return address;
+        }
+        offset -= node->mChunk->size();
+        node = node->mRight.get();
+    }
+}
+
+std::vector< Address > PersistentAddressList::ToVector() const
+{
+    std::vector< Address > result;
+    result.reserve( Size() );
+    auto append = [&]( const Chunk& chunk )
+    {
+        for( const auto& elem : chunk )
+        {
+            result.push_back( elem );
+            result.back().mPosition = result.size() - 1;
+        }
+    };
+    ForEachChunk( mRoot, append );
+    return result;
+}
+
+std::vector< const PersistentAddressList::Chunk* > PersistentAddressList::Chunks() const
+{
+    std::vector< const Chunk* > chunks;
+    auto append = [&]( const Chunk& chunk ){ chunks.push_back( &chunk ); };
+    ForEachChunk( mRoot, append );
+    return chunks;
+}
+
+PersistentAddressList PersistentAddressList::Insert( size_t position, const Address& address ) const
+{
+    if( position > Size() ) throw std::out_of_range( "insert position " + std::to_string( position ) + " is out of range" );
+    return PersistentAddressList( InsertAt( mRoot, position, address ) );
+}
+
+PersistentAddressList PersistentAddressList::Erase( size_t position ) const
+{
+    if( position >= Size() ) throw std::out_of_range( "erase position " + std::to_string( position ) + " is out of range" );
+    return PersistentAddressList( EraseAt( mRoot, position ) );
+}
+
+PersistentAddressList PersistentAddressList::SetValue( size_t position, const InternedString& value ) const
+{
+    if( position >= Size() ) throw std::out_of_range( "position " + std::to_string( position ) + " is out of range" );
+    return PersistentAddressList( SetAt( mRoot, position, value ) );
+}
+
+PersistentAddressList PersistentAddressList::Permute( const std::vector< size_t >& permutation ) const
+{
+    if( permutation.empty() ) return *this;
+    if( permutation.size() > Size() ) throw std::out_of_range( "permutation is longer than the list" );
+    NodePtr head, tail;
+    Split( mRoot, permutation.size(), head, tail );
+    auto elements = PersistentAddressList( head ).ToVector();
+    std::vector< Address > reordered;
+    reordered.reserve( elements.size() );
+    for( auto index : permutation ) reordered.push_back( elements[ index ] );
+    return PersistentAddressList( Merge( Build( reordered ), tail ) );
+}
+
+size_t PersistentAddressList::Find( size_t id ) const
+{
+    size_t position = 0;
+    bool found = false;
+    auto find = [&]( const Chunk& chunk )
+    {
+        if( found ) return;
+        for( const auto& elem : chunk )
+        {
+            if( elem.mId == id )
+            {
+                found = true;
+                return;
+            }
+            ++position;
+        }
+    };
+    ForEachChunk( mRoot, find );
+    return position;
+}
+
+CompareResult< Address > DifferAddress::Compare( const PersistentAddressList& old_addresses, const PersistentAddressList& updated_addresses )
+{
+    /*
+     * Отрезок, общий для обеих версий, не менялся: его элементы есть в обеих версиях с теми же значениями, поэтому
+     * не бывают ни добавленными, ни удаленными, ни измененными. Добавления, удаления и изменения ищутся только среди
+     * элементов необщих отрезков.
+     */
+    using Chunk = PersistentAddressList::Chunk;
+    auto old_chunks = old_addresses.Chunks();
+    auto updated_chunks = updated_addresses.Chunks();
+    std::unordered_set< const Chunk* > old_set( old_chunks.begin(), old_chunks.end() );
+    std::vector< bool > updated_shared( updated_chunks.size() );
+    std::unordered_set< const Chunk* > shared;
+    for( size_t i = 0; i < updated_chunks.size(); ++i )
+    {
+        updated_shared[ i ] = old_set.count( updated_chunks[ i ] ) != 0;
+        if( updated_shared[ i ] ) shared.insert( updated_chunks[ i ] );
+    }
+
+    /* Элементы необщих отрезков старой версии с их позициями */
+    std::unordered_map< size_t, Address > old_index;
+    size_t position = 0;
+    for( auto* chunk : old_chunks )
+    {
+        if( shared.count( chunk ) != 0 )
+        {
+            position += chunk->size();
+            continue;
+        }
+        for( const auto& elem : *chunk )
+        {
+            Address address = elem;
+            address.mPosition = position++;
+            old_index.emplace( address.mId, std::move( address ) );
+        }
+    }
+
+    CompareResult< Address > result;
+    std::unordered_set< size_t > matched, added_ids, deleted_ids;
+    position = 0;
+    for( size_t i = 0; i < updated_chunks.size(); ++i )
+    {
+        if( updated_shared[ i ] )
+        {
+            position += updated_chunks[ i ]->size();
+            continue;
+        }
+        for( const auto& elem : *updated_chunks[ i ] )
+        {
+            Address address = elem;
+            address.mPosition = position++;
+            auto it = old_index.find( address.mId );
+            if( it == old_index.end() )
+            {
+                added_ids.insert( address.mId );
+                result.mAddedOperations.push_back( { OPERATION_TYPE::ADDED, address, std::nullopt, address.mPosition, std::nullopt } );
+                continue;
+            }
+            matched.insert( address.mId );
+            if( it->second.mValue != address.mValue )
+            {
+                result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, it->second, address, address.mPosition, std::nullopt } );
+            }
+        }
+    }
+    for( auto* chunk : old_chunks )
+    {
+        if( shared.count( chunk ) != 0 ) continue;
+        for( const auto& elem : *chunk )
+        {
+            if( matched.count( elem.mId ) != 0 ) continue;
+            deleted_ids.insert( elem.mId );
+            const auto& address = old_index.at( elem.mId );
+            result.mDeletedOperations.push_back( { OPERATION_TYPE::DELETED, address, std::nullopt, address.mPosition, std::nullopt } );
+        }
+    }
+
+    /*
+     * Перемещений нет, если старая версия без удаленных совпадает с новой без добавленных. Проверка идет двумя курсорами;
+     * когда оба стоят в начале одного и того же отрезка, он пропускается целиком.
+     */
+    struct Cursor
+    {
+        const std::vector< const Chunk* >& mChunks;
+        const std::unordered_set< size_t >& mSkipped;
+        size_t mChunk = 0;
+        size_t mOffset = 0;
+
+        void Normalize()
+        {
+            while( mChunk < mChunks.size() )
+            {
+                if( mOffset == mChunks[ mChunk ]->size() )
+                {
+                    ++mChunk;
+                    mOffset = 0;
+                }
+                else if( mSkipped.count( ( *mChunks[ mChunk ] )[ mOffset ].mId ) != 0 ) ++mOffset;
+                else break;
+            }
+        }
+        bool End() const { return mChunk == mChunks.size(); }
+        const Address& Current() const { return ( *mChunks[ mChunk ] )[ mOffset ]; }
+    };
+    Cursor old_cursor{ old_chunks, deleted_ids };
+    Cursor updated_cursor{ updated_chunks, added_ids };
+    bool ordered = true;
+    while( ordered )
+    {
+        old_cursor.Normalize();
+        updated_cursor.Normalize();
+        if( old_cursor.End() || updated_cursor.End() )
+        {
+            ordered = old_cursor.End() && updated_cursor.End();
+            break;
+        }
+        if( old_cursor.mOffset == 0 && updated_cursor.mOffset == 0 && old_chunks[ old_cursor.mChunk ] == updated_chunks[ updated_cursor.mChunk ] )
+        {
+            ++old_cursor.mChunk;
+            ++updated_cursor.mChunk;
+            continue;
+        }
+        ordered = old_cursor.Current().mId == updated_cursor.Current().mId;
+        ++old_cursor.mOffset;
+        ++updated_cursor.mOffset;
+    }
+    if( ordered ) return result;
+
+    /* Порядок изменился: перемещения ищутся по спискам целиком, как у векторов */
+    return Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >(
+        old_addresses.ToVector(), updated_addresses.ToVector() );
+}
+
+PersistentAddressList DifferAddress::DoEditorialPrescription( const CompareResult< Address >& compare_result, const PersistentAddressList& old_adresses )
+{
+    PersistentAddressList result = old_adresses;
+    for( const auto& elem : compare_result.mAddedOperations )
+    {
+        result = result.Insert( elem.mPositionStart, elem.mValue );
+    }
+
+    /*
+     * Удаляемые и изменяемые элементы ищутся по старой позиции из операции, пересчитанной через места вставок и удалений;
+     * если там другой элемент - перебором, как в DoEditorialPrescription для вектора.
+     */
+    auto added_slots = AddedSlots( compare_result.mAddedOperations );
+    std::sort( added_slots.begin(), added_slots.end() );
+    auto locate = [&]( const PersistentAddressList& list, size_t position, size_t id )
+    {
+        if( position < list.Size() && list.At( position ).mId == id ) return position;
+        position = list.Find( id );
+        assert( position != list.Size() );
+        if( position == list.Size() ) throw std::invalid_argument( "id " + std::to_string( id ) + " is not in the list" );
+        return position;
+    };
+
+    std::vector< size_t > deleted_slots;
+    deleted_slots.reserve( compare_result.mDeletedOperations.size() );
+    for( const auto& elem : compare_result.mDeletedOperations )
+    {
+        deleted_slots.push_back( locate( result, SkipSlots( added_slots, elem.mValue.mPosition ), elem.mValue.mId ) );
+    }
+    /* С конца, чтобы удаление не сдвигало еще не удаленные */
+    std::sort( deleted_slots.begin(), deleted_slots.end() );
+    for( auto it = deleted_slots.rbegin(); it != deleted_slots.rend(); ++it )
+    {
+        result = result.Erase( *it );
+    }
+
+    for( const auto& elem : compare_result.mChandedOperations )
+    {
+        size_t slot = SkipSlots( added_slots, elem.mValue.mPosition );
+        size_t position = slot - ( std::lower_bound( deleted_slots.begin(), deleted_slots.end(), slot ) - deleted_slots.begin() );
+        result = result.SetValue( locate( result, position, elem.mValue.mId ), elem.mNewValue->mValue );
+    }
+
+    for( const auto& elem : compare_result.mMovedOperations )
+    {
+        assert( elem.mPositionEnd );
+        if( elem.mPositionStart == *elem.mPositionEnd ) continue;
+        auto moved = result.At( elem.mPositionStart );
+        result = result.Erase( elem.mPositionStart ).Insert( *elem.mPositionEnd, moved );
+    }
+
+    return result.Permute( compare_result.mPermutation );
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "address_differ.h"
+
+namespace positions_detail
+{
+
+/*
+ * @brief Поразрядная сортировка пар (позиция, индекс) по позиции, от младшего байта к старшему.
+ * @details Каждый проход: гистограммы частей считаются параллельно, затем каждая часть раскладывается в свои
+ * участки корзин - так сортировка остается устойчивой. Проходы по байтам, в которых все позиции совпадают, пропускаются.
+ * @param keys Пары (позиция, индекс).
+ * @param max_key Наибольшая позиция.
+ * @param parts Количество частей, обрабатываемых параллельно.
+ */
+void RadixSort( std::vector< std::pair< size_t, size_t > >& keys, size_t max_key, size_t parts )
+{
+    const size_t size = keys.size();
+    parts = std::max< size_t >( parts, 1 );
+    const size_t chunk = ( size + parts - 1 ) / parts;
+    std::vector< std::pair< size_t, size_t > > buffer( size );
+    std::vector< std::array< size_t, 256 > > counts( parts );
+
+    auto for_parts = [&]( auto fn )
+    {
+        std::vector< std::thread > threads;
+        for( size_t part = 1; part < parts; ++part ) threads.emplace_back( fn, part );
+        fn( 0 );
+        for( auto& thread : threads ) thread.join();
+    };
+
+    for( unsigned shift = 0; shift < 64 && ( max_key >> shift ) != 0; shift += 8 )
+    {
+        for_parts( [&]( size_t part )
+        {
+            auto& count = counts[ part ];
+            count.fill( 0 );
+            for( size_t i = part * chunk; i < std::min( size, ( part + 1 ) * chunk ); ++i ) ++count[ ( keys[ i ].first >> shift ) & 0xFF ];
+        } );
+
+        /* Начало участка части в корзине: все меньшие корзины, затем предыдущие части этой корзины */
+        size_t offset = 0;
+        bool single_bucket = false;
+        for( size_t digit = 0; digit < 256; ++digit )
+        {
+            size_t bucket = 0;
+            for( size_t part = 0; part < parts; ++part )
+            {
+                size_t count = counts[ part ][ digit ];
+                counts[ part ][ digit ] = offset + bucket;
+                bucket += count;
+            }
+            single_bucket |= bucket == size;
+            offset += bucket;
+        }
+        if( single_bucket ) continue;
+
+        for_parts( [&]( size_t part )
+        {
+            auto& next = counts[ part ];
+            for( size_t i = part * chunk; i < std::min( size, ( part + 1 ) * chunk ); ++i ) buffer[ next[ ( keys[ i ].first >> shift ) & 0xFF ]++ ] = keys[ i ];
+        } );
+        keys.swap( buffer );
+    }
+}
+
+}
+
+/*
+ * @brief Порядок элементов по возрастанию позиций за O(n).
+ * @details Если позиции - перестановка 0..n-1, каждый элемент ставится сразу на свое место. Иначе, при sparse,
+ * позиции сортируются поразрядно (параллельно на больших списках); без sparse это ошибка.
+ * std::invalid_argument - повторяющаяся позиция, std::out_of_range - позиция не меньше n без sparse.
+ * @param size Количество элементов.
+ * @param position_at Возвращает позицию элемента по индексу.
+ * @param sparse Разрешить позиции с пропусками.
+ * @return order[ k ] - индекс k-го по позиции элемента. Пустой, если позиции уже равны 0..n-1 по порядку.
+ */
+template< typename PositionAt >
+std::vector< size_t > PositionOrder( size_t size, PositionAt position_at, bool sparse )
+{
+    size_t first_unordered = 0;
+    while( first_unordered < size && position_at( first_unordered ) == first_unordered ) ++first_unordered;
+    if( first_unordered == size ) return {};
+
+    /* Плотные позиции: каждый элемент сразу на свое место */
+    const size_t npos = static_cast< size_t >( -1 );
+    std::vector< size_t > order( size, npos );
+    size_t max_position = 0;
+    bool dense = true;
+    for( size_t i = 0; i < size; ++i )
+    {
+        size_t position = position_at( i );
+        max_position = std::max( max_position, position );
+        if( position >= size )
+        {
+            if( !sparse ) throw std::out_of_range( "position " + std::to_string( position ) + " is out of range for " + std::to_string( size ) + " addresses" );
+            dense = false;
+            continue;
+        }
+        if( order[ position ] != npos ) throw std::invalid_argument( "duplicate position " + std::to_string( position ) );
+        order[ position ] = i;
+    }
+    if( dense ) return order;
+
+    std::vector< std::pair< size_t, size_t > > keys( size );
+    for( size_t i = 0; i < size; ++i ) keys[ i ] = { position_at( i ), i };
+    /* Потоки окупаются от 64K элементов на поток */
+    size_t parts = std::min< size_t >( std::thread::hardware_concurrency(), size >> 16 );
+    positions_detail::RadixSort( keys, max_position, parts );
+    for( size_t k = 0; k < size; ++k )
+    {
+        if( k != 0 && keys[ k ].first == keys[ k - 1 ].first ) throw std::invalid_argument( "duplicate position " + std::to_string( keys[ k ].first ) );
+        order[ k ] = keys[ k ].second;
+    }
+    return order;
+}
+
+/*
+ * @brief Приводит список к виду, который ожидают Compare и DoEditorialPrescription: по порядку позиций 0..n-1.
+ * @details O(n) для перестановки позиций, поразрядная сортировка для позиций с пропусками.
+ * std::invalid_argument - повторяющаяся позиция, std::out_of_range - позиция не меньше n без sparse.
+ * @param addresses Список адресов.
+ * @param sparse Разрешить позиции с пропусками; после упорядочивания они перенумеровываются в 0..n-1.
+ */
+void NormalizePositions( std::vector< Address >& addresses, bool sparse = false )
+{
+    auto order = PositionOrder( addresses.size(), [&]( size_t i ){ return addresses[ i ].mPosition; }, sparse );
+    if( order.empty() ) return;
+
+    std::vector< Address > sorted;
+    sorted.reserve( addresses.size() );
+    for( auto index : order )
+    {
+        sorted.push_back( std::move( addresses[ index ] ) );
+        sorted.back().mPosition = sorted.size() - 1;
+    }
+    addresses.swap( sorted );
+}
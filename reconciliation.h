@@ -0,0 +1,387 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "address_differ.h"
+#include "patch_codec.h"
+#include "hash_mix.h"
+
+/*
+ * @brief Запись эскиза: элемент списка вместе с идентификатором предыдущего элемента и хешем значения.
+ * Предыдущий элемент делает порядок частью множества: вставка или удаление меняют 3 записи, перемещение - до 6.
+ */
+struct SketchEntry
+{
+    size_t mId;
+
+    /* Идентификатор предыдущего элемента или NO_PREDECESSOR для первого */
+    size_t mPredecessor;
+    uint64_t mValueHash;
+
+    static constexpr size_t NO_PREDECESSOR = static_cast< size_t >( -1 );
+
+    bool operator==( const SketchEntry& rhs ) const
+    {
+        return mId == rhs.mId && mPredecessor == rhs.mPredecessor && mValueHash == rhs.mValueHash;
+    }
+};
+
+/*
+ * @brief Эскиз для сверки множеств (обратимая таблица Блума, IBLT) над записями списка адресов.
+ * Реплика строит эскиз своего списка и отправляет его издателю; издатель вычитает его из эскиза своего списка
+ * и восстанавливает отличающиеся записи. Размер эскиза задается ожидаемым количеством отличий и не зависит от размера
+ * списков. Каждая запись попадает в HASH_COUNT ячеек, по одной в каждой трети таблицы.
+ */
+class ReconciliationSketch
+{
+public:
+
+    /* Признак формата */
+    static constexpr char SKETCH_MAGIC = 'I';
+
+    static constexpr size_t HASH_COUNT = 3;
+
+    /*
+     * @details std::invalid_argument - количество ячеек не кратно HASH_COUNT или равно 0.
+     * @param cells Количество ячеек.
+     */
+    explicit ReconciliationSketch( size_t cells );
+
+    /*
+     * @brief Количество ячеек, при котором эскиз восстанавливает заданное количество отличий с вероятностью около 99%.
+     * @details Одно изменение значения дает 2 отличающиеся записи, добавление и удаление - 3, перемещение - до 6.
+     * При неудаче нужен эскиз большего размера.
+     * @param entries Ожидаемое количество отличающихся записей.
+     */
+    static size_t CellsFor( size_t entries );
+
+    /*
+     * @brief Эскиз списка адресов.
+     * @param addresses Список адресов по порядку позиций.
+     * @param cells Количество ячеек.
+     */
+    static ReconciliationSketch FromList( const std::vector< Address >& addresses, size_t cells );
+
+    /* @brief Записи списка в том виде, в котором они попадают в эскиз */
+    static std::vector< SketchEntry > Entries( const std::vector< Address >& addresses );
+
+    /* @brief Хеш значения, одинаковый на всех платформах (FNV-1a) */
+    static uint64_t ValueHash( std::string_view value );
+
+    size_t Cells() const { return mCells.size(); }
+
+    void Add( const SketchEntry& entry ) { Toggle( entry, 1 ); }
+    void Remove( const SketchEntry& entry ) { Toggle( entry, -1 ); }
+
+    /*
+     * @brief Вычитает другой эскиз: остаются только записи, которые есть лишь в одном из них.
+     * @details std::invalid_argument - эскизы разного размера.
+     */
+    void Subtract( const ReconciliationSketch& other );
+
+    /*
+     * @brief Восстанавливает записи разности эскизов.
+     * @param local_only Записи, добавленные в этот эскиз и отсутствующие в вычтенном.
+     * @param remote_only Записи вычтенного эскиза, отсутствующие в этом.
+     * @return false - отличий больше, чем вмещает эскиз; выходные списки тогда неполны.
+     */
+    bool Peel( std::vector< SketchEntry >& local_only, std::vector< SketchEntry >& remote_only ) const;
+
+    /*
+     * @brief Кодирует эскиз и дописывает его в конец буфера.
+     * @param out Выходной буфер.
+     */
+    void Encode( std::string& out ) const;
+
+    /*
+     * @brief Декодирует эскиз.
+     * @param data Закодированные данные.
+     * @param sketch Результат декодирования.
+     * @return false - данные повреждены.
+     */
+    static bool Decode( std::string_view data, ReconciliationSketch& sketch );
+
+private:
+
+    struct Cell
+    {
+        int64_t mCount = 0;
+        uint64_t mIdSum = 0;
+        uint64_t mPredecessorSum = 0;
+        uint64_t mValueHashSum = 0;
+        uint64_t mCheckSum = 0;
+    };
+
+    static uint64_t Mix( uint64_t value );
+    static uint64_t KeyHash( const SketchEntry& entry );
+    static uint64_t CheckHash( uint64_t key_hash ) { return Mix( key_hash ^ 0x5bd1e9955bd1e995ULL ); }
+
+    /* Ячейка записи в k-й трети таблицы */
+    size_t CellIndex( uint64_t key_hash, size_t k ) const;
+
+    /* В ячейке ровно одна запись: ее контрольная сумма совпадает */
+    static bool IsPure( const Cell& cell );
+
+    static void Toggle( Cell& cell, const SketchEntry& entry, uint64_t check, int64_t sign );
+    void Toggle( const SketchEntry& entry, int64_t sign );
+
+    std::vector< Cell > mCells;
+};
+
+ReconciliationSketch::ReconciliationSketch( size_t cells )
+{
+    if( cells == 0 || cells % HASH_COUNT != 0 ) throw std::invalid_argument( "sketch size must be a positive multiple of " + std::to_string( HASH_COUNT ) );
+    mCells.resize( cells );
+}
+
+size_t ReconciliationSketch::CellsFor( size_t entries )
+{
+    /*
+     * Таблице с тремя хешами асимптотически хватает 1.23 ячейки на запись, но на малых разностях часто встречаются записи
+     * с общими ячейками. С 2 ячейками на запись и 30 сверху отказ - около 1% при любом количестве отличий.
+     */
+    size_t cells = 2 * entries + 10 * HASH_COUNT;
+    return ( cells + HASH_COUNT - 1 ) / HASH_COUNT * HASH_COUNT;
+}
+
+uint64_t ReconciliationSketch::ValueHash( std::string_view value )
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for( unsigned char c : value )
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::vector< SketchEntry > ReconciliationSketch::Entries( const std::vector< Address >& addresses )
+{
+    std::vector< SketchEntry > entries;
+    entries.reserve( addresses.size() );
+    size_t predecessor = SketchEntry::NO_PREDECESSOR;
+    for( const auto& elem : addresses )
+    {
+        entries.push_back( { elem.mId, predecessor, ValueHash( elem.mValue.View() ) } );
+        predecessor = elem.mId;
+    }
+    return entries;
+}
+
+ReconciliationSketch ReconciliationSketch::FromList( const std::vector< Address >& addresses, size_t cells )
+{
+    ReconciliationSketch sketch( cells );
+    for( const auto& entry : Entries( addresses ) ) sketch.Add( entry );
+    return sketch;
+}
+
+uint64_t ReconciliationSketch::Mix( uint64_t value )
+{
+    /* Шаг splitmix64: сдвиг на золотое сечение не дает нулю отобразиться в ноль */
+    return MixHash( value + 0x9E3779B97F4A7C15ULL );
+}
+
+uint64_t ReconciliationSketch::KeyHash( const SketchEntry& entry )
+{
+    return Mix( Mix( Mix( entry.mId ) ^ entry.mPredecessor ) ^ entry.mValueHash );
+}
+
+size_t ReconciliationSketch::CellIndex( uint64_t key_hash, size_t k ) const
+{
+    size_t part = mCells.size() / HASH_COUNT;
+    return k * part + Mix( key_hash + k + 1 ) % part;
+}
+
+bool ReconciliationSketch::IsPure( const Cell& cell )
+{
+    if( cell.mCount != 1 && cell.mCount != -1 ) return false;
+    return CheckHash( KeyHash( { cell.mIdSum, cell.mPredecessorSum, cell.mValueHashSum } ) ) == cell.mCheckSum;
+}
+
+void ReconciliationSketch::Toggle( Cell& cell, const SketchEntry& entry, uint64_t check, int64_t sign )
+{
+    cell.mCount += sign;
+    cell.mIdSum ^= entry.mId;
+    cell.mPredecessorSum ^= entry.mPredecessor;
+    cell.mValueHashSum ^= entry.mValueHash;
+    cell.mCheckSum ^= check;
+}
+
+void ReconciliationSketch::Toggle( const SketchEntry& entry, int64_t sign )
+{
+    uint64_t key_hash = KeyHash( entry );
+    uint64_t check = CheckHash( key_hash );
+    for( size_t k = 0; k < HASH_COUNT; ++k ) Toggle( mCells[ CellIndex( key_hash, k ) ], entry, check, sign );
+}
+
+void ReconciliationSketch::Subtract( const ReconciliationSketch& other )
+{
+    if( other.mCells.size() != mCells.size() ) throw std::invalid_argument( "sketches have different sizes" );
+    for( size_t i = 0; i < mCells.size(); ++i )
+    {
+        auto& cell = mCells[ i ];
+        const auto& rhs = other.mCells[ i ];
+        cell.mCount -= rhs.mCount;
+        cell.mIdSum ^= rhs.mIdSum;
+        cell.mPredecessorSum ^= rhs.mPredecessorSum;
+        cell.mValueHashSum ^= rhs.mValueHashSum;
+        cell.mCheckSum ^= rhs.mCheckSum;
+    }
+}
+
+bool ReconciliationSketch::Peel( std::vector< SketchEntry >& local_only, std::vector< SketchEntry >& remote_only ) const
+{
+    /* Чистые ячейки снимаются по одной; снятие записи может сделать чистыми ее остальные ячейки */
+    ReconciliationSketch work = *this;
+    std::vector< size_t > pure;
+    for( size_t i = 0; i < work.mCells.size(); ++i )
+    {
+        if( IsPure( work.mCells[ i ] ) ) pure.push_back( i );
+    }
+    while( !pure.empty() )
+    {
+        size_t index = pure.back();
+        pure.pop_back();
+        const auto& cell = work.mCells[ index ];
+        if( !IsPure( cell ) ) continue;
+
+        SketchEntry entry{ cell.mIdSum, cell.mPredecessorSum, cell.mValueHashSum };
+        int64_t sign = cell.mCount;
+        ( sign > 0 ? local_only : remote_only ).push_back( entry );
+        uint64_t key_hash = KeyHash( entry );
+        uint64_t check = CheckHash( key_hash );
+        for( size_t k = 0; k < HASH_COUNT; ++k )
+        {
+            size_t other = work.CellIndex( key_hash, k );
+            Toggle( work.mCells[ other ], entry, check, -sign );
+            if( IsPure( work.mCells[ other ] ) ) pure.push_back( other );
+        }
+    }
+
+    for( const auto& cell : work.mCells )
+    {
+        if( cell.mCount != 0 || cell.mIdSum != 0 || cell.mPredecessorSum != 0 || cell.mValueHashSum != 0 || cell.mCheckSum != 0 ) return false;
+    }
+    return true;
+}
+
+void ReconciliationSketch::Encode( std::string& out ) const
+{
+    auto put_fixed = [&]( uint64_t value )
+    {
+        for( int byte = 0; byte < 8; ++byte ) out.push_back( static_cast< char >( value >> ( 8 * byte ) ) );
+    };
+    out.push_back( SKETCH_MAGIC );
+    PatchCodec::PutVarint( out, mCells.size() );
+    for( const auto& cell : mCells )
+    {
+        /* Счетчик со знаком в zigzag: у эскиза одного списка он мал, суммы - случайные 64-битные числа */
+        PatchCodec::PutVarint( out, ( static_cast< uint64_t >( cell.mCount ) << 1 ) ^ static_cast< uint64_t >( cell.mCount >> 63 ) );
+        put_fixed( cell.mIdSum );
+        put_fixed( cell.mPredecessorSum );
+        put_fixed( cell.mValueHashSum );
+        put_fixed( cell.mCheckSum );
+    }
+}
+
+bool ReconciliationSketch::Decode( std::string_view data, ReconciliationSketch& sketch )
+{
+    auto get_fixed = [&]( uint64_t& value )
+    {
+        if( data.size() < 8 ) return false;
+        value = 0;
+        for( int byte = 0; byte < 8; ++byte ) value |= static_cast< uint64_t >( static_cast< uint8_t >( data[ byte ] ) ) << ( 8 * byte );
+        data.remove_prefix( 8 );
+        return true;
+    };
+    if( data.empty() || data.front() != SKETCH_MAGIC ) return false;
+    data.remove_prefix( 1 );
+    uint64_t cells;
+    /* Каждая ячейка занимает не меньше 33 байт - проверка до выделения памяти */
+    if( !PatchCodec::GetVarint( data, cells ) || cells == 0 || cells % HASH_COUNT != 0 || cells > data.size() / 33 ) return false;
+
+    ReconciliationSketch result( cells );
+    for( auto& cell : result.mCells )
+    {
+        uint64_t count;
+        if( !PatchCodec::GetVarint( data, count ) ) return false;
+        cell.mCount = static_cast< int64_t >( count >> 1 ) ^ -static_cast< int64_t >( count & 1 );
+        if( !get_fixed( cell.mIdSum ) || !get_fixed( cell.mPredecessorSum ) || !get_fixed( cell.mValueHashSum ) || !get_fixed( cell.mCheckSum ) ) return false;
+    }
+    if( !data.empty() ) return false;
+    sketch = std::move( result );
+    return true;
+}
+
+bool DifferAddress::Compare( const ReconciliationSketch& old_sketch, const std::vector< Address >& updated_addresses, CompareResult< Address >& result )
+{
+    auto updated_entries = ReconciliationSketch::Entries( updated_addresses );
+    ReconciliationSketch difference( old_sketch.Cells() );
+    for( const auto& entry : updated_entries ) difference.Add( entry );
+    difference.Subtract( old_sketch );
+    std::vector< SketchEntry > updated_only, old_only;
+    if( !difference.Peel( updated_only, old_only ) ) return false;
+
+    /*
+     * Записи старого списка - записи нового без updated_only вместе с old_only. По предыдущим элементам
+     * восстанавливается порядок старого списка: next[ p ] - элемент, стоящий после p.
+     */
+    std::unordered_set< size_t > updated_only_ids;
+    for( const auto& entry : updated_only ) updated_only_ids.insert( entry.mId );
+    std::unordered_map< size_t, size_t > next, updated_index;
+    std::unordered_map< size_t, uint64_t > old_hashes;
+    next.reserve( updated_entries.size() + old_only.size() );
+    updated_index.reserve( updated_entries.size() );
+    for( size_t i = 0; i < updated_entries.size(); ++i )
+    {
+        updated_index.emplace( updated_entries[ i ].mId, i );
+        if( updated_only_ids.count( updated_entries[ i ].mId ) != 0 ) continue;
+        next.emplace( updated_entries[ i ].mPredecessor, updated_entries[ i ].mId );
+    }
+    for( const auto& entry : old_only )
+    {
+        /* Два элемента после одного - записи противоречат друг другу, например из-за повторяющихся идентификаторов */
+        if( !next.emplace( entry.mPredecessor, entry.mId ).second ) return false;
+        old_hashes.emplace( entry.mId, entry.mValueHash );
+    }
+
+    /*
+     * Значения старого списка известны только для элементов с тем же хешем значения; остальные получают пустое значение.
+     * Compare< ADDED, DELETED, MOVED > не смотрит на значения, изменения находятся по хешам.
+     */
+    const size_t old_size = next.size();
+    std::vector< Address > old_addresses;
+    old_addresses.reserve( old_size );
+    std::unordered_set< size_t > changed_ids;
+    for( auto it = next.find( SketchEntry::NO_PREDECESSOR ); it != next.end(); it = next.find( it->second ) )
+    {
+        if( old_addresses.size() == old_size ) return false;
+        size_t id = it->second;
+        auto updated = updated_index.find( id );
+        auto hash = old_hashes.find( id );
+        bool same_value = updated != updated_index.end() && ( hash == old_hashes.end() || hash->second == updated_entries[ updated->second ].mValueHash );
+        old_addresses.push_back( { same_value ? updated_addresses[ updated->second ].mValue : InternedString(), id, old_addresses.size() } );
+        if( updated != updated_index.end() && !same_value ) changed_ids.insert( id );
+    }
+    if( old_addresses.size() != old_size ) return false;
+
+    result = Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::MOVED >( old_addresses, updated_addresses );
+    if( !changed_ids.empty() )
+    {
+        std::unordered_map< size_t, size_t > old_index;
+        old_index.reserve( old_addresses.size() );
+        for( size_t i = 0; i < old_addresses.size(); ++i ) old_index.emplace( old_addresses[ i ].mId, i );
+        for( const auto& elem : updated_addresses )
+        {
+            if( changed_ids.count( elem.mId ) == 0 ) continue;
+            result.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, old_addresses[ old_index.at( elem.mId ) ], elem, elem.mPosition, std::nullopt } );
+        }
+    }
+    return true;
+}
@@ -0,0 +1,591 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "address_differ.h"
+#include "patch_codec.h"
+#include "transport_cost.h"
+
+/* @brief Тип кадра репликации */
+enum class FRAME_TYPE : uint8_t
+{
+    SNAPSHOT, PATCH, RESYNC,
+};
+
+/* @brief Кадр репликации */
+struct ReplicationFrame
+{
+    /* Тип кадра */
+    FRAME_TYPE mType;
+
+    /* Номер версии списка, которую дает кадр. Для запроса полного списка - последняя версия подписчика */
+    uint64_t mSequence;
+
+    /* Время отправки (steady_clock, наносекунды) */
+    uint64_t mTimestamp;
+
+    /* Закодированный список адресов или редакционное предписание */
+    std::string mPayload;
+};
+
+/* @brief Текущее время steady_clock в наносекундах */
+uint64_t SteadyNowNs()
+{
+    return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/*
+ * @brief Состояние реплики без привязки к транспорту.
+ * Применяет предписания строго по порядку номеров. При пропуске номера требует полный список
+ * и игнорирует предписания до его получения.
+ */
+class ReplicaState
+{
+public:
+
+    /* Результат обработки кадра */
+    enum class RESULT
+    {
+        APPLIED, IGNORED, NEED_RESYNC,
+    };
+
+    /*
+     * @brief Обрабатывает кадр от издателя.
+     * @param frame Кадр.
+     * @return Результат обработки.
+     */
+    RESULT Handle( const ReplicationFrame& frame );
+
+    const std::vector< Address >& Addresses() const { return mAddresses; }
+    uint64_t Sequence() const { return mSequence; }
+    bool Synced() const { return mSynced; }
+
+    size_t PatchesApplied() const { return mPatchesApplied; }
+    size_t SnapshotsApplied() const { return mSnapshotsApplied; }
+    size_t Gaps() const { return mGaps; }
+
+private:
+
+    std::vector< Address > mAddresses;
+    uint64_t mSequence = 0;
+
+    /* Реплика получила полный список и не пропускала предписаний после него */
+    bool mSynced = false;
+
+    size_t mPatchesApplied = 0;
+    size_t mSnapshotsApplied = 0;
+    size_t mGaps = 0;
+};
+
+ReplicaState::RESULT ReplicaState::Handle( const ReplicationFrame& frame )
+{
+    if( frame.mType == FRAME_TYPE::SNAPSHOT )
+    {
+        if( !PatchCodec::DecodeSnapshot( frame.mPayload, mAddresses ) )
+        {
+            mSynced = false;
+            return RESULT::NEED_RESYNC;
+        }
+        mSequence = frame.mSequence;
+        mSynced = true;
+        ++mSnapshotsApplied;
+        return RESULT::APPLIED;
+    }
+
+    if( frame.mType != FRAME_TYPE::PATCH ) return RESULT::IGNORED;
+
+    /* Ждем полный список или получили уже примененное предписание */
+    if( !mSynced || frame.mSequence <= mSequence ) return RESULT::IGNORED;
+
+    CompareResult< Address > patch;
+    if( frame.mSequence != mSequence + 1 || !PatchCodec::DecodePatch( frame.mPayload, patch ) )
+    {
+        ++mGaps;
+        mSynced = false;
+        return RESULT::NEED_RESYNC;
+    }
+
+    mAddresses = DifferAddress( false ).DoEditorialPrescription( patch, mAddresses );
+    mSequence = frame.mSequence;
+    ++mPatchesApplied;
+    return RESULT::APPLIED;
+}
+
+/*
+ * @brief Чтение и запись кадров репликации через потоковый сокет.
+ * Формат кадра: тип (1 байт), номер (8 байт), время (8 байт), длина (4 байта), данные. Числа заголовка - little-endian.
+ */
+class FrameChannel
+{
+public:
+
+    /* Размер заголовка кадра */
+    static constexpr size_t HEADER_SIZE = 1 + 8 + 8 + 4;
+
+    /* Время, за которое кадр должен уйти целиком, по умолчанию */
+    static constexpr int SEND_TIMEOUT_MS = 1000;
+
+    /*
+     * @param fd Потоковый сокет. Переводится в неблокирующий режим, закрывается каналом.
+     */
+    explicit FrameChannel( int fd );
+
+    FrameChannel( FrameChannel&& other ) noexcept;
+    FrameChannel& operator=( FrameChannel&& other ) noexcept;
+    FrameChannel( const FrameChannel& ) = delete;
+    FrameChannel& operator=( const FrameChannel& ) = delete;
+    ~FrameChannel();
+
+    int Fd() const { return mFd; }
+
+    /*
+     * @brief Отправляет кадр целиком, ожидая освобождения буфера сокета не дольше timeout_ms.
+     * @param frame Кадр.
+     * @param timeout_ms Время на отправку всего кадра.
+     * @return false - соединение закрыто или кадр не ушел за отведенное время.
+     * @warning После false кадр мог уйти частично: канал больше непригоден для отправки.
+     */
+    bool Send( const ReplicationFrame& frame, int timeout_ms = SEND_TIMEOUT_MS );
+
+    /*
+     * @brief Читает все доступные данные без блокировки.
+     * @return false - соединение закрыто.
+     */
+    bool Receive();
+
+    /*
+     * @brief Извлекает очередной полностью полученный кадр.
+     * @return false - полного кадра нет.
+     */
+    bool Next( ReplicationFrame& frame );
+
+private:
+
+    /* Запись и чтение числа заголовка побайтно, младшим байтом вперед */
+    static void PutFixed( char* out, uint64_t value, size_t bytes );
+    static uint64_t GetFixed( const char* data, size_t bytes );
+
+    int mFd;
+
+    /* Полученные, но еще не разобранные данные */
+    std::string mBuffer;
+    size_t mOffset = 0;
+};
+
+FrameChannel::FrameChannel( int fd )
+    : mFd( fd )
+{
+    if( mFd >= 0 ) fcntl( mFd, F_SETFL, fcntl( mFd, F_GETFL ) | O_NONBLOCK );
+}
+
+FrameChannel::FrameChannel( FrameChannel&& other ) noexcept
+    : mFd( other.mFd ), mBuffer( std::move( other.mBuffer ) ), mOffset( other.mOffset )
+{
+    other.mFd = -1;
+}
+
+FrameChannel& FrameChannel::operator=( FrameChannel&& other ) noexcept
+{
+    if( this != &other )
+    {
+        if( mFd >= 0 ) close( mFd );
+        mFd = other.mFd;
+        mBuffer = std::move( other.mBuffer );
+        mOffset = other.mOffset;
+        other.mFd = -1;
+    }
+    return *this;
+}
+
+FrameChannel::~FrameChannel()
+{
+    if( mFd >= 0 ) close( mFd );
+}
+
+void FrameChannel::PutFixed( char* out, uint64_t value, size_t bytes )
+{
+    for( size_t byte = 0; byte < bytes; ++byte ) out[ byte ] = static_cast< char >( value >> ( 8 * byte ) );
+}
+
+uint64_t FrameChannel::GetFixed( const char* data, size_t bytes )
+{
+    uint64_t value = 0;
+    for( size_t byte = 0; byte < bytes; ++byte ) value |= static_cast< uint64_t >( static_cast< uint8_t >( data[ byte ] ) ) << ( 8 * byte );
+    return value;
+}
+
+bool FrameChannel::Send( const ReplicationFrame& frame, int timeout_ms )
+{
+    char header[ HEADER_SIZE ];
+    header[ 0 ] = static_cast< char >( frame.mType );
+    PutFixed( header + 1, frame.mSequence, 8 );
+    PutFixed( header + 9, frame.mTimestamp, 8 );
+    PutFixed( header + 17, frame.mPayload.size(), 4 );
+
+    /* Медленный получатель не должен держать отправителя: ждем буфер сокета только до общего срока кадра */
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( timeout_ms );
+    auto send_all = [this, deadline]( const char* data, size_t size )
+    {
+        while( size > 0 )
+        {
+            auto sent = send( mFd, data, size, MSG_NOSIGNAL );
+            if( sent < 0 && errno == EINTR ) continue;
+            if( sent < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            {
+                auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now() ).count();
+                pollfd pfd{ mFd, POLLOUT, 0 };
+                if( remaining <= 0 || poll( &pfd, 1, static_cast< int >( remaining ) ) == 0 ) return false;
+                continue;
+            }
+            if( sent <= 0 ) return false;
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    };
+    return send_all( header, HEADER_SIZE ) && send_all( frame.mPayload.data(), frame.mPayload.size() );
+}
+
+bool FrameChannel::Receive()
+{
+    /* Сдвигаем неразобранный хвост в начало буфера */
+    if( mOffset > 0 )
+    {
+        mBuffer.erase( 0, mOffset );
+        mOffset = 0;
+    }
+
+    char chunk[ 64 * 1024 ];
+    while( true )
+    {
+        auto received = recv( mFd, chunk, sizeof( chunk ), MSG_DONTWAIT );
+        if( received < 0 && errno == EINTR ) continue;
+        if( received < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) return true;
+        if( received <= 0 ) return false;
+        mBuffer.append( chunk, received );
+    }
+}
+
+bool FrameChannel::Next( ReplicationFrame& frame )
+{
+    if( mBuffer.size() - mOffset < HEADER_SIZE ) return false;
+    const char* header = mBuffer.data() + mOffset;
+    auto length = static_cast< size_t >( GetFixed( header + 17, 4 ) );
+    if( mBuffer.size() - mOffset < HEADER_SIZE + length ) return false;
+
+    frame.mType = static_cast< FRAME_TYPE >( header[ 0 ] );
+    frame.mSequence = GetFixed( header + 1, 8 );
+    frame.mTimestamp = GetFixed( header + 9, 8 );
+    frame.mPayload.assign( header + HEADER_SIZE, length );
+    mOffset += HEADER_SIZE + length;
+    return true;
+}
+
+/*
+ * @brief Издатель списка адресов.
+ * Слушает Unix-сокет, новым подписчикам отправляет полный список, далее - предписания между версиями.
+ * Если по модели стоимости полный список доставить дешевле, чем предписание, новая версия отправляется полным списком.
+ * Подписчик, который не принял кадр за время отправки, отключается, чтобы не задерживать остальных;
+ * после переподключения он получает полный список.
+ */
+class ReplicationPublisher
+{
+public:
+
+    /*
+     * @param socket_path Путь к Unix-сокету.
+     * @param initial Начальный список адресов (версия 0).
+     * @param cost_model Модель выбора между предписанием и полным списком.
+     * @param send_timeout_ms Время на отправку кадра одному подписчику.
+     */
+    ReplicationPublisher( const std::string& socket_path, std::vector< Address > initial, TransportCostModel cost_model = {},
+        int send_timeout_ms = FrameChannel::SEND_TIMEOUT_MS );
+    ~ReplicationPublisher();
+
+    ReplicationPublisher( const ReplicationPublisher& ) = delete;
+    ReplicationPublisher& operator=( const ReplicationPublisher& ) = delete;
+
+    /*
+     * @brief Принимает ожидающих подписчиков и отправляет им полный список.
+     * @param timeout_ms Время ожидания первого подписчика.
+     * @return Количество принятых подписчиков.
+     */
+    size_t AcceptSubscribers( int timeout_ms = 0 );
+
+    /*
+     * @brief Публикует новую версию списка: сравнивает с текущей и рассылает предписание или полный список.
+     * @param addresses Новый список адресов.
+     * @return Номер опубликованной версии.
+     */
+    uint64_t Publish( std::vector< Address > addresses );
+
+    /*
+     * @brief Отвечает полным списком на запросы подписчиков, обнаруживших пропуск.
+     * @return Количество отправленных полных списков.
+     */
+    size_t ServeRequests();
+
+    size_t SubscribersCount() const { return mSubscribers.size(); }
+    uint64_t Sequence() const { return mSequence; }
+
+    /* Количество версий, опубликованных предписанием и полным списком */
+    size_t PatchesPublished() const { return mPatchesPublished; }
+    size_t SnapshotsPublished() const { return mSnapshotsPublished; }
+
+    /* Количество подписчиков, отключенных из-за того, что не успевали принимать кадры */
+    size_t SubscribersDropped() const { return mSubscribersDropped; }
+
+private:
+
+    /*
+     * @brief Отправляет кадр подписчику.
+     * @return false - подписчик отключился или не успел принять кадр; его нужно удалить.
+     */
+    bool SendTo( FrameChannel& channel, const ReplicationFrame& frame );
+
+    /* Рассылает кадр всем подписчикам, отключившихся и отстающих удаляет */
+    void Broadcast( const ReplicationFrame& frame );
+
+    ReplicationFrame MakeSnapshotFrame() const;
+
+    std::string mSocketPath;
+    int mListenFd;
+    std::vector< FrameChannel > mSubscribers;
+    std::vector< Address > mCurrent;
+    uint64_t mSequence = 0;
+    TransportCostModel mCostModel;
+    int mSendTimeoutMs;
+    size_t mPatchesPublished = 0;
+    size_t mSnapshotsPublished = 0;
+    size_t mSubscribersDropped = 0;
+};
+
+ReplicationPublisher::ReplicationPublisher( const std::string& socket_path, std::vector< Address > initial, TransportCostModel cost_model,
+    int send_timeout_ms )
+    : mSocketPath( socket_path ), mCurrent( std::move( initial ) ), mCostModel( cost_model ), mSendTimeoutMs( send_timeout_ms )
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if( socket_path.size() >= sizeof( address.sun_path ) ) throw std::invalid_argument( "socket path is too long" );
+    std::strcpy( address.sun_path, socket_path.c_str() );
+
+    mListenFd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( mListenFd < 0 ) throw std::system_error( errno, std::generic_category(), "socket" );
+    unlink( socket_path.c_str() );
+    if( bind( mListenFd, reinterpret_cast< sockaddr* >( &address ), sizeof( address ) ) < 0 || listen( mListenFd, 16 ) < 0 )
+    {
+        int error = errno;
+        close( mListenFd );
+        throw std::system_error( error, std::generic_category(), "bind" );
+    }
+    fcntl( mListenFd, F_SETFL, fcntl( mListenFd, F_GETFL ) | O_NONBLOCK );
+}
+
+ReplicationPublisher::~ReplicationPublisher()
+{
+    close( mListenFd );
+    unlink( mSocketPath.c_str() );
+}
+
+ReplicationFrame ReplicationPublisher::MakeSnapshotFrame() const
+{
+    ReplicationFrame frame{ FRAME_TYPE::SNAPSHOT, mSequence, SteadyNowNs(), {} };
+    PatchCodec::EncodeSnapshot( mCurrent, frame.mPayload );
+    return frame;
+}
+
+size_t ReplicationPublisher::AcceptSubscribers( int timeout_ms )
+{
+    if( timeout_ms != 0 )
+    {
+        pollfd pfd{ mListenFd, POLLIN, 0 };
+        poll( &pfd, 1, timeout_ms );
+    }
+
+    size_t accepted = 0;
+    while( true )
+    {
+        int fd = accept( mListenFd, nullptr, nullptr );
+        if( fd < 0 ) break;
+        FrameChannel channel( fd );
+        if( SendTo( channel, MakeSnapshotFrame() ) )
+        {
+            mSubscribers.push_back( std::move( channel ) );
+            ++accepted;
+        }
+    }
+    return accepted;
+}
+
+uint64_t ReplicationPublisher::Publish( std::vector< Address > addresses )
+{
+    /* Время берется до сравнения, чтобы задержка на подписчике включала весь путь от публикации до применения */
+    ReplicationFrame frame{ FRAME_TYPE::PATCH, mSequence + 1, SteadyNowNs(), {} };
+    auto patch = DifferAddress( false ).Compare< OPERATION_TYPE::ADDED, OPERATION_TYPE::DELETED, OPERATION_TYPE::CHANGED, OPERATION_TYPE::MOVED >(
+        mCurrent, addresses );
+    bool snapshot = mCostModel.PreferSnapshot( patch, mCurrent.size(), addresses );
+    mCurrent = std::move( addresses );
+    ++mSequence;
+
+    if( snapshot )
+    {
+        frame.mType = FRAME_TYPE::SNAPSHOT;
+        PatchCodec::EncodeSnapshot( mCurrent, frame.mPayload );
+        ++mSnapshotsPublished;
+    }
+    else
+    {
+        PatchCodec::EncodePatch( patch, frame.mPayload );
+        ++mPatchesPublished;
+    }
+    Broadcast( frame );
+    return mSequence;
+}
+
+size_t ReplicationPublisher::ServeRequests()
+{
+    size_t served = 0;
+    for( size_t i = 0; i < mSubscribers.size(); )
+    {
+        auto& channel = mSubscribers[ i ];
+        bool alive = channel.Receive();
+        bool need_snapshot = false;
+        ReplicationFrame request;
+        while( channel.Next( request ) )
+        {
+            need_snapshot |= request.mType == FRAME_TYPE::RESYNC;
+        }
+        if( alive && need_snapshot )
+        {
+            alive = SendTo( channel, MakeSnapshotFrame() );
+            served += alive;
+        }
+
+        if( alive ) ++i;
+        else mSubscribers.erase( mSubscribers.begin() + i );
+    }
+    return served;
+}
+
+bool ReplicationPublisher::SendTo( FrameChannel& channel, const ReplicationFrame& frame )
+{
+    if( channel.Send( frame, mSendTimeoutMs ) ) return true;
+    ++mSubscribersDropped;
+    return false;
+}
+
+void ReplicationPublisher::Broadcast( const ReplicationFrame& frame )
+{
+    mSubscribers.erase(
+        std::remove_if( mSubscribers.begin(), mSubscribers.end(), [&]( FrameChannel& channel ){ return !SendTo( channel, frame ); } ),
+        mSubscribers.end() );
+}
+
+/*
+ * @brief Подписчик издателя списка адресов.
+ * Применяет полученные кадры к реплике и запрашивает полный список при обнаружении пропуска.
+ */
+class ReplicationSubscriber
+{
+public:
+
+    /*
+     * @param socket_path Путь к Unix-сокету издателя.
+     */
+    explicit ReplicationSubscriber( const std::string& socket_path );
+
+    /*
+     * @brief Получает и применяет доступные кадры.
+     * @param timeout_ms Время ожидания данных.
+     * @return Количество примененных кадров.
+     */
+    size_t Poll( int timeout_ms = 0 );
+
+    /*
+     * @brief Обрабатывает кадр, полученный в обход сокета. При пропуске запрашивает полный список.
+     * @param frame Кадр.
+     * @return Результат обработки.
+     */
+    ReplicaState::RESULT Handle( const ReplicationFrame& frame );
+
+    const ReplicaState& State() const { return mState; }
+
+    /* @brief Соединение с издателем не закрыто. Отключенному издателем подписчику нужно подключиться заново */
+    bool Connected() const { return mConnected; }
+
+    /* @brief Задержка от публикации до применения последнего кадра в наносекундах */
+    uint64_t LastLatencyNs() const { return mLastLatencyNs; }
+
+private:
+
+    static int Connect( const std::string& socket_path );
+
+    FrameChannel mChannel;
+    ReplicaState mState;
+    bool mConnected = true;
+    uint64_t mLastLatencyNs = 0;
+};
+
+ReplicationSubscriber::ReplicationSubscriber( const std::string& socket_path )
+    : mChannel( Connect( socket_path ) )
+{
+}
+
+int ReplicationSubscriber::Connect( const std::string& socket_path )
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if( socket_path.size() >= sizeof( address.sun_path ) ) throw std::invalid_argument( "socket path is too long" );
+    std::strcpy( address.sun_path, socket_path.c_str() );
+
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd < 0 ) throw std::system_error( errno, std::generic_category(), "socket" );
+    if( connect( fd, reinterpret_cast< sockaddr* >( &address ), sizeof( address ) ) < 0 )
+    {
+        int error = errno;
+        close( fd );
+        throw std::system_error( error, std::generic_category(), "connect" );
+    }
+    return fd;
+}
+
+size_t ReplicationSubscriber::Poll( int timeout_ms )
+{
+    pollfd pfd{ mChannel.Fd(), POLLIN, 0 };
+    if( poll( &pfd, 1, timeout_ms ) <= 0 ) return 0;
+    mConnected = mChannel.Receive();
+
+    size_t applied = 0;
+    ReplicationFrame frame;
+    while( mChannel.Next( frame ) )
+    {
+        applied += Handle( frame ) == ReplicaState::RESULT::APPLIED;
+    }
+    return applied;
+}
+
+ReplicaState::RESULT ReplicationSubscriber::Handle( const ReplicationFrame& frame )
+{
+    auto result = mState.Handle( frame );
+    if( result == ReplicaState::RESULT::APPLIED )
+    {
+        mLastLatencyNs = SteadyNowNs() - frame.mTimestamp;
+    }
+    if( result == ReplicaState::RESULT::NEED_RESYNC )
+    {
+        mChannel.Send( { FRAME_TYPE::RESYNC, mState.Sequence(), SteadyNowNs(), {} } );
+    }
+    return result;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <iostream>
+
+/*
+ * @brief Интернированная строка.
+ * Хранит не саму строку, а ссылку на единственную копию значения в пуле строк StringPool.
+ * Копирование - это копирование указателя и увеличение счетчика ссылок, сравнение - сравнение указателей.
+ */
+class InternedString
+{
+public:
+
+    InternedString() = default;
+    InternedString( const char* value );
+    InternedString( const std::string& value );
+    InternedString( std::string_view value );
+
+    InternedString( const InternedString& other );
+    InternedString( InternedString&& other ) noexcept;
+    InternedString& operator=( const InternedString& other );
+    InternedString& operator=( InternedString&& other ) noexcept;
+    ~InternedString();
+
+    /* @brief Возвращает значение строки */
+    const std::string& Str() const;
+
+    /* @brief Возвращает значение строки */
+    std::string_view View() const { return Str(); }
+
+    /* @brief Проверяет, что строка пустая */
+    bool Empty() const { return mEntry == nullptr; }
+
+    /* Одинаковые значения всегда лежат в одной записи пула, поэтому достаточно сравнить указатели */
+    bool operator==( const InternedString& rhs ) const { return mEntry == rhs.mEntry; }
+    bool operator!=( const InternedString& rhs ) const { return mEntry != rhs.mEntry; }
+
+    friend std::ostream& operator<<( std::ostream& os, const InternedString& value );
+
+private:
+
+    friend class StringPool;
+    friend struct std::hash< InternedString >;
+
+    struct Entry
+    {
+        /* Значение строки */
+        std::string mValue;
+
+        /* Количество InternedString, ссылающихся на запись */
+        mutable std::atomic< std::size_t > mRefs{ 0 };
+    };
+
+    /* Запись пула. nullptr - пустая строка */
+    const Entry* mEntry = nullptr;
+};
+
+/*
+ * @brief Пул интернированных строк.
+ * Каждое значение хранится в единственном экземпляре, пока на него ссылается хотя бы одна InternedString.
+ * Все списки адресов, адреса и операции разделяют один пул.
+ */
+class StringPool
+{
+public:
+
+    /* @brief Возвращает пул строк процесса */
+    static StringPool& Instance();
+
+    /*
+     * @brief Возвращает ссылку на единственную копию значения. Если значения нет в пуле - добавляет его.
+     * @param value Значение строки.
+     */
+    InternedString Intern( std::string_view value );
+
+    /* @brief Количество уникальных строк в пуле */
+    std::size_t Size() const;
+
+private:
+
+    friend class InternedString;
+
+    StringPool() = default;
+
+    void Acquire( const InternedString::Entry* entry );
+    void Release( const InternedString::Entry* entry );
+
+    mutable std::mutex mMutex;
+
+    /* Ключ ссылается на значение внутри записи, записи не перемещаются в памяти */
+    std::unordered_map< std::string_view, std::unique_ptr< InternedString::Entry > > mEntries;
+};
+
+StringPool& StringPool::Instance()
+{
+    /* Пул не разрушается при завершении процесса: статические объекты со строками могут пережить его */
+    static StringPool* pool = new StringPool();
+    return *pool;
+}
+
+InternedString StringPool::Intern( std::string_view value )
+{
+    InternedString result;
+    if( value.empty() ) return result;
+
+    std::lock_guard< std::mutex > lock( mMutex );
+    auto it = mEntries.find( value );
+    if( it == mEntries.end() )
+    {
+        auto entry = std::make_unique< InternedString::Entry >();
+        entry->mValue = std::string( value );
+        std::string_view key = entry->mValue;
+        it = mEntries.emplace( key, std::move( entry ) ).first;
+    }
+    /* Переход 0 -> 1 выполняется только под мьютексом, поэтому запись не может быть удалена в этот момент */
+    it->second->mRefs.fetch_add( 1, std::memory_order_relaxed );
+    result.mEntry = it->second.get();
+    return result;
+}
+
+std::size_t StringPool::Size() const
+{
+    std::lock_guard< std::mutex > lock( mMutex );
+    return mEntries.size();
+}
+
+void StringPool::Acquire( const InternedString::Entry* entry )
+{
+    entry->mRefs.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void StringPool::Release( const InternedString::Entry* entry )
+{
+    /* Пока ссылка не последняя - уменьшаем счетчик без блокировки */
+    auto refs = entry->mRefs.load( std::memory_order_relaxed );
+    while( refs > 1 )
+    {
+        if( entry->mRefs.compare_exchange_weak( refs, refs - 1, std::memory_order_acq_rel ) ) return;
+    }
+
+    /* Последняя ссылка: переход 1 -> 0 и удаление записи выполняются под мьютексом, чтобы не пересечься с Intern */
+    std::lock_guard< std::mutex > lock( mMutex );
+    if( entry->mRefs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+        mEntries.erase( std::string_view( entry->mValue ) );
+    }
+}
+
+InternedString::InternedString( const char* value )
+    : InternedString( std::string_view( value ) ) {}
+
+InternedString::InternedString( const std::string& value )
+    : InternedString( std::string_view( value ) ) {}
+
+InternedString::InternedString( std::string_view value )
+    : InternedString( StringPool::Instance().Intern( value ) ) {}
+
+InternedString::InternedString( const InternedString& other )
+    : mEntry( other.mEntry )
+{
+    if( mEntry ) StringPool::Instance().Acquire( mEntry );
+}
+
+InternedString::InternedString( InternedString&& other ) noexcept
+    : mEntry( other.mEntry )
+{
+    other.mEntry = nullptr;
+}
+
+InternedString& InternedString::operator=( const InternedString& other )
+{
+    if( mEntry != other.mEntry )
+    {
+        if( other.mEntry ) StringPool::Instance().Acquire( other.mEntry );
+        if( mEntry ) StringPool::Instance().Release( mEntry );
+        mEntry = other.mEntry;
+    }
+    return *this;
+}
+
+InternedString& InternedString::operator=( InternedString&& other ) noexcept
+{
+    if( this != &other )
+    {
+        if( mEntry ) StringPool::Instance().Release( mEntry );
+        mEntry = other.mEntry;
+        other.mEntry = nullptr;
+    }
+    return *this;
+}
+
+InternedString::~InternedString()
+{
+    if( mEntry ) StringPool::Instance().Release( mEntry );
+}
+
+const std::string& InternedString::Str() const
+{
+    static const std::string empty;
+    return mEntry ? mEntry->mValue : empty;
+}
+
+std::ostream& operator<<( std::ostream& os, const InternedString& value )
+{
+    os << value.Str();
+    return os;
+}
+
+namespace std
+{
+    template<>
+    struct hash< InternedString >
+    {
+        std::size_t operator()( const InternedString& value ) const noexcept
+        {
+            return std::hash< const void* >()( value.mEntry );
+        }
+    };
+}
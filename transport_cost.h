@@ -0,0 +1,281 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "address_differ.h"
+#include "patch_codec.h"
+
+/* @brief Оценка стоимости передачи и применения */
+struct TransportEstimate
+{
+    /* Размер закодированных данных, байт */
+    size_t mBytes = 0;
+
+    /* Время передачи, нс */
+    double mTransferNs = 0;
+
+    /* Время разбора и применения на подписчике, нс */
+    double mApplyNs = 0;
+
+    double TotalNs() const { return mTransferNs + mApplyNs; }
+};
+
+/*
+ * @brief Модель стоимости доставки новой версии списка: предписанием или полным списком.
+ * Размер считается точно по формату PatchCodec. Время применения предписания следует за DoEditorialPrescription:
+ * копирование списка, сдвиг хвоста при добавлении и удалении, поиск по идентификатору, пошаговые перемещения
+ * или одно копирование, если кодек заменит их перестановкой.
+ * Коэффициенты задаются вручную или замеряются Calibrate на текущей машине.
+ */
+class TransportCostModel
+{
+public:
+
+    /* @brief Коэффициенты модели, нс */
+    struct Coefficients
+    {
+        /* Передача байта через сокет */
+        double mTransferNsPerByte = 0.5;
+
+        /* Разбор байта закодированных данных */
+        double mDecodeNsPerByte = 1.0;
+
+        /* Разбор адреса: создание элемента и поиск строки в пуле */
+        double mDecodeNsPerAddress = 60.0;
+
+        /* Копирование элемента списка и исправление его позиции */
+        double mCopyNsPerElement = 5.0;
+
+        /* Сравнение идентификатора при поиске элемента */
+        double mScanNsPerElement = 0.5;
+
+        /* Сдвиг элемента при вставке и удалении, обмен при перемещении */
+        double mShiftNsPerElement = 2.0;
+    };
+
+    TransportCostModel() = default;
+
+    explicit TransportCostModel( const Coefficients& coefficients )
+        : mCoefficients( coefficients ) {}
+
+    /*
+     * @brief Оценивает доставку предписания.
+     * @param compare_result Редакционное предписание.
+     * @param old_size Размер списка, к которому применяется предписание.
+     */
+    TransportEstimate EstimatePatch( const CompareResult< Address >& compare_result, size_t old_size ) const;
+
+    /*
+     * @brief Оценивает доставку полного списка.
+     * @param addresses Список адресов.
+     */
+    TransportEstimate EstimateSnapshot( const std::vector< Address >& addresses ) const;
+
+    /*
+     * @brief Выбирает способ доставки новой версии.
+     * @param compare_result Предписание между текущей и новой версиями.
+     * @param old_size Размер текущей версии.
+     * @param updated_addresses Новая версия.
+     * @return true - дешевле отправить полный список.
+     */
+    bool PreferSnapshot( const CompareResult< Address >& compare_result, size_t old_size, const std::vector< Address >& updated_addresses ) const;
+
+    /*
+     * @brief Замеряет коэффициенты на текущей машине.
+     * @details Разбор снимков с короткими и длинными значениями разделяет стоимость байта и адреса,
+     * пустое предписание дает стоимость копирования, изменения последнего элемента - стоимость поиска,
+     * перемещения через весь список - стоимость сдвига,
+     * передача через пару Unix-сокетов - стоимость байта в сокете.
+     * @param list_size Размер списков для замеров.
+     */
+    static TransportCostModel Calibrate( size_t list_size = 4000 );
+
+    const Coefficients& GetCoefficients() const { return mCoefficients; }
+
+private:
+
+    /* Минимальное время выполнения fn из repeats попыток, нс */
+    template< typename Fn >
+    static double MeasureNs( Fn fn, size_t repeats = 5 );
+
+    /* Время передачи buffer через пару Unix-сокетов, нс */
+    static double MeasureTransferNs( const std::string& buffer );
+
+    Coefficients mCoefficients;
+};
+
+TransportEstimate TransportCostModel::EstimatePatch( const CompareResult< Address >& compare_result, size_t old_size ) const
+{
+    const auto& c = mCoefficients;
+    TransportEstimate estimate;
+    size_t addresses = 0;
+    double scans = 0;
+    double shifts = 0;
+
+    /* Вставка сдвигает хвост списка */
+    size_t size = old_size;
+    for( const auto& elem : compare_result.mAddedOperations )
+    {
+        shifts += size - std::min( size, elem.mPositionStart );
+        ++size;
+    }
+    /* Удаление: поиск до элемента и сдвиг хвоста, вместе - весь список. Позиция элемента в этот момент неизвестна, берем середину */
+    for( size_t i = 0; i < compare_result.mDeletedOperations.size(); ++i )
+    {
+        scans += size / 2.0;
+        shifts += size / 2.0;
+        --size;
+    }
+    /* Изменение: поиск до элемента */
+    for( const auto& elem : compare_result.mChandedOperations )
+    {
+        scans += std::min( size, elem.mPositionStart + 1 );
+    }
+    /* Перемещения, закодированные перестановкой, применяются одним копированием ее элементов */
+    std::vector< size_t > permutation;
+    bool reorder = PatchCodec::PermutationFor( compare_result, permutation );
+    double copies = reorder ? permutation.size() : 0;
+    for( const auto& elem : compare_result.mMovedOperations )
+    {
+        if( reorder ) break;
+        if( elem.mPositionEnd ) shifts += elem.mPositionStart > *elem.mPositionEnd ? elem.mPositionStart - *elem.mPositionEnd : *elem.mPositionEnd - elem.mPositionStart;
+    }
+
+    estimate.mBytes = PatchCodec::EncodedSize( compare_result );
+    for( const auto* operations : { &compare_result.mAddedOperations, &compare_result.mDeletedOperations, &compare_result.mChandedOperations, &compare_result.mMovedOperations } )
+    {
+        if( reorder && operations == &compare_result.mMovedOperations ) break;
+        for( const auto& elem : *operations )
+        {
+            addresses += elem.mNewValue ? 2 : 1;
+        }
+    }
+
+    estimate.mTransferNs = c.mTransferNsPerByte * estimate.mBytes;
+    estimate.mApplyNs = c.mDecodeNsPerByte * estimate.mBytes + c.mDecodeNsPerAddress * addresses
+                      + c.mCopyNsPerElement * ( old_size + compare_result.mAddedOperations.size() + copies )
+                      + c.mScanNsPerElement * scans + c.mShiftNsPerElement * shifts;
+    return estimate;
+}
+
+TransportEstimate TransportCostModel::EstimateSnapshot( const std::vector< Address >& addresses ) const
+{
+    const auto& c = mCoefficients;
+    TransportEstimate estimate;
+    estimate.mBytes = 1 + PatchCodec::VarintSize( addresses.size() );
+    for( const auto& elem : addresses )
+    {
+        estimate.mBytes += PatchCodec::EncodedSize( elem );
+    }
+    estimate.mTransferNs = c.mTransferNsPerByte * estimate.mBytes;
+    estimate.mApplyNs = c.mDecodeNsPerByte * estimate.mBytes + c.mDecodeNsPerAddress * addresses.size();
+    return estimate;
+}
+
+bool TransportCostModel::PreferSnapshot( const CompareResult< Address >& compare_result, size_t old_size, const std::vector< Address >& updated_addresses ) const
+{
+    return EstimateSnapshot( updated_addresses ).TotalNs() < EstimatePatch( compare_result, old_size ).TotalNs();
+}
+
+template< typename Fn >
+double TransportCostModel::MeasureNs( Fn fn, size_t repeats )
+{
+    double best = 0;
+    for( size_t i = 0; i < repeats; ++i )
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        double ns = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count();
+        if( i == 0 || ns < best ) best = ns;
+    }
+    return best;
+}
+
+double TransportCostModel::MeasureTransferNs( const std::string& buffer )
+{
+    int fds[ 2 ];
+    if( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) < 0 ) return 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer( [&]()
+    {
+        for( size_t sent = 0; sent < buffer.size(); )
+        {
+            auto n = write( fds[ 0 ], buffer.data() + sent, buffer.size() - sent );
+            if( n <= 0 ) break;
+            sent += n;
+        }
+    } );
+    std::vector< char > chunk( 1 << 16 );
+    for( size_t received = 0; received < buffer.size(); )
+    {
+        auto n = read( fds[ 1 ], chunk.data(), chunk.size() );
+        if( n <= 0 ) break;
+        received += n;
+    }
+    writer.join();
+    double ns = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count();
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    return ns;
+}
+
+TransportCostModel TransportCostModel::Calibrate( size_t list_size )
+{
+    list_size = std::max< size_t >( list_size, 16 );
+    Coefficients c;
+
+    /* Снимки одинакового размера с короткими и длинными значениями */
+    std::vector< Address > short_values, long_values;
+    for( size_t i = 0; i < list_size; ++i )
+    {
+        short_values.push_back( { "s" + std::to_string( i ), i + 1, i } );
+        long_values.push_back( { std::string( 200, 'l' ) + std::to_string( i ), i + 1, i } );
+    }
+    std::string short_encoded, long_encoded;
+    PatchCodec::EncodeSnapshot( short_values, short_encoded );
+    PatchCodec::EncodeSnapshot( long_values, long_encoded );
+
+    std::vector< Address > decoded;
+    double short_ns = MeasureNs( [&]{ PatchCodec::DecodeSnapshot( short_encoded, decoded ); } );
+    double long_ns = MeasureNs( [&]{ PatchCodec::DecodeSnapshot( long_encoded, decoded ); } );
+    c.mDecodeNsPerByte = std::max( 0.0, ( long_ns - short_ns ) / ( long_encoded.size() - short_encoded.size() ) );
+    c.mDecodeNsPerAddress = std::max( 0.0, ( short_ns - c.mDecodeNsPerByte * short_encoded.size() ) / list_size );
+
+    /* Пустое предписание: только копирование и исправление позиций */
+    DifferAddress differ( false );
+    CompareResult< Address > empty;
+    double copy_ns = MeasureNs( [&]{ decoded = differ.DoEditorialPrescription( empty, short_values ); } );
+    c.mCopyNsPerElement = copy_ns / list_size;
+
+    /* Изменения последнего элемента: поиск через весь список */
+    const size_t repeats = 16;
+    CompareResult< Address > changes;
+    for( size_t i = 0; i < repeats; ++i )
+    {
+        changes.mChandedOperations.push_back( { OPERATION_TYPE::CHANGED, short_values.back(), short_values.front(), list_size - 1, std::nullopt } );
+    }
+    double changes_ns = MeasureNs( [&]{ decoded = differ.DoEditorialPrescription( changes, short_values ); } );
+    c.mScanNsPerElement = std::max( 0.0, ( changes_ns - copy_ns ) / ( repeats * list_size ) );
+
+    /* Перемещения через весь список туда и обратно */
+    CompareResult< Address > moves;
+    for( size_t i = 0; i < repeats; ++i )
+    {
+        bool forward = i % 2 == 0;
+        moves.mMovedOperations.push_back( { OPERATION_TYPE::MOVED, {}, std::nullopt, forward ? 0 : list_size - 1, forward ? list_size - 1 : 0 } );
+    }
+    double moves_ns = MeasureNs( [&]{ decoded = differ.DoEditorialPrescription( moves, short_values ); } );
+    c.mShiftNsPerElement = std::max( 0.0, ( moves_ns - copy_ns ) / ( repeats * ( list_size - 1 ) ) );
+
+    std::string transfer( 1 << 20, 'x' );
+    if( double transfer_ns = MeasureTransferNs( transfer ); transfer_ns > 0 ) c.mTransferNsPerByte = transfer_ns / transfer.size();
+
+    return TransportCostModel( c );
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include "address_differ.h"
+
+/* @brief Опубликованная версия списка адресов. После публикации не изменяется */
+struct SnapshotVersion
+{
+    /* Номер версии */
+    size_t mVersion;
+
+    /* Список адресов версии */
+    std::vector< Address > mAddresses;
+};
+
+/*
+ * @brief Хранилище версий списка адресов для одного писателя и множества читателей.
+ * Писатель применяет редакционное предписание к своей копии и атомарно публикует ее.
+ * Читатели не блокируются и видят только полностью примененные версии. Одновременно живущих ReadGuard
+ * не больше max_readers: лишнее чтение не ждет освобождения слота, а завершается исключением.
+ * Старые версии освобождаются по эпохам (epoch-based reclamation): версия удаляется,
+ * когда ни один читатель, зашедший до ее замены, больше ее не держит.
+ */
+class VersionedSnapshot
+{
+public:
+
+    /*
+     * @brief Доступ читателя к текущей версии. Пока объект жив, версия не будет освобождена.
+     */
+    class ReadGuard
+    {
+    public:
+
+        ReadGuard( ReadGuard&& other ) noexcept;
+        ReadGuard( const ReadGuard& ) = delete;
+        ReadGuard& operator=( const ReadGuard& ) = delete;
+        ReadGuard& operator=( ReadGuard&& ) = delete;
+        ~ReadGuard();
+
+        const SnapshotVersion& operator*() const { return *mVersion; }
+        const SnapshotVersion* operator->() const { return mVersion; }
+
+    private:
+
+        friend class VersionedSnapshot;
+
+        ReadGuard( std::atomic< uint64_t >* slot, const SnapshotVersion* version )
+            : mSlot( slot ), mVersion( version ) {}
+
+        /* Слот читателя с объявленной эпохой */
+        std::atomic< uint64_t >* mSlot;
+
+        /* Версия, которую видит читатель */
+        const SnapshotVersion* mVersion;
+    };
+
+    /*
+     * @param initial Начальный список адресов (версия 0).
+     * @param max_readers Максимальное количество одновременно живущих ReadGuard, во всех потоках вместе.
+     */
+    explicit VersionedSnapshot( std::vector< Address > initial, size_t max_readers = 64 );
+    ~VersionedSnapshot();
+
+    VersionedSnapshot( const VersionedSnapshot& ) = delete;
+    VersionedSnapshot& operator=( const VersionedSnapshot& ) = delete;
+
+    /*
+     * @brief Возвращает текущую версию для чтения. Не блокируется.
+     * @details Исключение std::runtime_error - все max_readers слотов заняты живыми ReadGuard.
+     */
+    ReadGuard Read() const;
+
+    /*
+     * @brief Применяет редакционное предписание к текущей версии и публикует результат.
+     * @param compare_result Редакционное предписание.
+     * @return Номер опубликованной версии.
+     */
+    size_t Apply( const CompareResult< Address >& compare_result );
+
+    /*
+     * @brief Публикует новый список адресов целиком.
+     * @param addresses Новый список адресов.
+     * @return Номер опубликованной версии.
+     */
+    size_t Publish( std::vector< Address > addresses );
+
+    /* @brief Освобождает версии, которые больше не видны читателям. Возвращает количество освобожденных версий */
+    size_t Reclaim();
+
+    /* @brief Количество замененных, но еще не освобожденных версий */
+    size_t RetiredCount() const;
+
+private:
+
+    /* Замененная версия, ожидающая освобождения */
+    struct Retired
+    {
+        /* Эпоха, в которой версия была заменена */
+        uint64_t mEpoch;
+
+        std::unique_ptr< const SnapshotVersion > mVersion;
+    };
+
+    /* Слот читателя на отдельной кэш-линии. 0 - слот свободен, иначе - эпоха, в которой читатель зашел */
+    struct alignas( 64 ) ReaderSlot
+    {
+        std::atomic< uint64_t > mEpoch{ 0 };
+    };
+
+    /* Публикует версию и освобождает старые. Вызывается под mWriterMutex */
+    size_t PublishVersion( std::unique_ptr< SnapshotVersion > version );
+
+    /* Освобождает версии, которые больше не видны читателям. Вызывается под mWriterMutex */
+    size_t ReclaimRetired();
+
+    /* Текущая опубликованная версия */
+    std::atomic< const SnapshotVersion* > mCurrent;
+
+    /* Глобальная эпоха, увеличивается при каждой публикации */
+    std::atomic< uint64_t > mEpoch{ 1 };
+
+    std::unique_ptr< ReaderSlot[] > mSlots;
+    size_t mSlotsCount;
+
+    /* Сериализует писателей. Читатели его не берут */
+    mutable std::mutex mWriterMutex;
+
+    /* Версии, ожидающие освобождения. Доступ только под mWriterMutex */
+    std::vector< Retired > mRetired;
+};
+
+VersionedSnapshot::ReadGuard::ReadGuard( ReadGuard&& other ) noexcept
+    : mSlot( other.mSlot ), mVersion( other.mVersion )
+{
+    other.mSlot = nullptr;
+    other.mVersion = nullptr;
+}
+
+VersionedSnapshot::ReadGuard::~ReadGuard()
+{
+    if( mSlot ) mSlot->store( 0, std::memory_order_release );
+}
+
+VersionedSnapshot::VersionedSnapshot( std::vector< Address > initial, size_t max_readers )
+    : mCurrent( new SnapshotVersion{ 0, std::move( initial ) } ),
+      mSlots( new ReaderSlot[ max_readers ] ),
+      mSlotsCount( max_readers )
+{
+    assert( max_readers > 0 );
+}
+
+VersionedSnapshot::~VersionedSnapshot()
+{
+    delete mCurrent.load();
+}
+
+VersionedSnapshot::ReadGuard VersionedSnapshot::Read() const
+{
+    /* Начинаем поиск свободного слота с места, зависящего от потока, чтобы читатели не толкались на одном слоте */
+    size_t start = std::hash< std::thread::id >()( std::this_thread::get_id() ) % mSlotsCount;
+    for( size_t attempt = 0; attempt < mSlotsCount; ++attempt )
+    {
+        auto& slot = mSlots[ ( start + attempt ) % mSlotsCount ].mEpoch;
+        uint64_t epoch = mEpoch.load( std::memory_order_seq_cst );
+        uint64_t expected = 0;
+        if( slot.compare_exchange_strong( expected, epoch, std::memory_order_seq_cst ) )
+        {
+            /* Указатель читается после объявления эпохи: версия, замененная до этого момента, уже не будет получена */
+            return ReadGuard( &slot, mCurrent.load( std::memory_order_seq_cst ) );
+        }
+    }
+    /* Ожидание слота могло бы не кончиться никогда: например, если этот же поток держит все ReadGuard */
+    throw std::runtime_error( "all " + std::to_string( mSlotsCount ) + " reader slots are busy" );
+}
+
+size_t VersionedSnapshot::Apply( const CompareResult< Address >& compare_result )
+{
+    std::lock_guard< std::mutex > lock( mWriterMutex );
+    const SnapshotVersion* current = mCurrent.load( std::memory_order_acquire );
+    auto addresses = DifferAddress( false ).DoEditorialPrescription( compare_result, current->mAddresses );
+    return PublishVersion( std::make_unique< SnapshotVersion >( SnapshotVersion{ current->mVersion + 1, std::move( addresses ) } ) );
+}
+
+size_t VersionedSnapshot::Publish( std::vector< Address > addresses )
+{
+    std::lock_guard< std::mutex > lock( mWriterMutex );
+    const SnapshotVersion* current = mCurrent.load( std::memory_order_acquire );
+    return PublishVersion( std::make_unique< SnapshotVersion >( SnapshotVersion{ current->mVersion + 1, std::move( addresses ) } ) );
+}
+
+size_t VersionedSnapshot::PublishVersion( std::unique_ptr< SnapshotVersion > version )
+{
+    size_t number = version->mVersion;
+    const SnapshotVersion* previous = mCurrent.exchange( version.release(), std::memory_order_seq_cst );
+    uint64_t epoch = mEpoch.fetch_add( 1, std::memory_order_seq_cst );
+    mRetired.push_back( { epoch, std::unique_ptr< const SnapshotVersion >( previous ) } );
+
+    ReclaimRetired();
+    return number;
+}
+
+size_t VersionedSnapshot::Reclaim()
+{
+    std::lock_guard< std::mutex > lock( mWriterMutex );
+    return ReclaimRetired();
+}
+
+size_t VersionedSnapshot::ReclaimRetired()
+{
+    /* Минимальная эпоха среди активных читателей */
+    uint64_t min_epoch = UINT64_MAX;
+    for( size_t i = 0; i < mSlotsCount; ++i )
+    {
+        uint64_t epoch = mSlots[ i ].mEpoch.load( std::memory_order_seq_cst );
+        if( epoch != 0 && epoch < min_epoch ) min_epoch = epoch;
+    }
+
+    /* Читатель с эпохой больше эпохи замены гарантированно видит уже новую версию */
+    auto it = std::remove_if( mRetired.begin(), mRetired.end(), [min_epoch]( const Retired& retired ){ return retired.mEpoch < min_epoch; } );
+    size_t reclaimed = std::distance( it, mRetired.end() );
+    mRetired.erase( it, mRetired.end() );
+    return reclaimed;
+}
+
+size_t VersionedSnapshot::RetiredCount() const
+{
+    std::lock_guard< std::mutex > lock( mWriterMutex );
+    return mRetired.size();
+}